@@ -17,9 +17,24 @@
  * Author: Adrian Maire escain (at) gmail.com
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <unistd.h>
+#include "HiwonderBatch.hpp"
+#include "HiwonderBusGroup.hpp"
 #include "HiwonderBusServo.hpp"
+#include "HiwonderControlLoop.hpp"
+#include "HiwonderRecording.hpp"
+#include "HiwonderDiscovery.hpp"
+#include "HiwonderRobotDescription.hpp"
+#include "HiwonderTelemetryLog.hpp"
 
 
 // Some raspian OS still don't have C++17 -> no std::optional
@@ -46,23 +61,39 @@ namespace std
 #endif
 
 
-/// Parse and check an argument for a servo ID
+/// Parse a servo ID, in the range [0-253], without printing errors
 ///@arg str: input string
-///@arg pos: argument position, for error message
 ///@return servo id
-std::optional<uint8_t> getServoId(const std::string& str, int pos)
+std::optional<uint8_t> parseServoId(const std::string& str)
 {
-	uint8_t id=0;
+	int id=0;
 	try
 	{
 		id = std::stoi(str);
 	}
 	catch(...)
 	{
-		std::cout << "Error, argument " << pos << " expected "
-		    "to be a valid servo id" << std::endl;
 		return std::nullopt;
 	}
+	if (id<0 || id>=HiwonderRpi::HiwonderBus::BroadcastId)
+	{
+		return std::nullopt;
+	}
+	return static_cast<uint8_t>(id);
+}
+
+/// Parse and check an argument for a servo ID
+///@arg str: input string
+///@arg pos: argument position, for error message
+///@return servo id
+std::optional<uint8_t> getServoId(const std::string& str, int pos)
+{
+	const auto id = parseServoId(str);
+	if (!id)
+	{
+		std::cout << "Error, argument " << pos << " expected "
+		    "to be a valid servo id [0-253]" << std::endl;
+	}
 	return id;
 }
 
@@ -95,6 +126,396 @@ std::optional<uint16_t> getServoAngle(const std::string& str, int pos)
 	return angle;
 }
 
+/// Set by SIGINT to end the monitor or a recording
+std::atomic<bool> interrupted{false};
+
+/// Bus statistics and servo latencies, copied from the I/O thread
+struct MonitorSnapshot
+{
+	HiwonderRpi::HiwonderBus::Stats stats;
+	std::vector<HiwonderRpi::ReplyLatency::Servo> latency;
+	std::vector<uint32_t> turnaroundUs;
+};
+
+/// Print the monitor table
+///@arg ids, telemetry: servos and their last values
+///@arg snapshot: bus state now, previous: at the last refresh
+///@arg elapsedUs: time since the last refresh
+///@arg pollUs: recent poll durations
+void printMonitor( const std::vector<uint8_t>& ids, const std::vector<HiwonderRpi::ServoTelemetry>& telemetry,
+    const MonitorSnapshot& snapshot, const MonitorSnapshot& previous, uint64_t elapsedUs,
+    std::vector<uint32_t> pollUs )
+{
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	out << "  id  position    vin  temp  load  reply mean/p99.5  state\n";
+	for (size_t i=0; i<ids.size(); ++i)
+	{
+		const auto& t = telemetry[i];
+		const auto& latency = snapshot.latency[i];
+		out << std::setw(4) << static_cast<int>(ids[i])
+		    << std::setw(9) << static_cast<float>(t.position)*0.24f << "º"
+		    << std::setw(6) << static_cast<float>(t.vin)/1000.0f << "V"
+		    << std::setw(4) << static_cast<int>(t.temp) << "ºC"
+		    << std::setw(6) << (t.loaded ? "on" : "off")
+		    << std::setw(7) << static_cast<int>(latency.meanUs) << "/"
+		    << std::left << std::setw(7) << snapshot.turnaroundUs[i] << std::right << "us"
+		    << "  " << (latency.degraded ? "degraded" : t.valid ? "ok" : "no reply") << "\n";
+	}
+
+	const auto delta = [&](uint64_t HiwonderRpi::HiwonderBus::Stats::*field)
+	{
+		return snapshot.stats.*field-previous.stats.*field;
+	};
+	out << "\n  bus: " << 100.0*delta(&HiwonderRpi::HiwonderBus::Stats::busyUs)/std::max<uint64_t>(elapsedUs, 1)
+	    << "% utilisation, " << delta(&HiwonderRpi::HiwonderBus::Stats::timeouts) << " timeout(s), "
+	    << delta(&HiwonderRpi::HiwonderBus::Stats::corrupted) << " corrupted, "
+	    << delta(&HiwonderRpi::HiwonderBus::Stats::retries) << " retried, "
+	    << delta(&HiwonderRpi::HiwonderBus::Stats::skipped) << " skipped\n";
+	if (!pollUs.empty())
+	{
+		const auto percentile = [&](double p)
+		{
+			auto nth = pollUs.begin()+static_cast<size_t>(p/100.0*(pollUs.size()-1));
+			std::nth_element(pollUs.begin(), nth, pollUs.end());
+			return *nth;
+		};
+		out << "  poll: p50=" << percentile(50) << "us p99=" << percentile(99)
+		    << "us max=" << percentile(100) << "us\n";
+	}
+	out << "\n  Ctrl-C to quit\n";
+
+	// Home and clear, then the table in a single write
+	std::cout << "\033[H\033[J" << out.str() << std::flush;
+}
+
+/// Poll all the servos found on the bus until Ctrl-C, and refresh a table twice per second.
+/// Positions are read at <positionHz>, vin, temp and load at <statusHz>: the loop
+///     sleeps until each absolute wakeup, so the monitor itself costs little CPU.
+///@return false if no servo was found
+bool runMonitor( double positionHz, double statusHz )
+{
+	HiwonderRpi::BusGroup group;
+	group.addBus("/dev/ttyAMA0");
+
+	HiwonderRpi::ServoDiscovery::Config config;
+	config.inventory = false;
+	std::vector<uint8_t> ids;
+	for (const auto& info: HiwonderRpi::ServoDiscovery::scan(group, config)) ids.push_back(info.id);
+	if (ids.empty())
+	{
+		std::cout << "Error: no servo found" << std::endl;
+		return false;
+	}
+
+	// Learn the reply latency of each servo, and skip the ones not answering
+	auto& executor = group.getExecutor(0);
+	executor.post([](HiwonderRpi::HiwonderBus& bus)
+	{
+		auto latency = bus.getReplyLatency().getConfig();
+		latency.enabled = true;
+		bus.getReplyLatency().setConfig(latency);
+	});
+	executor.wait();
+
+	MonitorSnapshot snapshot, previous;
+	const auto takeSnapshot = [&]
+	{
+		executor.post([&](HiwonderRpi::HiwonderBus& bus)
+		{
+			snapshot.stats = bus.stats();
+			snapshot.latency.clear();
+			snapshot.turnaroundUs.clear();
+			for (auto id: ids)
+			{
+				snapshot.latency.push_back(bus.getReplyLatency().servo(id));
+				snapshot.turnaroundUs.push_back(bus.getReplyLatency().turnaroundUs(id, 0));
+			}
+		}, HiwonderRpi::BusExecutor::Priority::Telemetry);
+		executor.wait();
+	};
+	takeSnapshot();
+	previous = snapshot;
+
+	HiwonderRpi::ControlLoop::Config loopConfig;
+	loopConfig.periodNs = static_cast<int64_t>(1e9/positionHz);
+	HiwonderRpi::ControlLoop loop(loopConfig);
+	const uint64_t statusEvery = std::max<uint64_t>(1, static_cast<uint64_t>(positionHz/statusHz));
+	const uint64_t refreshEvery = std::max<uint64_t>(1, static_cast<uint64_t>(positionHz/2));
+
+	using Clock = std::chrono::steady_clock;
+	const auto toUs = [](Clock::duration d){ return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count()); };
+	std::vector<HiwonderRpi::ServoTelemetry> telemetry(ids.size());
+	std::vector<uint32_t> pollUs;
+	auto lastRefresh = Clock::now();
+
+	interrupted = false;
+	std::signal(SIGINT, [](int){ interrupted = true; });
+	loop.run([&](uint64_t cycle)
+	{
+		const uint8_t fields = cycle%statusEvery==0 ? HiwonderRpi::ServoTelemetry::All : HiwonderRpi::ServoTelemetry::Position;
+		const auto start = Clock::now();
+		group.poll(ids.data(), ids.size(), telemetry.data(), fields);
+		pollUs.push_back(static_cast<uint32_t>(toUs(Clock::now()-start)));
+
+		if (cycle%refreshEvery==0)
+		{
+			takeSnapshot();
+			const auto now = Clock::now();
+			printMonitor(ids, telemetry, snapshot, previous, toUs(now-lastRefresh), pollUs);
+			previous = snapshot;
+			lastRefresh = now;
+			pollUs.clear();
+		}
+		return !interrupted;
+	});
+	std::signal(SIGINT, SIG_DFL);
+	return true;
+}
+
+/// Create a group with the servos <ids> on the default bus
+void addDefaultBus( HiwonderRpi::BusGroup& group, const uint8_t* ids, size_t count )
+{
+	group.addBus("/dev/ttyAMA0");
+	for (size_t i=0; i<count; ++i) group.assign(ids[i], 0);
+}
+
+/// Unload the servos <ids> and record their positions at <rateHz> into <path>, until Ctrl-C
+///     (the servos can be moved by hand meanwhile).
+void runRecord( const std::string& path, double rateHz, const std::vector<uint8_t>& ids )
+{
+	HiwonderRpi::BusGroup group;
+	addDefaultBus(group, ids.data(), ids.size());
+	group.getExecutor(0).post([&ids](HiwonderRpi::HiwonderBus& bus)
+	{
+		for (auto id: ids)
+		{
+			HiwonderRpi::HiwonderBusServo(bus, id).loadOrUnloadWrite(HiwonderRpi::HiwonderBusServo::LoadMode::Unload, true);
+		}
+	}, HiwonderRpi::BusExecutor::Priority::Emergency);
+	group.getExecutor(0).wait();
+
+	HiwonderRpi::ControlLoop::Config loopConfig;
+	loopConfig.periodNs = static_cast<int64_t>(1e9/rateHz);
+	HiwonderRpi::MotionRecorder recorder(path, ids, static_cast<uint32_t>(loopConfig.periodNs/1000));
+	HiwonderRpi::ControlLoop loop(loopConfig);
+	// Keep one frame per period: missed cycles are sampled back-to-back
+	loop.setOverrunPolicy([](uint64_t){ return HiwonderRpi::ControlLoop::OverrunAction::CatchUp; });
+
+	std::vector<HiwonderRpi::ServoTelemetry> telemetry(ids.size());
+	std::vector<int16_t> positions(ids.size(), 500);
+	uint64_t failed = 0;
+	std::cout << "    Recording, Ctrl-C to stop" << std::endl;
+	interrupted = false;
+	std::signal(SIGINT, [](int){ interrupted = true; });
+	loop.run([&](uint64_t)
+	{
+		group.poll(ids.data(), ids.size(), telemetry.data(), HiwonderRpi::ServoTelemetry::Position);
+		// A failed read keeps the previous position
+		for (size_t i=0; i<ids.size(); ++i)
+		{
+			if (telemetry[i].valid) positions[i] = telemetry[i].position;
+			else ++failed;
+		}
+		recorder.append(positions.data());
+		return !interrupted;
+	});
+	std::signal(SIGINT, SIG_DFL);
+	recorder.close();
+
+	std::cout << "    " << recorder.frameCount() << " frame(s) of " << ids.size() << " servo(s), "
+	    << failed << " failed read(s), " << loop.stats().overruns << " overrun(s)" << std::endl;
+}
+
+/// Play a recorded motion: reach the first frame in 1s, then stream the frames
+void runPlay( const std::string& path )
+{
+	const auto recording = HiwonderRpi::MotionRecording::load(path);
+	if (0==recording.frameCount())
+	{
+		std::cout << "    Empty recording" << std::endl;
+		return;
+	}
+
+	HiwonderRpi::BusGroup group;
+	addDefaultBus(group, recording.ids(), recording.servoCount());
+	group.moveTimeWrite(recording.ids(), recording.frame(0), recording.servoCount(), 1000);
+	delay(1000);
+
+	const auto stats = recording.play(group);
+	std::cout << "    " << recording.frameCount() << " frame(s) played, " << stats.overruns << " overrun(s), wakeup latency p99="
+	    << stats.latencyPercentileNs(99)/1000 << "us" << std::endl;
+}
+
+/// Round-trip times of one read command, in us
+struct BenchLatency
+{
+	std::string command;
+	std::vector<uint32_t> us;  /// successful reads
+	uint64_t timeouts = 0;
+	uint64_t corrupted = 0;
+
+	/// Return the round-trip time at <percentile> in [0,100] (us must be sorted)
+	uint32_t at( double percentile ) const
+	{
+		return us.empty() ? 0 : us[static_cast<size_t>(percentile/100.0*(us.size()-1)+0.5)];
+	}
+};
+
+/// Measure the bus with the servos <ids> and print the report (text or JSON).
+///@arg rounds: samples per servo and command
+///@arg write: also measure writes, moving the servos to their current position:
+///    torque is enabled during the measure, then unloaded servos are unloaded again
+///@return false if a servo did not answer at all
+bool runBench( const std::vector<uint8_t>& ids, unsigned rounds, bool json, bool write )
+{
+	using Clock = std::chrono::steady_clock;
+	const auto sinceUs = [](Clock::time_point start)
+	{
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-start).count());
+	};
+	auto& bus = HiwonderRpi::HiwonderBus::defaultBus();
+	bus.open();
+
+	// Positions to hold while writing, and load state to restore after
+	std::vector<int16_t> positions;
+	std::vector<HiwonderRpi::HiwonderBusServo::LoadMode> loads;
+	for (auto id: ids)
+	{
+		const HiwonderRpi::HiwonderBusServo servo(bus, id);
+		const auto position = servo.posRead(std::nothrow);
+		const auto load = servo.loadOrUnloadRead(std::nothrow);
+		if (!position || !load)
+		{
+			std::cout << "Error: servo " << static_cast<int>(id) << ": "
+			    << HiwonderRpi::errorMessage(position ? load.error() : position.error()) << std::endl;
+			return false;
+		}
+		positions.push_back(*position);
+		loads.push_back(*load);
+	}
+
+	// Round-trip time per command
+	std::vector<BenchLatency> latencies(4);
+	latencies[0].command = "position";
+	latencies[1].command = "vin";
+	latencies[2].command = "temp";
+	latencies[3].command = "load";
+	const auto sample = [&](BenchLatency& latency, HiwonderRpi::Error error, Clock::time_point start)
+	{
+		const uint32_t us = sinceUs(start);
+		if (HiwonderRpi::Error::None==error) latency.us.push_back(us);
+		else if (HiwonderRpi::Error::Timeout==error) ++latency.timeouts;
+		else ++latency.corrupted;
+	};
+	for (unsigned n=0; n<rounds; ++n)
+	{
+		for (auto id: ids)
+		{
+			const HiwonderRpi::HiwonderBusServo servo(bus, id);
+			auto start = Clock::now();
+			sample(latencies[0], servo.posRead(std::nothrow).error(), start);
+			start = Clock::now();
+			sample(latencies[1], servo.vinRead(std::nothrow).error(), start);
+			start = Clock::now();
+			sample(latencies[2], servo.tempRead(std::nothrow).error(), start);
+			start = Clock::now();
+			sample(latencies[3], servo.loadOrUnloadRead(std::nothrow).error(), start);
+		}
+	}
+
+	// Pose updates: the moves of all servos in one flush, then the position of each.
+	// The write time lasts until the moves are out on the wire, not only
+	//     copied to the driver buffer. The position reads are only part of
+	//     the pose time, not of the round-trip times of the position command.
+	uint64_t poseUs = 0, writeUs = 0, poseFailures = 0;
+	for (unsigned n=0; write && n<rounds; ++n)
+	{
+		const auto start = Clock::now();
+		bus.hold();
+		for (size_t i=0; i<ids.size(); ++i)
+		{
+			HiwonderRpi::HiwonderBusServo(bus, ids[i]).moveTimeWrite(positions[i], 0, true);
+		}
+		bus.flush();
+		bus.getTransport().drain();
+		writeUs += sinceUs(start);
+		for (auto id: ids)
+		{
+			if (!HiwonderRpi::HiwonderBusServo(bus, id).posRead(std::nothrow)) ++poseFailures;
+		}
+		poseUs += sinceUs(start);
+	}
+	for (size_t i=0; write && i<ids.size(); ++i)
+	{
+		if (HiwonderRpi::HiwonderBusServo::LoadMode::Unload==loads[i])
+		{
+			HiwonderRpi::HiwonderBusServo(bus, ids[i]).loadOrUnloadWrite(HiwonderRpi::HiwonderBusServo::LoadMode::Unload, true);
+		}
+	}
+	const uint64_t frames = static_cast<uint64_t>(rounds)*ids.size();
+	const double writeFramesPerS = writeUs ? frames*1e6/writeUs : 0.0;
+	const double poseHz = writeUs ? rounds*1e6/writeUs : 0.0;
+	const double poseFeedbackHz = poseUs ? rounds*1e6/poseUs : 0.0;
+
+	for (auto& latency: latencies) std::sort(latency.us.begin(), latency.us.end());
+	const auto rate = [](uint64_t count, const BenchLatency& latency)
+	{
+		const uint64_t total = latency.us.size()+latency.timeouts+latency.corrupted;
+		return total ? static_cast<double>(count)/total : 0.0;
+	};
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(4);
+	if (json)
+	{
+		out << "{\"baud\":" << bus.getTransport().baud() << ",\"servos\":[";
+		for (size_t i=0; i<ids.size(); ++i) out << (i ? "," : "") << static_cast<int>(ids[i]);
+		out << "],\"rounds\":" << rounds << ",\"latency_us\":{";
+		for (size_t i=0; i<latencies.size(); ++i)
+		{
+			const auto& l = latencies[i];
+			out << (i ? "," : "") << "\"" << l.command << "\":{\"samples\":" << l.us.size()
+			    << ",\"min\":" << l.at(0) << ",\"p50\":" << l.at(50) << ",\"p90\":" << l.at(90)
+			    << ",\"p99\":" << l.at(99) << ",\"max\":" << l.at(100)
+			    << ",\"timeout_rate\":" << rate(l.timeouts, l) << ",\"corruption_rate\":" << rate(l.corrupted, l) << "}";
+		}
+		out << "}";
+		if (write)
+		{
+			out << ",\"write_frames_per_s\":" << writeFramesPerS << ",\"pose_hz\":" << poseHz
+			    << ",\"pose_feedback_hz\":" << poseFeedbackHz << ",\"pose_read_failures\":" << poseFailures;
+		}
+		out << "}";
+	}
+	else
+	{
+		out << "    " << ids.size() << " servo(s) at " << bus.getTransport().baud() << " bauds, "
+		    << rounds << " round(s)\n"
+		    << "    round-trip (us)   min    p50    p90    p99    max   timeouts  corrupted\n";
+		for (const auto& l: latencies)
+		{
+			out << "    " << std::left << std::setw(15) << l.command << std::right
+			    << std::setw(6) << l.at(0) << std::setw(7) << l.at(50) << std::setw(7) << l.at(90)
+			    << std::setw(7) << l.at(99) << std::setw(7) << l.at(100)
+			    << std::setw(10) << 100*rate(l.timeouts, l) << "%" << std::setw(9) << 100*rate(l.corrupted, l) << "%\n";
+		}
+		out << std::setprecision(1);
+		if (write)
+		{
+			out << "    write throughput: " << writeFramesPerS << " frames/s\n"
+			    << "    pose update rate: " << poseHz << " Hz (moves only), "
+			    << poseFeedbackHz << " Hz (moves and position reads, " << poseFailures << " failed)";
+		}
+		else
+		{
+			out << "    writes not measured (see --write)";
+		}
+	}
+	std::cout << out.str() << std::endl;
+	return true;
+}
+
 /// Print the command help message
 void printHelp()
 {
@@ -106,7 +527,25 @@ void printHelp()
 	" - set_middle <id>: Set the servo with id=<id> to it middle position (500)\n"
 	" - move <id> <angle>: Set the servo with id=<id> to it position=<angle> in 0s\n"
 	" - read_voltage <id>: Return the input voltage for the servo with id=<id>\n"
-	" - read_position <id>: Return the current position of the servo with id=<id>" << std::endl;
+	" - read_position <id>: Return the current position of the servo with id=<id>\n"
+	" - scan: List all the servos connected to the bus\n"
+	" - compile_robot <in> <out>: Compile the robot description <in> (text) to <out> (binary)\n"
+	" - monitor [position_hz] [status_hz]: Show the telemetry of all the servos found and the\n"
+	"   bus statistics, reading positions at position_hz (10) and vin/temp/load at status_hz (1)\n"
+	" - bench [--json] [--rounds N] [--write] <id>...: Measure read round-trip times, timeout and\n"
+	"   corruption rates with the given servos. With --write, also the write throughput and pose\n"
+	"   update rate: the servos are held in place (torque on), the unloaded ones are unloaded after\n"
+	" - record <file> <rate_hz> <id>...: Unload the servos and record their positions into <file>\n"
+	"   until Ctrl-C, while they are moved by hand\n"
+	" - play <file>: Play a recorded motion\n"
+	" - log_export <file> [from_s] [to_s]: Print a telemetry log as CSV, optionally only the\n"
+	"   samples between from_s and to_s seconds after its start\n"
+	" - batch [file]: Run the commands of <file> (or stdin), one per line, keeping the bus open.\n"
+	"   Commands are not waited for, unless asked with wait; writes are sent together before\n"
+	"   a read, a wait or waiting for more input (after each line on a terminal):\n"
+	"     move <id> <angle> [time_ms], set_middle <id>, load <id>, unload <id>,\n"
+	"     read_position <id>, read_voltage <id>, read_temp <id>, wait <ms>\n"
+	"   Text after # is ignored." << std::endl;
 }
 
 bool checkArguments( int num, int exp, const std::string& name )
@@ -180,10 +619,234 @@ auto main(int num, char* args[]) ->int
 		HiwonderRpi::HiwonderBusServo servo(*idOpt);
 		std::cout << "    " << static_cast<float>(servo.posRead())*0.24f << "º" << std::endl;
 	}
-	else if (command == "demo")
+	else if (command == "scan")
+	{
+		if (!checkArguments(num, 0, "scan")) return 1;
+		
+		auto found = HiwonderRpi::ServoDiscovery::scan(HiwonderRpi::HiwonderBus::defaultBus());
+		for (const auto& servo: found)
+		{
+			std::cout << "    id=" << static_cast<int>(servo.id);
+			if (servo.complete)
+			{
+				std::cout << " position=" << static_cast<float>(servo.position)*0.24f << "º"
+				    << " vin=" << static_cast<float>(servo.vin)/1000.0f << "V"
+				    << " temp=" << static_cast<int>(servo.temp) << "ºC"
+				    << " angle_limit=[" << servo.angleLimit.minLimit << "," << servo.angleLimit.maxLimit << "]"
+				    << " vin_limit=[" << servo.vinLimit.minLimit << "," << servo.vinLimit.maxLimit << "]"
+				    << " temp_limit=" << static_cast<int>(servo.tempMaxLimit);
+			}
+			std::cout << std::endl;
+		}
+		std::cout << "    " << found.size() << " servo(s) found" << std::endl;
+	}
+	else if (command == "compile_robot")
+	{
+		if (!checkArguments(num, 2, "compile_robot")) return 1;
+		
+		try
+		{
+			auto robot = HiwonderRpi::RobotDescription::loadText(argsStr[2]);
+			robot.saveBinary(argsStr[3]);
+			std::cout << "    " << robot.jointCount() << " joint(s) on " << robot.busCount() << " bus(es)" << std::endl;
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "monitor")
 	{
-		std::cout <<  "Demoing..." <<  std::endl;
-		//demo(fd);
+		if (num>4 && !checkArguments(num, 2, "monitor")) return 1;
+		
+		double positionHz = 10, statusHz = 1;
+		try
+		{
+			if (num>2) positionHz = std::stod(argsStr[2]);
+			if (num>3) statusHz = std::stod(argsStr[3]);
+		}
+		catch(...)
+		{
+			positionHz = 0;
+		}
+		if (positionHz<=0 || positionHz>1000 || statusHz<=0 || statusHz>positionHz)
+		{
+			std::cout << "Error: rates must be in Hz, with 0 < status_hz <= position_hz <= 1000" << std::endl;
+			return 1;
+		}
+		
+		try
+		{
+			if (!runMonitor(positionHz, statusHz)) return 1;
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "bench")
+	{
+		bool json = false;
+		bool write = false;
+		unsigned rounds = 50;
+		std::vector<uint8_t> ids;
+		for (int i=2; i<num; ++i)
+		{
+			if (argsStr[i]=="--json")
+			{
+				json = true;
+			}
+			else if (argsStr[i]=="--write")
+			{
+				write = true;
+			}
+			else if (argsStr[i]=="--rounds" && i+1<num)
+			{
+				try { rounds = std::stoul(argsStr[++i]); } catch(...) { rounds = 0; }
+				if (!rounds)
+				{
+					std::cout << "Error, --rounds expects a positive number" << std::endl;
+					return 1;
+				}
+			}
+			else
+			{
+				auto idOpt = getServoId(argsStr[i], i-1);
+				if (!idOpt) return 1;
+				ids.push_back(*idOpt);
+			}
+		}
+		if (ids.empty())
+		{
+			std::cout << "Error: bench command expects at least one servo id" << std::endl;
+			printHelp();
+			return 1;
+		}
+		
+		try
+		{
+			if (!runBench(ids, rounds, json, write)) return 1;
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "log_export")
+	{
+		if (num<3 || num>5)
+		{
+			std::cout << "Error: log_export command expects a file and an optional time range" << std::endl;
+			printHelp();
+			return 1;
+		}
+		
+		try
+		{
+			HiwonderRpi::TelemetryLogReader reader(argsStr[2]);
+			double fromS = 0, toS = (reader.endUs()-reader.startUs())/1e6;
+			try
+			{
+				if (num>3) fromS = std::stod(argsStr[3]);
+				if (num>4) toS = std::stod(argsStr[4]);
+			}
+			catch(...)
+			{
+				fromS = -1;
+			}
+			if (fromS<0 || toS<fromS)
+			{
+				std::cout << "Error: the time range is expected in seconds, with 0 <= from_s <= to_s" << std::endl;
+				return 1;
+			}
+			reader.exportCsv(std::cout, reader.startUs()+static_cast<uint64_t>(fromS*1e6),
+			    reader.startUs()+static_cast<uint64_t>(toS*1e6));
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "batch")
+	{
+		if (num!=2 && !checkArguments(num, 1, "batch")) return 1;
+		
+		try
+		{
+			unsigned failed = 0;
+			if (num==2 || argsStr[2]=="-")
+			{
+				failed = HiwonderRpi::Batch::run(HiwonderRpi::HiwonderBus::defaultBus(), std::cin, std::cout, isatty(STDIN_FILENO));
+			}
+			else
+			{
+				std::ifstream file(argsStr[2]);
+				if (!file)
+				{
+					std::cout << "Error: can not open " << argsStr[2] << std::endl;
+					return 1;
+				}
+				failed = HiwonderRpi::Batch::run(HiwonderRpi::HiwonderBus::defaultBus(), file, std::cout);
+			}
+			if (failed) return 1;
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "record")
+	{
+		if (num<5)
+		{
+			std::cout << "Error: record command expects a file, a rate and at least one servo id" << std::endl;
+			printHelp();
+			return 1;
+		}
+		
+		double rateHz = 0;
+		try { rateHz = std::stod(argsStr[3]); } catch(...) {}
+		if (rateHz<=0 || rateHz>1000)
+		{
+			std::cout << "Error, argument 2 expected to be a rate in (0,1000] Hz" << std::endl;
+			return 1;
+		}
+		std::vector<uint8_t> ids;
+		for (int i=4; i<num; ++i)
+		{
+			auto idOpt = getServoId(argsStr[i], i-1);
+			if (!idOpt) return 1;
+			ids.push_back(*idOpt);
+		}
+		
+		try
+		{
+			runRecord(argsStr[2], rateHz, ids);
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "play")
+	{
+		if (!checkArguments(num, 1, "play")) return 1;
+		
+		try
+		{
+			runPlay(argsStr[2]);
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
 	}
 	else
 	{
@@ -0,0 +1,142 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "HiwonderBusBudget.hpp"
+#include "HiwonderBusGroup.hpp"
+#include "HiwonderSimulator.hpp"
+
+
+/// Result of one point of the sweep
+struct ScalingPoint
+{
+	size_t servos = 0;
+	double cycleUs = 0;         /// CPU time of a cycle (group move and position poll)
+	double framesPerS = 0;      /// Frames handled by the driver per second of CPU
+	double wireCycleUs = 0;     /// Bus time of a cycle at the simulated baud rate (slowest bus)
+	bool valid = true;          /// All the polls were answered
+};
+
+/// Run <cycles> cycles of a group move and a position poll of <servos>
+///     servos spread over <buses> simulated buses
+ScalingPoint measure( size_t servos, size_t buses, unsigned cycles )
+{
+	HiwonderRpi::BusGroup group;
+	std::vector<HiwonderRpi::SimulatedTransport*> sims;
+	for (size_t b=0; b<buses; ++b)
+	{
+		sims.push_back(new HiwonderRpi::SimulatedTransport());
+		group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sims.back()));
+	}
+
+	std::vector<uint8_t> ids;
+	std::vector<size_t> perBus(buses);
+	for (size_t i=0; i<servos; ++i)
+	{
+		const uint8_t id = static_cast<uint8_t>(i+1);
+		const size_t bus = i%buses;
+		sims[bus]->addServo(id);
+		group.assign(id, bus);
+		ids.push_back(id);
+		perBus[bus]++;
+	}
+	std::vector<int16_t> positions(servos, 500);
+	std::vector<HiwonderRpi::ServoTelemetry> telemetry(servos);
+
+	using Clock = std::chrono::steady_clock;
+	ScalingPoint point;
+	point.servos = servos;
+	const auto start = Clock::now();
+	for (unsigned n=0; n<cycles; ++n)
+	{
+		for (auto& p: positions) p = static_cast<int16_t>(100+(p+7)%800);
+		group.moveTimeWrite(ids.data(), positions.data(), servos, 20);
+		group.poll(ids.data(), servos, telemetry.data(), HiwonderRpi::ServoTelemetry::Position);
+		for (const auto& t: telemetry) point.valid = point.valid && t.valid;
+	}
+	const double elapsedUs = std::chrono::duration<double, std::micro>(Clock::now()-start).count();
+
+	// A move frame and a read request and reply per servo and cycle
+	point.cycleUs = elapsedUs/cycles;
+	point.framesPerS = 3.0*servos*cycles*1e6/elapsedUs;
+	const HiwonderRpi::BusTimeModel model(sims[0]->baud());
+	const size_t slowest = *std::max_element(perBus.begin(), perBus.end());
+	point.wireCycleUs = model.writeUs(slowest) + slowest*model.telemetryUs(1, HiwonderRpi::ServoTelemetry::Position);
+	return point;
+}
+
+/// Print the help message
+void printHelp()
+{
+	std::cout <<
+	"Scaling of the driver with the number of servos, on simulated buses (no hardware).\n"
+	" ./hiwonder_scaling [buses] [cycles]\n"
+	"\n"
+	"Each cycle is a group move and a position poll of all the servos, swept from\n"
+	"    1 to 253 servos spread over <buses> buses (1). CPU figures are measured,\n"
+	"    bus figures are the wire time of the same cycle at the simulated baud rate." << std::endl;
+}
+
+/// main function
+auto main(int num, char* args[]) ->int
+{
+	size_t buses = 1;
+	unsigned cycles = 200;
+	try
+	{
+		if (num>1) buses = std::stoul(args[1]);
+		if (num>2) cycles = std::stoul(args[2]);
+	}
+	catch(...)
+	{
+		buses = 0;
+	}
+	if (num>3 || 0==buses || buses>16 || 0==cycles)
+	{
+		printHelp();
+		return 1;
+	}
+
+	// Memory held per servo: simulated state, and the driver tables of the benchmark
+	const size_t driverBytes = sizeof(uint8_t)+sizeof(int16_t)+sizeof(HiwonderRpi::ServoTelemetry);
+	std::cout << "    " << buses << " bus(es), " << cycles << " cycle(s) per point\n"
+	    << "    memory per servo: " << sizeof(HiwonderRpi::SimulatedTransport::Servo) << " bytes simulated, "
+	    << driverBytes << " bytes of group tables (id, target, telemetry)\n"
+	    << "    memory per bus: " << sizeof(HiwonderRpi::SimulatedTransport) << " bytes simulated, "
+	    << sizeof(HiwonderRpi::HiwonderBus) << " bytes of driver\n\n"
+	    << "    servos   cycle(us)  frames/s(CPU)  bus cycle(us)  bus rate(Hz)\n";
+
+	for (size_t servos: {1, 2, 4, 8, 16, 32, 64, 128, 192, 253})
+	{
+		const auto point = measure(servos, buses, cycles);
+		std::cout << std::fixed << std::setprecision(1)
+		    << "    " << std::setw(6) << point.servos
+		    << std::setw(12) << point.cycleUs
+		    << std::setw(15) << std::setprecision(0) << point.framesPerS
+		    << std::setw(15) << point.wireCycleUs
+		    << std::setw(14) << std::setprecision(1) << 1e6/point.wireCycleUs
+		    << (point.valid ? "" : "  (missing replies)") << std::endl;
+	}
+}
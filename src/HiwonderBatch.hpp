@@ -0,0 +1,220 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_BATCH
+#define HIWONDER_RPI_BATCH
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderBusServo.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Run servo commands from a text stream, one per line, '#' starts a comment:
+///     move <id> <angle> [time_ms], set_middle <id>, load <id>, unload <id>,
+///     read_position <id>, read_voltage <id>, read_temp <id>, wait <ms>
+/// Commands are not waited for, unless asked with wait. Writes are queued
+///     (see HiwonderBus::hold) and sent together before a read, a wait, and
+///     before waiting for input not received yet: a file or a burst of piped
+///     lines is sent in few writes, while streamed lines go out as they come.
+class Batch
+{
+public:
+	/// Run all the commands of <in> on <bus>
+	/// @arg out: values read and errors (with their line number)
+	/// @arg interactive: also send the writes after each line (terminal input)
+	/// @return number of failed lines
+	/// @throw runtime_error on transport failure (device can not be opened or written)
+	static unsigned run( HiwonderBus& bus, std::istream& in, std::ostream& out, bool interactive=false );
+
+private:
+	/// Run one line, return the error message or an empty string
+	inline static std::string runLine( HiwonderBus& bus, const std::string& line, std::ostream& out );
+
+	/// Run a read command and print the value read, return false on bus error
+	inline static bool read( HiwonderBus& bus, uint8_t id, const std::string& command, std::ostream& out );
+
+	/// Parse an integer in [min,max], return false if it is not valid
+	inline static bool parse( const std::string& str, int min, int max, int& value );
+
+	/// Send the queued writes and keep queuing
+	inline static void send( HiwonderBus& bus );
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+bool Batch::parse( const std::string& str, int min, int max, int& value )
+{
+	size_t end = 0;
+	try
+	{
+		value = std::stoi(str, &end);
+	}
+	catch(...)
+	{
+		return false;
+	}
+	return end==str.size() && value>=min && value<=max;
+}
+
+void Batch::send( HiwonderBus& bus )
+{
+	bus.flush();
+	bus.hold();
+}
+
+bool Batch::read( HiwonderBus& bus, uint8_t id, const std::string& command, std::ostream& out )
+{
+	const HiwonderBusServo servo(bus, id);
+
+	if (command=="read_position")
+	{
+		const auto position = servo.posRead(std::nothrow);
+		if (!position) return false;
+		out << "    id=" << static_cast<int>(id) << " position=" << static_cast<float>(*position)*0.24f << "º" << std::endl;
+	}
+	else if (command=="read_voltage")
+	{
+		const auto vin = servo.vinRead(std::nothrow);
+		if (!vin) return false;
+		out << "    id=" << static_cast<int>(id) << " vin=" << static_cast<float>(*vin)/1000.0f << "V" << std::endl;
+	}
+	else
+	{
+		const auto temp = servo.tempRead(std::nothrow);
+		if (!temp) return false;
+		out << "    id=" << static_cast<int>(id) << " temp=" << static_cast<int>(*temp) << "ºC" << std::endl;
+	}
+	return true;
+}
+
+std::string Batch::runLine( HiwonderBus& bus, const std::string& line, std::ostream& out )
+{
+	std::istringstream words(line.substr(0, line.find('#')));
+	std::vector<std::string> args;
+	for (std::string word; words >> word;) args.push_back(word);
+	if (args.empty()) return "";
+
+	const auto& command = args[0];
+	const auto expect = [&](size_t min, size_t max)
+	{
+		if (args.size()>=min+1 && args.size()<=max+1) return std::string();
+		return command + " expects " + std::to_string(min) +
+		    (min==max ? "" : "-" + std::to_string(max)) + " argument(s)";
+	};
+
+	if (command=="wait")
+	{
+		const auto error = expect(1, 1);
+		if (!error.empty()) return error;
+		int ms = 0;
+		if (!parse(args[1], 0, 3600000, ms)) return "wait expects a time in ms";
+		bus.flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+		bus.hold();
+		return "";
+	}
+
+	if (command!="move" && command!="set_middle" && command!="load" && command!="unload" &&
+	    command!="read_position" && command!="read_voltage" && command!="read_temp")
+	{
+		return "unknown command " + command;
+	}
+
+	const auto error = expect(command=="move" ? 2 : 1, command=="move" ? 3 : 1);
+	if (!error.empty()) return error;
+	int id = 0;
+	if (!parse(args[1], 0, HiwonderBus::BroadcastId-1, id))
+	{
+		return "invalid servo id " + args[1] + ", expected [0-253]";
+	}
+	HiwonderBusServo servo(bus, static_cast<uint8_t>(id));
+
+	if (command=="move")
+	{
+		int angle = 0, time = 0;
+		if (!parse(args[2], 0, 1000, angle)) return "invalid angle " + args[2] + ", expected [0-1000]";
+		if (args.size()>3 && !parse(args[3], 0, 30000, time)) return "invalid time " + args[3] + ", expected [0-30000]";
+		servo.moveTimeWrite(static_cast<int16_t>(angle), static_cast<uint16_t>(time));
+	}
+	else if (command=="set_middle")
+	{
+		servo.moveTimeWrite(500, 0);
+	}
+	else if (command=="load" || command=="unload")
+	{
+		servo.loadOrUnloadWrite(command=="load" ? HiwonderBusServo::LoadMode::Load : HiwonderBusServo::LoadMode::Unload);
+	}
+	else
+	{
+		// The moves queued so far are sent (and out on the wire) before the request
+		send(bus);
+		if (!read(bus, static_cast<uint8_t>(id), command, out))
+		{
+			return "no valid reply from servo " + args[1];
+		}
+	}
+	return "";
+}
+
+unsigned Batch::run( HiwonderBus& bus, std::istream& in, std::ostream& out, bool interactive )
+{
+	bus.open();
+	bus.hold();
+
+	unsigned failed = 0;
+	unsigned lineNumber = 0;
+	std::string line;
+	while (true)
+	{
+		// Nothing buffered: the next line may take time to come, send the writes first
+		if (in.rdbuf()->in_avail()<=0) send(bus);
+		if (!std::getline(in, line)) break;
+		++lineNumber;
+
+		const std::string error = runLine(bus, line, out);
+		if (!error.empty())
+		{
+			out << "Error, line " << lineNumber << ": " << error << std::endl;
+			++failed;
+		}
+		if (interactive) send(bus);
+	}
+
+	bus.flush();
+	return failed;
+}
+
+}
+#endif //HIWONDER_RPI_BATCH
@@ -0,0 +1,795 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_BUS
+#define HIWONDER_RPI_BUS
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "HiwonderReplyLatency.hpp"
+#include "HiwonderResult.hpp"
+#include "HiwonderTransport.hpp"
+
+namespace HiwonderRpi
+{
+
+/// This class represent the UART bus shared by all the servos.
+/// It implements the framing part of the protocol over a HiwonderTransport,
+///     while HiwonderBusServo implements the commands.
+/// A bus is not thread-safe: use it from one thread at a time (see BusGroup).
+///
+/// Write path:
+///     - Redundant writes are dropped: the last frame written for each servo
+///       and idempotent command (move, load/unload, power led) is kept, and a
+///       frame equal to it is not sent again unless forced.
+///     - Between hold() and flush(), writes are queued; a newer write to the
+///       same servo and idempotent command replaces the pending one, unless
+///       another frame for that servo is queued in between. flush() sends
+///       all pending frames in a single system call.
+///
+/// Configuration cache (disabled by default, see setConfigCache):
+///     Settings that only change when written (angle/vin/temp limits, angle
+///     offset, led errors and servo/motor mode) are kept per servo. Reads are
+///     answered from the cache once filled (by a read or refreshConfig), and
+///     the matching writes update it (write-through).
+///
+/// Reads have a throwing form and a non-throwing one (std::nothrow argument)
+///     returning a Result: the latter is meant for control loops on a noisy
+///     bus, where timeouts and corrupted replies are routine. It does not
+///     allocate, and only transport failures (device can not be opened or
+///     written, see open()) are reported by exception.
+///
+/// Failed reads can be retried (see RetryPolicy), within a hard time budget
+///     per transaction and per cycle (see startCycle): a lost reply costs at
+///     most the budget.
+/// Reply timeouts can adapt to the latency observed for each servo, and
+///     servos that stop answering are requested less (see getReplyLatency).
+///
+/// After construction, write, read (both forms), hold and flush do not
+///     allocate: queues are sized up-front and replies use a member buffer.
+class HiwonderBus
+{
+public:
+	using Buffer = std::array<uint8_t,10>;
+
+	/// Message prefix/frame header
+	constexpr static uint8_t FrameHeader = 0x55;
+	/// Broadcast servo ID
+	constexpr static uint8_t BroadcastId = 254;
+	/// Default time to wait for a reply, in us
+	constexpr static uint32_t DefaultReplyTimeoutUs = 20000;
+
+	struct Stats
+	{
+		uint64_t sent = 0;       /// Frames sent
+		uint64_t suppressed = 0; /// Writes dropped because nothing would change
+		uint64_t coalesced = 0;  /// Pending writes replaced by a newer one
+		uint64_t cacheHits = 0;  /// Reads answered by the configuration cache
+		uint64_t timeouts = 0;   /// Read attempts without reply
+		uint64_t corrupted = 0;  /// Read attempts with an invalid reply
+		uint64_t retries = 0;    /// Read attempts repeated after a failure
+		uint64_t overBudget = 0; /// Reads refused or not retried for lack of time budget
+		uint64_t skipped = 0;    /// Reads not sent because the servo is degraded
+		uint64_t busyUs = 0;     /// Bus time used: wire time of writes, and duration of reads
+	};
+
+	/// How failed reads are retried. The default does not retry and has no budget.
+	struct RetryPolicy
+	{
+		/// Attempts after the first failed one
+		uint8_t maxRetries = 0;
+		/// Wait before the first retry (lets a late reply end), doubled at each retry
+		uint32_t backoffUs = 0;
+		/// Upper bound of the wait between retries
+		uint32_t maxBackoffUs = 20000;
+		/// Max time of one read, all attempts included, 0 for no limit
+		uint32_t transactionBudgetUs = 0;
+		/// Max time of all the reads of a cycle (see startCycle), 0 for no limit.
+		///     Once exhausted, reads fail with Error::Budget without being sent.
+		uint32_t cycleBudgetUs = 0;
+	};
+
+	/// Configure the UART device, it is opened on first use (see open()).
+	HiwonderBus( const char* device="/dev/ttyAMA0", int baud=115200 );
+	/// Use the given transport
+	explicit HiwonderBus( std::unique_ptr<HiwonderTransport> transport );
+	/// Bus object can not be copied (UART access is unique)
+	HiwonderBus( const HiwonderBus& ) = delete;
+	HiwonderBus& operator=( const HiwonderBus& ) = delete;
+	~HiwonderBus();
+
+	/// Return the process-wide bus on /dev/ttyAMA0 (the device is opened on first use)
+	static HiwonderBus& defaultBus();
+
+	/// Open the device now instead of on first use
+	/// @throw runtime_error if the device can not be opened
+	void open();
+
+	/// Return the checksum for a given message
+	inline static uint8_t checksum( const Buffer& buf );
+
+	/// Send a write command to the servo(s).
+	/// @arg buf: complete frame (id and checksum set)
+	/// @arg force: send it even if the servo already has this value
+	void write( const Buffer& buf, bool force=false );
+
+	/// Send a read request and return the reply (this function is blocking).
+	/// Queued writes are sent first, and the request waits until they are
+	///     out on the wire (the reply timeout starts with the request).
+	/// @arg buf: complete frame of the request (id and checksum set)
+	/// @arg replySize: expected size of the reply (for checks).
+	/// @throw runtime_error on timeout or corrupted reply
+	const Buffer& read( const Buffer& buf, uint8_t replySize );
+
+	/// Same as read, but bus errors are returned instead of thrown.
+	/// The reply stays valid until the next read.
+	Result<const Buffer*> read( const Buffer& buf, uint8_t replySize, std::nothrow_t );
+
+	/// Start queuing writes until flush()
+	void hold();
+
+	/// Send all queued writes at once, and stop queuing
+	void flush();
+
+	/// Forget the last written values of a servo (e.g. it was power-cycled),
+	///     or of all servos with BroadcastId. Next writes will be sent.
+	void invalidate( uint8_t id=BroadcastId );
+
+	/// Enable or disable the configuration cache. The cache starts empty.
+	void setConfigCache( bool enable );
+
+	/// Read all the cached settings of a servo from the bus at once
+	///     (the configuration cache must be enabled)
+	/// @throw runtime_error on timeout or corrupted reply
+	void refreshConfig( uint8_t id );
+
+	/// Forget the cached settings of a servo, or of all servos with BroadcastId
+	void invalidateConfig( uint8_t id=BroadcastId );
+
+	const Stats& stats() const;
+
+	/// Set the max time to wait for a reply (in us)
+	void setReplyTimeout( uint32_t timeoutUs );
+
+	/// Return the max time to wait for a reply (in us)
+	uint32_t replyTimeout() const;
+
+	/// Replace the retry policy
+	void setRetryPolicy( const RetryPolicy& policy );
+
+	const RetryPolicy& retryPolicy() const;
+
+	/// Start a new cycle: reset the time spent in reads, for the cycle budget
+	void startCycle();
+
+	/// Return the time spent in reads since startCycle (in us)
+	uint32_t cycleTimeUs() const;
+
+	/// Return the underlying transport
+	HiwonderTransport& getTransport();
+
+	/// Return the per-servo reply latency statistics, to configure the
+	///     adaptive timeouts (disabled by default) or inspect degraded servos
+	ReplyLatency& getReplyLatency();
+
+private:
+	/// Commands for which the last written value is tracked
+	constexpr static uint8_t MoveTimeWriteId = 1;
+	constexpr static uint8_t LoadOrUnloadWriteId = 31;
+	constexpr static uint8_t LedCtrlWriteId = 33;
+	constexpr static size_t TrackedCommands = 3;
+
+	/// Read commands of the configuration cache, and their matching write
+	///     command (the write frame has the same payload as the read reply)
+	constexpr static size_t CachedCommands = 6;
+	constexpr static std::array<uint8_t, CachedCommands> CachedReadIds = {19, 21, 23, 25, 30, 36};
+	constexpr static std::array<uint8_t, CachedCommands> CachedWriteIds = {17, 20, 22, 24, 29, 35};
+	constexpr static std::array<uint8_t, CachedCommands> CachedReplySizes = {4, 7, 7, 4, 7, 4};
+	constexpr static uint8_t IdWriteId = 13;
+
+	/// Max number of queued writes, before an automatic flush
+	constexpr static size_t MaxPending = 256;
+
+	/// Return the tracking slot of a command, or -1 if not tracked
+	inline static int trackedSlot( uint8_t commandId );
+
+	/// Return the size of a frame, in bytes
+	inline static size_t frameSize( const Buffer& buf );
+
+	/// Return the time to transmit <bytes> on the wire, in us
+	inline uint32_t wireTimeUs( size_t bytes ) const;
+
+	using Clock = std::chrono::steady_clock;
+
+	/// Get a message from the servo into reply (this function is blocking).
+	/// Return Error::Timeout if the message does not arrive until <deadline>,
+	///     Error::Length if the announced size does not fit a frame.
+	/// Timeout is a busy loop, avoiding long waiting of re-scheduling
+	inline Error getMessage( Clock::time_point deadline );
+
+	/// Busy loop until <count> bytes are available or the deadline is reached.
+	/// Return true if the bytes are available
+	inline bool waitBytes( int count, Clock::time_point deadline );
+
+	/// Basic check on a reply to <request>:
+	///    - If the size of the message is the expected (expect at pos 3)
+	///    - If the checksum match
+	///    - If the commandId is the expected
+	///    - If it comes from the requested servo (unless broadcast)
+	/// Return the first error found, Error::None if valid
+	inline static Error checkMessage( const Buffer& buf, const Buffer& request, size_t expectedSize );
+
+	/// Send the queued writes
+	inline void sendPending();
+
+	/// Return true if the frame would not change anything in the servo
+	inline bool isRedundant( const Buffer& buf ) const;
+
+	/// Update the last written state with a frame
+	inline void track( const Buffer& buf );
+
+	/// Update the configuration cache with a write frame
+	inline void cacheWrite( const Buffer& buf );
+
+	/// Return the cache slot of a read (or write if isWrite) command, or -1 if not cached
+	inline static int cacheSlot( uint8_t commandId, bool isWrite );
+
+	// Access to the device
+	std::unique_ptr<HiwonderTransport> transport;
+	// Last received message
+	Buffer reply{};
+	uint32_t replyTimeoutUs = DefaultReplyTimeoutUs;
+	RetryPolicy retry;
+	uint32_t cycleSpentUs = 0;
+	ReplyLatency latency;
+	// Last frame written, for each servo and tracked command
+	struct Written
+	{
+		Buffer frame{};
+		bool valid = false;
+	};
+	std::array<std::array<Written, TrackedCommands>, 256> written{};
+	// Last reply of each servo and cached read command
+	bool configCache = false;
+	std::array<std::array<Written, CachedCommands>, 256> config{};
+	// Queued writes
+	bool holding = false;
+	std::vector<Buffer> pending;
+	std::vector<uint8_t> txBuf;
+	Stats stat;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+HiwonderBus::HiwonderBus( const char* device, int baud ):
+    HiwonderBus(std::unique_ptr<HiwonderTransport>(new SerialTransport(device, baud)))
+{
+}
+
+HiwonderBus::HiwonderBus( std::unique_ptr<HiwonderTransport> transport ):
+    transport(std::move(transport))
+{
+	if (!this->transport)
+	{
+		throw std::runtime_error("Invalid bus transport");
+	}
+	pending.reserve(MaxPending);
+	txBuf.reserve(MaxPending*sizeof(Buffer));
+}
+
+HiwonderBus::~HiwonderBus()
+{
+	try
+	{
+		flush();
+	}
+	catch(...) {}
+}
+
+HiwonderBus& HiwonderBus::defaultBus()
+{
+	static HiwonderBus bus;
+	return bus;
+}
+
+void HiwonderBus::open()
+{
+	transport->open();
+}
+
+uint8_t HiwonderBus::checksum( const Buffer& buf )
+{
+	uint16_t temp = 0;
+	for (size_t i=2; i<buf[3]+2u; ++i)
+	{
+		temp += buf[i];
+	}
+	temp = ~temp;
+	return static_cast<uint8_t>(temp);
+}
+
+int HiwonderBus::trackedSlot( uint8_t commandId )
+{
+	switch (commandId)
+	{
+		case MoveTimeWriteId: return 0;
+		case LoadOrUnloadWriteId: return 1;
+		case LedCtrlWriteId: return 2;
+		default: return -1;
+	}
+}
+
+size_t HiwonderBus::frameSize( const Buffer& buf )
+{
+	return buf[3]+3u;
+}
+
+bool HiwonderBus::isRedundant( const Buffer& buf ) const
+{
+	const int slot = trackedSlot(buf[4]);
+	if (slot<0 || BroadcastId==buf[2])
+	{
+		return false;
+	}
+	const Written& last = written[buf[2]][slot];
+	return last.valid && last.frame==buf;
+}
+
+void HiwonderBus::track( const Buffer& buf )
+{
+	const uint8_t id = buf[2];
+	const int slot = trackedSlot(buf[4]);
+
+	if (slot<0)
+	{
+		// Other commands (stop, limits, mode, id...) may change the servo
+		//     state in a way we do not model: forget it.
+		invalidate(id);
+		return;
+	}
+
+	// After load/unload, the servo may have been moved by hand
+	const bool forgetMove = LoadOrUnloadWriteId==buf[4];
+
+	if (BroadcastId==id)
+	{
+		for (auto& servo: written)
+		{
+			servo[slot].valid = false;
+			if (forgetMove) servo[trackedSlot(MoveTimeWriteId)].valid = false;
+		}
+		return;
+	}
+
+	written[id][slot].frame = buf;
+	written[id][slot].valid = true;
+
+	if (forgetMove)
+	{
+		written[id][trackedSlot(MoveTimeWriteId)].valid = false;
+	}
+}
+
+int HiwonderBus::cacheSlot( uint8_t commandId, bool isWrite )
+{
+	const auto& ids = isWrite ? CachedWriteIds : CachedReadIds;
+	for (size_t i=0; i<CachedCommands; ++i)
+	{
+		if (ids[i]==commandId) return static_cast<int>(i);
+	}
+	return -1;
+}
+
+void HiwonderBus::cacheWrite( const Buffer& buf )
+{
+	const uint8_t id = buf[2];
+	if (!configCache)
+	{
+		return;
+	}
+	if (IdWriteId==buf[4])
+	{
+		// The servo changes its id: both ids are unknown now
+		invalidateConfig(id);
+		invalidateConfig(buf[5]);
+		return;
+	}
+
+	const int slot = cacheSlot(buf[4], true);
+	if (slot<0)
+	{
+		return;
+	}
+	if (BroadcastId==id)
+	{
+		for (auto& servo: config) servo[slot].valid = false;
+		return;
+	}
+
+	// Build the reply the servo would send to the matching read
+	Written& entry = config[id][slot];
+	entry.frame = buf;
+	entry.frame[4] = CachedReadIds[slot];
+	entry.frame[entry.frame[3]+2] = checksum(entry.frame);
+	entry.valid = true;
+}
+
+void HiwonderBus::setConfigCache( bool enable )
+{
+	configCache = enable;
+	invalidateConfig();
+}
+
+void HiwonderBus::invalidateConfig( uint8_t id )
+{
+	if (BroadcastId==id)
+	{
+		for (auto& servo: config)
+		{
+			for (auto& command: servo) command.valid = false;
+		}
+		return;
+	}
+	for (auto& command: config[id]) command.valid = false;
+}
+
+void HiwonderBus::refreshConfig( uint8_t id )
+{
+	if (!configCache)
+	{
+		throw std::runtime_error("Configuration cache is disabled");
+	}
+	invalidateConfig(id);
+
+	for (size_t i=0; i<CachedCommands; ++i)
+	{
+		// Request frame: header, id, size, command, checksum
+		Buffer buf{FrameHeader, FrameHeader, id, 3, CachedReadIds[i]};
+		buf[5] = checksum(buf);
+		read(buf, CachedReplySizes[i]);
+	}
+}
+
+void HiwonderBus::write( const Buffer& buf, bool force )
+{
+	if (!force && isRedundant(buf))
+	{
+		stat.suppressed++;
+		return;
+	}
+	track(buf);
+	cacheWrite(buf);
+
+	if (!holding)
+	{
+		transport->write(buf.data(), frameSize(buf));
+		stat.sent++;
+		stat.busyUs += wireTimeUs(frameSize(buf));
+		return;
+	}
+
+	// Coalesce: drop the pending write to the same servo/command, the latest
+	//     one is queued at the end. Only idempotent commands are merged, and
+	//     only if no other frame for the servo is in between (e.g. a waiting
+	//     move started, or an offset saved, by the frames that follow it).
+	if (trackedSlot(buf[4])>=0)
+	{
+		for (auto it=pending.rbegin(); it!=pending.rend(); ++it)
+		{
+			if ((*it)[2]==buf[2] && (*it)[4]==buf[4])
+			{
+				pending.erase(std::next(it).base());
+				stat.coalesced++;
+				break;
+			}
+			if ((*it)[2]==buf[2] || BroadcastId==(*it)[2] || BroadcastId==buf[2])
+			{
+				break;
+			}
+		}
+	}
+	if (pending.size()>=MaxPending)
+	{
+		sendPending();
+	}
+	pending.push_back(buf);
+}
+
+void HiwonderBus::hold()
+{
+	holding = true;
+}
+
+void HiwonderBus::flush()
+{
+	holding = false;
+	sendPending();
+}
+
+void HiwonderBus::sendPending()
+{
+	if (pending.empty())
+	{
+		return;
+	}
+
+	txBuf.clear();
+	for (const auto& buf: pending)
+	{
+		txBuf.insert(txBuf.end(), buf.begin(), buf.begin()+frameSize(buf));
+	}
+	stat.sent += pending.size();
+	stat.busyUs += wireTimeUs(txBuf.size());
+	pending.clear();
+	transport->write(txBuf.data(), txBuf.size());
+}
+
+void HiwonderBus::invalidate( uint8_t id )
+{
+	if (BroadcastId==id)
+	{
+		for (auto& servo: written)
+		{
+			for (auto& command: servo) command.valid = false;
+		}
+		return;
+	}
+	for (auto& command: written[id]) command.valid = false;
+}
+
+const HiwonderBus::Stats& HiwonderBus::stats() const
+{
+	return stat;
+}
+
+void HiwonderBus::setReplyTimeout( uint32_t timeoutUs )
+{
+	replyTimeoutUs = timeoutUs;
+}
+
+uint32_t HiwonderBus::replyTimeout() const
+{
+	return replyTimeoutUs;
+}
+
+HiwonderTransport& HiwonderBus::getTransport()
+{
+	return *transport;
+}
+
+ReplyLatency& HiwonderBus::getReplyLatency()
+{
+	return latency;
+}
+
+uint32_t HiwonderBus::wireTimeUs( size_t bytes ) const
+{
+	// 10 bits per byte (start, 8 data, stop)
+	return static_cast<uint32_t>(bytes*10*1000000ull/std::max(transport->baud(), 1));
+}
+
+void HiwonderBus::setRetryPolicy( const RetryPolicy& policy )
+{
+	retry = policy;
+}
+
+const HiwonderBus::RetryPolicy& HiwonderBus::retryPolicy() const
+{
+	return retry;
+}
+
+void HiwonderBus::startCycle()
+{
+	cycleSpentUs = 0;
+}
+
+uint32_t HiwonderBus::cycleTimeUs() const
+{
+	return cycleSpentUs;
+}
+
+bool HiwonderBus::waitBytes( int count, Clock::time_point deadline )
+{
+	while (transport->available()<count)
+	{
+		if (Clock::now()>=deadline)
+		{
+			return transport->available()>=count;
+		}
+	}
+	return true;
+}
+
+Error HiwonderBus::getMessage( Clock::time_point deadline )
+{
+	Buffer& res = reply;
+
+	// To avoid timeout (too long), poll until we get enough bytes
+	if (!waitBytes(4, deadline))
+	{
+		res[3]=res[2]=0;
+		return Error::Timeout;
+	}
+
+	res[0] = transport->getByte(); //frame header 1
+	res[1] = transport->getByte(); //frame header 2
+	res[2] = transport->getByte(); //servo id
+	res[3] = transport->getByte(); //size
+
+	// Size counts itself, the command and the checksum
+	if (res[3]<3 || frameSize(res)>res.size())
+	{
+		res[3]=res[2]=0;
+		transport->discardInput();
+		return Error::Length;
+	}
+
+	if (!waitBytes(res[3]-1, deadline))
+	{
+		res[3]=res[2]=0;
+		return Error::Timeout;
+	}
+
+	for (size_t i=0; i<res[3]-1u; ++i)
+	{
+		res[i+4] = transport->getByte();
+	}
+
+	return Error::None;
+}
+
+Error HiwonderBus::checkMessage( const Buffer& buf, const Buffer& request, size_t expectedSize )
+{
+	if (buf[3] != expectedSize)
+	{
+		return Error::Length;
+	}
+	if (buf[expectedSize+2] != checksum(buf))
+	{
+		return Error::Checksum;
+	}
+	if (buf[4] != request[4])
+	{
+		return Error::WrongCommand;
+	}
+	if (buf[2] != request[2] && BroadcastId != request[2])
+	{
+		return Error::WrongId;
+	}
+	return Error::None;
+}
+
+const HiwonderBus::Buffer& HiwonderBus::read( const Buffer& buf, uint8_t replySize )
+{
+	return *read(buf, replySize, std::nothrow).value();
+}
+
+Result<const HiwonderBus::Buffer*> HiwonderBus::read( const Buffer& buf, uint8_t replySize, std::nothrow_t )
+{
+	const int slot = configCache ? cacheSlot(buf[4], false) : -1;
+	if (slot>=0 && config[buf[2]][slot].valid)
+	{
+		stat.cacheHits++;
+		return &config[buf[2]][slot].frame;
+	}
+
+	const uint8_t id = buf[2];
+	if (BroadcastId!=id && latency.skip(id))
+	{
+		stat.skipped++;
+		return Error::Degraded;
+	}
+
+	// Hard limit of the transaction: its own budget, and what is left of the cycle
+	const auto start = Clock::now();
+	auto limit = Clock::time_point::max();
+	if (retry.transactionBudgetUs)
+	{
+		limit = start+std::chrono::microseconds(retry.transactionBudgetUs);
+	}
+	if (retry.cycleBudgetUs)
+	{
+		if (cycleSpentUs>=retry.cycleBudgetUs)
+		{
+			stat.overBudget++;
+			return Error::Budget;
+		}
+		limit = std::min(limit, start+std::chrono::microseconds(retry.cycleBudgetUs-cycleSpentUs));
+	}
+
+	sendPending();
+	transport->drain();
+
+	const uint32_t wireUs = wireTimeUs(frameSize(buf)+replySize+3u);
+	const uint32_t timeoutUs = BroadcastId==id ? replyTimeoutUs : latency.timeoutUs(id, wireUs, replyTimeoutUs);
+
+	Error error = Error::None;
+	uint32_t backoffUs = retry.backoffUs;
+	for (uint8_t attempt=0; ; ++attempt)
+	{
+		transport->discardInput();
+		const auto sentAt = Clock::now();
+		transport->write(buf.data(), frameSize(buf));
+		stat.sent++;
+
+		// Read result
+		error = getMessage(std::min(sentAt+std::chrono::microseconds(timeoutUs), limit));
+		if (Error::None==error)
+		{
+			error = checkMessage(reply, buf, replySize);
+		}
+		if (Error::None==error)
+		{
+			if (BroadcastId!=id)
+			{
+				const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-sentAt).count();
+				latency.success(id, static_cast<uint32_t>(std::max<int64_t>(elapsedUs-wireUs, 0)));
+			}
+			break;
+		}
+		(Error::Timeout==error ? stat.timeouts : stat.corrupted)++;
+
+		if (attempt>=retry.maxRetries)
+		{
+			break;
+		}
+		const auto retryAt = Clock::now()+std::chrono::microseconds(backoffUs);
+		if (retryAt>=limit)
+		{
+			stat.overBudget++;
+			break;
+		}
+		while (Clock::now()<retryAt) continue;
+		backoffUs = std::min(backoffUs*2, retry.maxBackoffUs);
+		stat.retries++;
+	}
+
+	const auto spentUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-start).count());
+	cycleSpentUs += spentUs;
+	stat.busyUs += spentUs;
+	if (Error::None!=error)
+	{
+		if (Error::Timeout==error && BroadcastId!=id) latency.failure(id);
+		return error;
+	}
+
+	if (slot>=0 && BroadcastId!=buf[2])
+	{
+		config[buf[2]][slot].frame = reply;
+		config[buf[2]][slot].valid = true;
+	}
+
+	return &reply;
+}
+
+}
+#endif //HIWONDER_RPI_BUS
@@ -0,0 +1,304 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_BUS_BUDGET
+#define HIWONDER_RPI_BUS_BUDGET
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderBusGroup.hpp"
+#include "HiwonderReplyLatency.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Model of the time frames take on a bus: wire time from the baud rate and
+///     frame lengths, plus the servo turnaround for reads (measured, see
+///     ReplyLatency, or a default value).
+class BusTimeModel
+{
+public:
+	/// Turnaround used when none is measured, in us
+	constexpr static uint32_t DefaultTurnaroundUs = 600;
+	/// Size of a MOVE_TIME_WRITE frame, in bytes
+	constexpr static size_t MoveFrameBytes = 10;
+	/// Size of a read request frame, in bytes
+	constexpr static size_t ReadRequestBytes = 6;
+
+	/// @arg baud: baud rate of the bus
+	/// @arg latency: measured turnarounds, or nullptr to always use the default
+	BusTimeModel( int baud, const ReplyLatency* latency=nullptr, uint32_t turnaroundUs=DefaultTurnaroundUs );
+
+	/// Model of a bus, with its measured turnarounds
+	explicit BusTimeModel( HiwonderBus& bus );
+
+	/// Time of <bytes> on the wire, in us
+	uint32_t wireUs( size_t bytes ) const;
+
+	/// Time of a write of <frames> frames of <frameBytes>, in us
+	uint32_t writeUs( size_t frames, size_t frameBytes=MoveFrameBytes ) const;
+
+	/// Time of a read to a servo, from the request to the end of the reply, in us
+	/// @arg replyLength: length field of the reply frame (total size - 3)
+	uint32_t readUs( uint8_t id, uint8_t replyLength ) const;
+
+	/// Time of the reads of telemetry fields (see ServoTelemetry::Field) of a servo, in us
+	uint32_t telemetryUs( uint8_t id, uint8_t fields ) const;
+
+private:
+	int baud;
+	const ReplyLatency* latency;
+	uint32_t defaultTurnaroundUs;
+};
+
+/// Bus time accountant for a control cycle. Motion writes are planned first
+///     and always accepted; telemetry reads are then admitted only in the time
+///     left, so they can not delay the next cycle motion:
+///     - Accept: the read fits in what is left of the cycle (it is reserved)
+///     - Defer: it does not fit now, but would in a cycle with the same motion
+///       load; the caller should request it again next cycle (first)
+///     - Reject: it can never fit (bus saturated by motion, or cycle too short)
+/// endCycle compares the plan with the bus time actually used (utilisation).
+class BusBudget
+{
+public:
+	enum class Decision: uint8_t
+	{
+		Accept = 0,
+		Defer = 1,
+		Reject = 2
+	};
+
+	struct Stats
+	{
+		uint64_t cycles = 0;
+		uint64_t accepted = 0;
+		uint64_t deferred = 0;
+		uint64_t rejected = 0;
+		uint64_t overruns = 0;       /// Cycles where motion alone did not fit
+		float plannedUtilisation = 0.f;  /// Planned bus time / cycle time, last cycle
+		float utilisation = 0.f;         /// Used bus time / cycle time, last cycle
+		float meanUtilisation = 0.f;     /// Exponential average of utilisation
+	};
+
+	/// @arg model: time model of the bus (must outlive the budget)
+	/// @arg cycleUs: period of the control cycle
+	/// @arg reserveUs: bus time kept free in each cycle (safety margin)
+	BusBudget( const BusTimeModel& model, uint32_t cycleUs, uint32_t reserveUs=0 );
+
+	/// Start planning a new cycle
+	void startCycle();
+
+	/// Start planning a new cycle, and measuring the bus time used from now
+	///     (see endCycle)
+	void startCycle( const HiwonderBus& bus );
+
+	/// Plan a motion write (always accepted)
+	/// Return false if motion alone exceeds the cycle (overrun)
+	bool planWrite( size_t frames, size_t frameBytes=BusTimeModel::MoveFrameBytes );
+
+	/// Ask for a read
+	Decision admitRead( uint8_t id, uint8_t replyLength );
+
+	/// Ask for the telemetry reads (see ServoTelemetry::Field) of a servo, as a whole
+	Decision admitTelemetry( uint8_t id, uint8_t fields );
+
+	/// Return true if <us> of bus time still fit in the cycle
+	bool fits( uint32_t us ) const;
+
+	/// Bus time left in the cycle, in us
+	uint32_t remainingUs() const;
+
+	/// End the cycle, measuring the bus time used since startCycle
+	///     (see HiwonderBus::Stats::busyUs)
+	void endCycle( const HiwonderBus& bus );
+
+	/// End the cycle with the measured bus time used in it
+	void endCycle( uint32_t busyUs );
+
+	const Stats& stats() const;
+
+	const BusTimeModel& model() const;
+
+private:
+	/// Weight of the last cycle in the mean utilisation
+	constexpr static float UtilisationAlpha = 0.05f;
+
+	/// Decide and account a read of <costUs>
+	inline Decision admit( uint32_t costUs );
+
+	const BusTimeModel& timeModel;
+	uint32_t capacityUs;        // Usable bus time per cycle
+	uint32_t cycleUs;
+	uint32_t motionUs = 0;      // Planned in this cycle
+	uint32_t plannedUs = 0;
+	uint64_t startBusyUs = 0;   // Bus counter at startCycle
+	Stats stat;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+BusTimeModel::BusTimeModel( int baud, const ReplyLatency* latency, uint32_t turnaroundUs ):
+    baud(baud), latency(latency), defaultTurnaroundUs(turnaroundUs)
+{
+	if (baud<=0)
+	{
+		throw std::runtime_error("Invalid baud rate");
+	}
+}
+
+BusTimeModel::BusTimeModel( HiwonderBus& bus ):
+    BusTimeModel(bus.getTransport().baud(), &bus.getReplyLatency())
+{
+}
+
+uint32_t BusTimeModel::wireUs( size_t bytes ) const
+{
+	// 10 bits per byte (start, 8 data, stop)
+	return static_cast<uint32_t>(bytes*10*1000000ull/baud);
+}
+
+uint32_t BusTimeModel::writeUs( size_t frames, size_t frameBytes ) const
+{
+	return wireUs(frames*frameBytes);
+}
+
+uint32_t BusTimeModel::readUs( uint8_t id, uint8_t replyLength ) const
+{
+	const uint32_t turnaround = latency ? latency->turnaroundUs(id, defaultTurnaroundUs) : defaultTurnaroundUs;
+	return wireUs(ReadRequestBytes+replyLength+3u) + turnaround;
+}
+
+uint32_t BusTimeModel::telemetryUs( uint8_t id, uint8_t fields ) const
+{
+	// Reply lengths: POS_READ 5, VIN_READ 5, TEMP_READ 4, LOAD_OR_UNLOAD_READ 4
+	uint32_t us = 0;
+	if (fields & ServoTelemetry::Position) us += readUs(id, 5);
+	if (fields & ServoTelemetry::Vin) us += readUs(id, 5);
+	if (fields & ServoTelemetry::Temp) us += readUs(id, 4);
+	if (fields & ServoTelemetry::Load) us += readUs(id, 4);
+	return us;
+}
+
+BusBudget::BusBudget( const BusTimeModel& model, uint32_t cycleUs, uint32_t reserveUs ):
+    timeModel(model), capacityUs(cycleUs>reserveUs ? cycleUs-reserveUs : 0), cycleUs(cycleUs)
+{
+	if (0==cycleUs)
+	{
+		throw std::runtime_error("Bus budget cycle must be positive");
+	}
+}
+
+void BusBudget::startCycle()
+{
+	motionUs = 0;
+	plannedUs = 0;
+}
+
+void BusBudget::startCycle( const HiwonderBus& bus )
+{
+	startCycle();
+	startBusyUs = bus.stats().busyUs;
+}
+
+bool BusBudget::planWrite( size_t frames, size_t frameBytes )
+{
+	const uint32_t us = timeModel.writeUs(frames, frameBytes);
+	motionUs += us;
+	plannedUs += us;
+	return motionUs<=capacityUs;
+}
+
+BusBudget::Decision BusBudget::admit( uint32_t costUs )
+{
+	if (fits(costUs))
+	{
+		plannedUs += costUs;
+		stat.accepted++;
+		return Decision::Accept;
+	}
+	if (motionUs<capacityUs && costUs<=capacityUs-motionUs)
+	{
+		stat.deferred++;
+		return Decision::Defer;
+	}
+	stat.rejected++;
+	return Decision::Reject;
+}
+
+BusBudget::Decision BusBudget::admitRead( uint8_t id, uint8_t replyLength )
+{
+	return admit(timeModel.readUs(id, replyLength));
+}
+
+BusBudget::Decision BusBudget::admitTelemetry( uint8_t id, uint8_t fields )
+{
+	return admit(timeModel.telemetryUs(id, fields));
+}
+
+bool BusBudget::fits( uint32_t us ) const
+{
+	return us<=remainingUs();
+}
+
+uint32_t BusBudget::remainingUs() const
+{
+	return plannedUs<capacityUs ? capacityUs-plannedUs : 0;
+}
+
+void BusBudget::endCycle( const HiwonderBus& bus )
+{
+	const uint64_t delta = bus.stats().busyUs-startBusyUs;
+	endCycle(static_cast<uint32_t>(std::min<uint64_t>(delta, std::numeric_limits<uint32_t>::max())));
+}
+
+void BusBudget::endCycle( uint32_t busyUs )
+{
+	if (motionUs>capacityUs)
+	{
+		stat.overruns++;
+	}
+	stat.plannedUtilisation = static_cast<float>(plannedUs)/cycleUs;
+	stat.utilisation = static_cast<float>(busyUs)/cycleUs;
+	stat.meanUtilisation = stat.cycles ?
+	    stat.meanUtilisation + UtilisationAlpha*(stat.utilisation-stat.meanUtilisation) : stat.utilisation;
+	stat.cycles++;
+}
+
+const BusBudget::Stats& BusBudget::stats() const
+{
+	return stat;
+}
+
+const BusTimeModel& BusBudget::model() const
+{
+	return timeModel;
+}
+
+}
+#endif //HIWONDER_RPI_BUS_BUDGET
@@ -0,0 +1,579 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_BUS_GROUP
+#define HIWONDER_RPI_BUS_GROUP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderBusServo.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Last values polled from a servo
+struct ServoTelemetry
+{
+	enum Field: uint8_t
+	{
+		Position = 0x1,
+		Vin = 0x2,
+		Temp = 0x4,
+		Load = 0x8,
+		All = 0xF
+	};
+
+	int16_t position = 0;  /// multiples of 0.24deg
+	uint16_t vin = 0;      /// mV
+	uint8_t temp = 0;      /// deg celsius
+	bool loaded = false;   /// motor torque on
+	bool valid = false;    /// false if any of the requested reads failed
+};
+
+/// Run jobs on a bus from a dedicated I/O thread, optionally pinned to a core.
+/// Once a bus is given to an executor, it must only be used from its jobs.
+///
+/// Jobs have a priority class, each with its own queue: the next job is always
+///     taken from the most urgent non-empty class. Long jobs can also be
+///     preempted between transactions: they call yield() before each read,
+///     which runs the pending jobs of more urgent classes inline. So a safety
+///     stop or a motion frame never waits behind a queue of telemetry reads,
+///     only for the read in progress: up to its reply timeout and retries
+///     (bounded by HiwonderBus::RetryPolicy::transactionBudgetUs).
+class BusExecutor
+{
+public:
+	using Job = std::function<void(HiwonderBus&)>;
+
+	enum class Priority: uint8_t
+	{
+		Emergency = 0,  /// Safety commands (unload, stop)
+		Motion = 1,     /// Setpoints
+		Telemetry = 2   /// Background reads
+	};
+	constexpr static size_t PriorityCount = 3;
+
+	/// Latency of the jobs of a priority class, from post()
+	struct ClassStats
+	{
+		uint64_t jobs = 0;          /// Jobs done
+		uint64_t sumWaitUs = 0;     /// Time queued, until the job starts
+		uint32_t maxWaitUs = 0;
+		uint64_t sumLatencyUs = 0;  /// Time until the job is done
+		uint32_t maxLatencyUs = 0;
+
+		double meanWaitUs() const;
+		double meanLatencyUs() const;
+	};
+
+	/// Start the I/O thread
+	/// @arg bus: bus to run the jobs on (must outlive the executor)
+	/// @arg cpu: core to pin the thread to, -1 for no pinning
+	BusExecutor( HiwonderBus& bus, int cpu=-1 );
+	BusExecutor( const BusExecutor& ) = delete;
+	BusExecutor& operator=( const BusExecutor& ) = delete;
+	/// Finish the queued jobs and stop the I/O thread
+	~BusExecutor();
+
+	/// Queue a job (blocks while the queue of its class is full).
+	/// Exceptions thrown by the job are caught and counted (see errors())
+	void post( Job job, Priority priority=Priority::Motion );
+
+	/// Wait until all the queued jobs are done
+	void wait();
+
+	/// Wait until all the queued jobs of a class are done
+	void wait( Priority priority );
+
+	/// Run the pending jobs more urgent than <current>, from a job of class
+	///     <current> (only from the I/O thread, between two frames)
+	void yield( Priority current );
+
+	/// Number of jobs that ended with an exception
+	uint64_t errors() const;
+
+	/// Latency statistics of a class
+	ClassStats stats( Priority priority ) const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	constexpr static size_t QueueSize = 64;
+
+	struct Queue
+	{
+		std::array<Job, QueueSize> jobs;
+		std::array<Clock::time_point, QueueSize> posted;
+		size_t head = 0;
+		size_t count = 0;
+		size_t running = 0;
+	};
+
+	/// Main function of the I/O thread
+	inline void loop();
+
+	/// Return the most urgent class with pending jobs, more urgent than
+	///     <below> (PriorityCount for any), or -1
+	inline int nextClass( size_t below ) const;
+
+	/// Run the next job of a class (mutex locked by <lock>, released while running)
+	inline void runNext( std::unique_lock<std::mutex>& lock, size_t priority );
+
+	/// Return true if there is nothing queued nor running
+	inline bool idle() const;
+
+	HiwonderBus& bus;
+	std::array<Queue, PriorityCount> queues;
+	std::array<ClassStats, PriorityCount> classStats;
+	bool quit = false;
+	uint64_t errorCount = 0;
+	mutable std::mutex mutex;
+	std::condition_variable workCv;
+	std::condition_variable doneCv;
+	std::thread thread;
+};
+
+/// A robot spread over several buses (e.g. /dev/ttyAMA0, /dev/ttyAMA1 and USB
+///     adapters). Each servo ID is assigned to one bus, and each bus has its
+///     own I/O thread: group operations are split per bus and run in parallel,
+///     so throughput scales with the number of buses.
+/// Group methods are blocking and must be called from a single thread.
+/// Moves run as Motion jobs and polls as Telemetry jobs (see BusExecutor).
+/// Once the buses are added, moveTimeWrite and poll do not allocate.
+class BusGroup
+{
+public:
+	constexpr static uint8_t NoBus = 0xFF;
+
+	BusGroup();
+	BusGroup( const BusGroup& ) = delete;
+	BusGroup& operator=( const BusGroup& ) = delete;
+
+	/// Add a bus on a serial device and start its I/O thread.
+	/// @arg cpu: core for the I/O thread, -1 for no pinning
+	/// @return index of the bus
+	size_t addBus( const char* device, int baud=115200, int cpu=-1 );
+
+	/// Add a bus on the given transport and start its I/O thread.
+	size_t addBus( std::unique_ptr<HiwonderTransport> transport, int cpu=-1 );
+
+	/// Number of buses
+	size_t busCount() const;
+
+	/// Assign a servo to a bus
+	void assign( uint8_t id, size_t bus );
+
+	/// Return the bus index of a servo, or NoBus
+	size_t busOf( uint8_t id ) const;
+
+	/// Return the executor of a bus, to run custom jobs on it
+	BusExecutor& getExecutor( size_t bus );
+
+	/// Move a group of servos: each bus sends the frames of its servos
+	///     at once (see HiwonderBus::hold), all buses in parallel.
+	/// @arg ids, positions: servo ids and targets, [count]
+	/// @arg time: time to reach the targets in ms
+	void moveTimeWrite( const uint8_t* ids, const int16_t* positions, size_t count, uint16_t time=0 );
+
+	/// Read telemetry of a group of servos, all buses in parallel.
+	/// Each poll is a new cycle for the bus time budget (see HiwonderBus::RetryPolicy).
+	/// @arg ids: servo ids, [count]
+	/// @arg out: telemetry for each servo, [count]
+	/// @arg fields: combination of ServoTelemetry::Field to read
+	void poll( const uint8_t* ids, size_t count, ServoTelemetry* out, uint8_t fields=ServoTelemetry::All );
+
+	/// Unload all the servos of all buses (no torque), ahead of any queued
+	///     motion or telemetry, and wait until it is sent.
+	/// Unlike the other methods, it can be called from any thread.
+	void emergencyUnload();
+
+private:
+	/// Parameters of the running group operation, shared with the bus jobs
+	///     (keeps the jobs small, they do not allocate)
+	struct Request
+	{
+		const uint8_t* ids = nullptr;
+		const int16_t* positions = nullptr;
+		ServoTelemetry* telemetry = nullptr;
+		size_t count = 0;
+		uint16_t time = 0;
+		uint8_t fields = 0;
+	};
+
+	/// Job: send the moves of the request for one bus
+	inline void moveJob( size_t bus, HiwonderBus& hwBus ) const;
+
+	/// Job: read the telemetry of the request for one bus
+	inline void pollJob( size_t bus, HiwonderBus& hwBus ) const;
+
+	/// Wait for all the executors
+	inline void waitAll();
+
+	std::vector<std::unique_ptr<HiwonderBus>> buses;
+	std::vector<std::unique_ptr<BusExecutor>> executors;
+	std::array<uint8_t, 256> busIndex;
+	Request request;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+double BusExecutor::ClassStats::meanWaitUs() const
+{
+	return jobs ? static_cast<double>(sumWaitUs)/jobs : 0.0;
+}
+
+double BusExecutor::ClassStats::meanLatencyUs() const
+{
+	return jobs ? static_cast<double>(sumLatencyUs)/jobs : 0.0;
+}
+
+BusExecutor::BusExecutor( HiwonderBus& bus, int cpu ): bus(bus)
+{
+	thread = std::thread([this]{ loop(); });
+
+	if (cpu>=0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (0!=pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set))
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				quit = true;
+			}
+			workCv.notify_one();
+			thread.join();
+			throw std::runtime_error("Unable to pin the bus thread to the requested CPU");
+		}
+	}
+}
+
+BusExecutor::~BusExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	workCv.notify_one();
+	thread.join();
+}
+
+void BusExecutor::post( Job job, Priority priority )
+{
+	Queue& queue = queues[static_cast<size_t>(priority)];
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [&queue]{ return queue.count<QueueSize; });
+	const size_t slot = (queue.head+queue.count)%QueueSize;
+	queue.jobs[slot] = std::move(job);
+	queue.posted[slot] = Clock::now();
+	queue.count++;
+	lock.unlock();
+	workCv.notify_one();
+}
+
+bool BusExecutor::idle() const
+{
+	for (const auto& queue: queues)
+	{
+		if (queue.count>0 || queue.running>0) return false;
+	}
+	return true;
+}
+
+void BusExecutor::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [this]{ return idle(); });
+}
+
+void BusExecutor::wait( Priority priority )
+{
+	const Queue& queue = queues[static_cast<size_t>(priority)];
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [&queue]{ return 0==queue.count && 0==queue.running; });
+}
+
+uint64_t BusExecutor::errors() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return errorCount;
+}
+
+BusExecutor::ClassStats BusExecutor::stats( Priority priority ) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return classStats[static_cast<size_t>(priority)];
+}
+
+int BusExecutor::nextClass( size_t below ) const
+{
+	for (size_t c=0; c<below; ++c)
+	{
+		if (queues[c].count>0) return static_cast<int>(c);
+	}
+	return -1;
+}
+
+void BusExecutor::runNext( std::unique_lock<std::mutex>& lock, size_t priority )
+{
+	Queue& queue = queues[priority];
+	Job job = std::move(queue.jobs[queue.head]);
+	const Clock::time_point posted = queue.posted[queue.head];
+	queue.head = (queue.head+1)%QueueSize;
+	queue.count--;
+	queue.running++;
+	lock.unlock();
+
+	const Clock::time_point start = Clock::now();
+	bool failed = false;
+	try
+	{
+		job(bus);
+	}
+	catch(...)
+	{
+		failed = true;
+	}
+	const Clock::time_point end = Clock::now();
+
+	lock.lock();
+	auto toUs = [](Clock::duration d){ return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count()); };
+	ClassStats& stat = classStats[priority];
+	const uint32_t waitUs = toUs(start-posted);
+	const uint32_t latencyUs = toUs(end-posted);
+	stat.jobs++;
+	stat.sumWaitUs += waitUs;
+	stat.maxWaitUs = std::max(stat.maxWaitUs, waitUs);
+	stat.sumLatencyUs += latencyUs;
+	stat.maxLatencyUs = std::max(stat.maxLatencyUs, latencyUs);
+	queue.running--;
+	errorCount += failed ? 1 : 0;
+	doneCv.notify_all();
+}
+
+void BusExecutor::yield( Priority current )
+{
+	if (std::this_thread::get_id()!=thread.get_id())
+	{
+		throw std::runtime_error("BusExecutor::yield must be called from a job");
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	for (int c=nextClass(static_cast<size_t>(current)); c>=0; c=nextClass(static_cast<size_t>(current)))
+	{
+		runNext(lock, static_cast<size_t>(c));
+	}
+}
+
+void BusExecutor::loop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		workCv.wait(lock, [this]{ return nextClass(PriorityCount)>=0 || quit; });
+		const int c = nextClass(PriorityCount);
+		if (c<0)
+		{
+			return; // quit, and nothing left to do
+		}
+		runNext(lock, static_cast<size_t>(c));
+	}
+}
+
+BusGroup::BusGroup()
+{
+	busIndex.fill(NoBus);
+}
+
+size_t BusGroup::addBus( const char* device, int baud, int cpu )
+{
+	return addBus(std::unique_ptr<HiwonderTransport>(new SerialTransport(device, baud)), cpu);
+}
+
+size_t BusGroup::addBus( std::unique_ptr<HiwonderTransport> transport, int cpu )
+{
+	if (buses.size()>=NoBus)
+	{
+		throw std::runtime_error("Too many buses in the group");
+	}
+	buses.emplace_back(new HiwonderBus(std::move(transport)));
+	executors.emplace_back(new BusExecutor(*buses.back(), cpu));
+	return buses.size()-1;
+}
+
+size_t BusGroup::busCount() const
+{
+	return buses.size();
+}
+
+void BusGroup::assign( uint8_t id, size_t bus )
+{
+	if (bus>=buses.size())
+	{
+		throw std::runtime_error("Invalid bus index");
+	}
+	busIndex[id] = static_cast<uint8_t>(bus);
+}
+
+size_t BusGroup::busOf( uint8_t id ) const
+{
+	return busIndex[id];
+}
+
+BusExecutor& BusGroup::getExecutor( size_t bus )
+{
+	return *executors.at(bus);
+}
+
+void BusGroup::waitAll()
+{
+	for (auto& executor: executors) executor->wait();
+}
+
+void BusGroup::moveJob( size_t bus, HiwonderBus& hwBus ) const
+{
+	hwBus.hold();
+	for (size_t i=0; i<request.count; ++i)
+	{
+		if (busIndex[request.ids[i]]==bus)
+		{
+			HiwonderBusServo(hwBus, request.ids[i]).moveTimeWrite(request.positions[i], request.time);
+		}
+	}
+	hwBus.flush();
+}
+
+void BusGroup::pollJob( size_t bus, HiwonderBus& hwBus ) const
+{
+	hwBus.startCycle();
+	for (size_t i=0; i<request.count; ++i)
+	{
+		if (busIndex[request.ids[i]]!=bus)
+		{
+			continue;
+		}
+
+		const HiwonderBusServo servo(hwBus, request.ids[i]);
+		ServoTelemetry& out = request.telemetry[i];
+		// Let motion and emergency jobs go first, before each read
+		const auto yield = [this, bus]{ executors[bus]->yield(BusExecutor::Priority::Telemetry); };
+		// Stop at the first error, the servo is probably not answering
+		out.valid = false;
+		if (request.fields & ServoTelemetry::Position)
+		{
+			yield();
+			const auto position = servo.posRead(std::nothrow);
+			if (!position) continue;
+			out.position = *position;
+		}
+		if (request.fields & ServoTelemetry::Vin)
+		{
+			yield();
+			const auto vin = servo.vinRead(std::nothrow);
+			if (!vin) continue;
+			out.vin = *vin;
+		}
+		if (request.fields & ServoTelemetry::Temp)
+		{
+			yield();
+			const auto temp = servo.tempRead(std::nothrow);
+			if (!temp) continue;
+			out.temp = *temp;
+		}
+		if (request.fields & ServoTelemetry::Load)
+		{
+			yield();
+			const auto load = servo.loadOrUnloadRead(std::nothrow);
+			if (!load) continue;
+			out.loaded = *load==HiwonderBusServo::LoadMode::Load;
+		}
+		out.valid = true;
+	}
+}
+
+void BusGroup::moveTimeWrite( const uint8_t* ids, const int16_t* positions, size_t count, uint16_t time )
+{
+	request = Request();
+	request.ids = ids;
+	request.positions = positions;
+	request.count = count;
+	request.time = time;
+
+	for (size_t b=0; b<executors.size(); ++b)
+	{
+		executors[b]->post([this, b](HiwonderBus& hwBus){ moveJob(b, hwBus); }, BusExecutor::Priority::Motion);
+	}
+	waitAll();
+}
+
+void BusGroup::poll( const uint8_t* ids, size_t count, ServoTelemetry* out, uint8_t fields )
+{
+	request = Request();
+	request.ids = ids;
+	request.telemetry = out;
+	request.count = count;
+	request.fields = fields;
+
+	for (size_t i=0; i<count; ++i)
+	{
+		out[i].valid = false;
+	}
+	for (size_t b=0; b<executors.size(); ++b)
+	{
+		executors[b]->post([this, b](HiwonderBus& hwBus){ pollJob(b, hwBus); }, BusExecutor::Priority::Telemetry);
+	}
+	waitAll();
+}
+
+void BusGroup::emergencyUnload()
+{
+	for (auto& executor: executors)
+	{
+		executor->post([](HiwonderBus& hwBus)
+		{
+			HiwonderBusServo(hwBus, HiwonderBus::BroadcastId).loadOrUnloadWrite(HiwonderBusServo::LoadMode::Unload, true);
+		}, BusExecutor::Priority::Emergency);
+	}
+	for (auto& executor: executors)
+	{
+		executor->wait(BusExecutor::Priority::Emergency);
+	}
+}
+
+}
+#endif //HIWONDER_RPI_BUS_GROUP
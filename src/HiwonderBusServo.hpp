@@ -24,10 +24,15 @@
 #include <cstdint>
 #include <exception>
 #include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 
 #include <wiringPi.h>
 #include <wiringSerial.h>
 
+#include "HiwonderBus.hpp"
+
 namespace HiwonderRpi
 {
 	
@@ -44,9 +49,17 @@ constexpr int8_t operator ""_int8( unsigned long long v) { return static_cast<in
 /// For convenience, command names are keep similar to the documentation, but
 ///     parameters are in a more user-friendly format than bytes.
 ///     Methods in this class and servo commands match 1 to 1.
+/// Each read has a non-throwing overload taking std::nothrow, which returns
+///     bus errors (timeout, corrupted reply...) in a Result instead of
+///     throwing them (see HiwonderBus::read).
+/// Servo objects hold no buffer: commands do not allocate (frames are on the
+///     stack, see HiwonderBus for the bus side).
+/// A servo object is a handle: a bus pointer and an id, without vtable,
+///     trivially copyable. Copies address the same servo, so handles can be
+///     kept in containers and passed by value; the bus must outlive them.
 class HiwonderBusServo
 {
-	using Buffer = std::array<uint8_t,10>;
+	using Buffer = HiwonderBus::Buffer;
 	
 public:
 	struct MoveTime
@@ -94,28 +107,35 @@ public:
 	
 	/// Constructor, accept the servo ID. 
 	/// Id=254 is the broadcast ID
+	/// The servo is on the default bus (/dev/ttyAMA0)
+	/// Constructors do not access the hardware (see HiwonderBus::open)
 	HiwonderBusServo( uint8_t id=254 );
-	HiwonderBusServo( const HiwonderBusServo&& );
-	/// Servo object can not be copied (UART access is unique)
-	HiwonderBusServo( const HiwonderBusServo& ) = delete;
-	HiwonderBusServo& operator=( const HiwonderBusServo&) = delete;
-	
-	virtual ~HiwonderBusServo();
+	/// Constructor for a servo on a given bus (the bus must outlive the servo)
+	HiwonderBusServo( HiwonderBus& bus, uint8_t id=254 );
+
+	/// Id of the servo
+	uint8_t getId() const;
+
+	/// Bus the servo is connected to
+	HiwonderBus& getBus() const;
 
 	/// Immediately start moving the servo to the given position
 	///     trying to reach target position in the given time (ms)
 	/// @arg position: target absolute position in multiples of 0.24deg
 	/// @arg time: time to reach the target position in ms (if too short, max-speed is used)
-	void moveTimeWrite( int16_t position, uint16_t time=0);
+	/// @arg force: send even if it is the same as the last move sent (see HiwonderBus::write)
+	void moveTimeWrite( int16_t position, uint16_t time=0, bool force=false);
 	
 	/// Read the values set by moveTimeWrite
 	MoveTime moveTimeRead() const;
+	Result<MoveTime> moveTimeRead( std::nothrow_t ) const;
 	
 	/// Those functions aren't yet implemented in the servo?
 		///
 		void moveTimeWaitWrite( int16_t position, uint16_t time=0);
 		///
 		MoveTime moveTimeWaitRead() const;
+		Result<MoveTime> moveTimeWaitRead( std::nothrow_t ) const;
 		///
 		void moveStart();
 		///
@@ -128,6 +148,7 @@ public:
 	
 	/// Read the id from the servo. This alway uses broadcast (why to read the id if you know it?)
 	uint8_t idRead() const;
+	Result<uint8_t> idRead( std::nothrow_t ) const;
 	
 	/// The angle offset is an adjustment on the position (homing).
 	/// This function set (volatile memory until servo reset) this angle adjustment.
@@ -136,6 +157,7 @@ public:
 	
 	/// Return the current offset angle
 	int8_t angleOffsetRead() const;
+	Result<int8_t> angleOffsetRead( std::nothrow_t ) const;
 	
 	/// Save permanently(over reset, in flash memory) the current offset in the servo.
 	void angleOffsetWrite();
@@ -147,6 +169,7 @@ public:
 	
 	/// Retrieve current angle limits
 	Limit angleLimitRead() const;
+	Result<Limit> angleLimitRead( std::nothrow_t ) const;
 	
 	/// Set (persistently over shutdown) voltage limits; Outside, the servo will output no torque
 	///     and the LED will blink for warnings (if configured/available).
@@ -156,6 +179,7 @@ public:
 	
 	/// Retrieve current voltage limits
 	Limit vinLimitRead() const;
+	Result<Limit> vinLimitRead( std::nothrow_t ) const;
 	
 	/// Set (persistently over shutdown) temperature limits; Outside, the servo will output no torque
 	///     and the LED will blink for warnings (if configured/available).
@@ -164,16 +188,20 @@ public:
 	
 	/// Retrieve current max temperature limit
 	uint8_t tempMaxLimitRead() const;
+	Result<uint8_t> tempMaxLimitRead( std::nothrow_t ) const;
 	
 	/// Read the current servo temperature in deg celsius
 	uint8_t tempRead() const;
+	Result<uint8_t> tempRead( std::nothrow_t ) const;
 	
 	/// Read the input voltage to the servo, in mV
 	uint16_t vinRead() const;
+	Result<uint16_t> vinRead( std::nothrow_t ) const;
 	
 	/// Read the current servo position in multiple of 0.24 deg (1000 = 240deg)
 	/// Note: the servo can be easily 0.5deg away of it command, that way it can be in negative angle.
 	int16_t posRead() const;
+	Result<int16_t> posRead( std::nothrow_t ) const;
 	
 	/// Set (volatile) the mode of the device: Servo or Motor (position or speed)
 	/// In case of motor mode, the speed can be specified: 0=stopped, negative/positive for each direction.
@@ -183,21 +211,26 @@ public:
 	
 	/// Read the Servo or Motor mode, and in case of motor, the speed (0 for servo).
 	ModeRead servoOrMotorModeRead() const;
+	Result<ModeRead> servoOrMotorModeRead( std::nothrow_t ) const;
 	
 	/// Set the servo to "Unload":free-rotation (it will not apply torque to keep a position), or 
 	/// "Load": normal mode, where the servo tries to hold a given position
 	/// @arg loadMode: Load or Unload mode to set
-	void loadOrUnloadWrite( LoadMode loadMode = LoadMode::Load );
+	/// @arg force: send even if it is the same as the last mode sent (see HiwonderBus::write)
+	void loadOrUnloadWrite( LoadMode loadMode = LoadMode::Load, bool force=false );
 	
 	/// Retrieve the Load or Unload mode from the servo
 	LoadMode loadOrUnloadRead() const;
+	Result<LoadMode> loadOrUnloadRead( std::nothrow_t ) const;
 	
 	/// Set if the Power LED is always ON, or always OFF
 	/// @arg powerLed: On or Off
-	void ledCtrlWrite(PowerLed powerLed = PowerLed::On);
+	/// @arg force: send even if it is the same as the last value sent (see HiwonderBus::write)
+	void ledCtrlWrite(PowerLed powerLed = PowerLed::On, bool force=false);
 	
 	/// Read if the Power LED is ON or OFF
 	PowerLed ledCtrlRead() const;
+	Result<PowerLed> ledCtrlRead( std::nothrow_t ) const;
 	
 	/// Set the different errors to be warned by the LED
 	/// @arg overTemperature: if to warn over temperature with the LED
@@ -207,11 +240,12 @@ public:
 	
 	/// Read the LED errors set
 	LedError ledErrorRead() const;
+	Result<LedError> ledErrorRead( std::nothrow_t ) const;
 
 private:
 	
 	/// Message prefix/frame header
-	constexpr static uint8_t FrameHeader = 0x55;
+	constexpr static uint8_t FrameHeader = HiwonderBus::FrameHeader;
 	/// Used to pre-fill buffers before real data is set in
 	constexpr static uint8_t _pholder = 0;
 	
@@ -224,34 +258,26 @@ private:
 	/// Return the checksum for a given message
 	inline static uint8_t checksum(const Buffer& buf);
 
-	/// Send a buffer of data to the servo
-	inline void sendBuf(const Buffer& buf) const;
-	
-	/// Get a message from the servo (this function is blocking).
-	/// @throw runtime_error if the message does not arrive until timeout (< 1 ms)
-	/// Timeout is a busy loop, avoiding long waiting of re-scheduling
-	inline const Buffer& getMessage() const;
-	
-	/// Basic check on a message: 
-	///    - If the checksum match
-	///    - If the size of the message is the expected (expect at pos 3)
-	///    - If the commandId is the expected
-	/// Return false in case of error
-	inline static bool checkMessage( const Buffer& buf, uint8_t commandId, size_t expectedSize);
+	/// Send a buffer of data to the servo (see HiwonderBus::write)
+	inline void sendBuf(const Buffer& buf, bool force=false) const;
 	
 	/// Set all variable elements in buf (Id, and checksum), and send the request, 
-	///     then it read the result, check it validity and return the buffer.
+	///     then it read the result, check it validity and return the buffer or the error.
 	/// Used internally to reuse common code between all the xxxxREAD commmands
 	/// @arg buf: Buffer of the request (id, and checksum are computed internally)
 	/// @arg replySize: expected size of the reply (for checks).
-	inline const Buffer& genericRead( Buffer& buf, uint8_t replySize ) const;
+	inline Result<const Buffer*> genericRead( Buffer& buf, uint8_t replySize ) const;
 
-	// Access to the device
-	int fd = -1;
+	// Bus the servo is connected to
+	HiwonderBus* bus = nullptr;
 	// Id of the servo
-	int id = 1;
+	uint8_t id = 1;
 };
 
+static_assert(std::is_trivially_copyable<HiwonderBusServo>::value, "servo handles are copied as plain values");
+static_assert(!std::is_polymorphic<HiwonderBusServo>::value, "servo handles have no vtable");
+static_assert(sizeof(HiwonderBusServo)<=2*sizeof(void*), "servo handles are a bus pointer and an id");
+
 
 
 
@@ -271,114 +297,46 @@ uint8_t HiwonderBusServo::getHighByte( const uint16_t in)
 
 uint8_t HiwonderBusServo::checksum(const Buffer& buf)
 {
-	uint16_t temp = 0;
-	for (size_t i=2; i<buf[3]+2u; ++i)
-	{
-		temp += buf[i];
-	}
-	temp = ~temp;
-	return getLowByte(temp);
+	return HiwonderBus::checksum(buf);
 }
 
-void HiwonderBusServo::sendBuf(const Buffer& buf) const
+void HiwonderBusServo::sendBuf(const Buffer& buf, bool force) const
 {
-	for (size_t i=0; i< buf[3]+3u; ++i)
-	{
-		serialPutchar(fd, buf[i]);
-	}
+	bus->write(buf, force);
 }
-	
-const HiwonderBusServo::Buffer& HiwonderBusServo::getMessage() const
-{
-	static Buffer res;
-	
-	constexpr static size_t MaxBusyLoop = 20000;
-	
-	// To avoid timeout (too long), poll until we get enough bytes
-	for(size_t i=0; i<MaxBusyLoop && serialDataAvail(fd)<4; ++i) continue; //noop
 
-	
-	if (serialDataAvail(fd)<4)
-	{
-		res[3]=res[2]=0;
-		throw std::runtime_error("Unable to retrieve message header from servo");
-		return res;
-	}
-	
-	res[0] = serialGetchar(fd); //frame header 1
-	res[1] = serialGetchar(fd); //frame header 2
-	res[2] = serialGetchar(fd); //servo id
-	res[3] = serialGetchar(fd); //size
-	
-	for(size_t i=0; i<MaxBusyLoop && serialDataAvail(fd)<res[3]-1; ++i) continue; //noop
-	
-	if (serialDataAvail(fd)<res[3]-1)
-	{
-		res[3]=res[2]=0;
-		throw std::runtime_error("Unable to retrieve message content from servo");
-		return res;
-	}
-	
-	for (size_t i=0; i<res[3]-1u; ++i)
-	{
-		res[i+4] = serialGetchar(fd);
-	}
-	
-	return res;
+HiwonderBusServo::HiwonderBusServo(uint8_t id): HiwonderBusServo(HiwonderBus::defaultBus(), id)
+{
 }
-	
-	
-bool HiwonderBusServo::checkMessage( const Buffer& buf, uint8_t commandId, size_t expectedSize)
+
+HiwonderBusServo::HiwonderBusServo(HiwonderBus& bus, uint8_t id): bus(&bus), id(id)
 {
-	if (buf[3] != expectedSize || 
-			buf[4] != commandId || 
-			buf[expectedSize+2] != checksum(buf))
-	{
-		return false;
-	}
-	return true;
 }
 
-HiwonderBusServo::HiwonderBusServo(uint8_t id): id(id)
+uint8_t HiwonderBusServo::getId() const
 {
-	fd = serialOpen("/dev/ttyAMA0", 115200);
-	auto setupResult = wiringPiSetup();
-	if (0>fd || -1==setupResult)
-	{
-		throw std::runtime_error("Unable to setup UART device.");
-	}
+	return id;
 }
 
-HiwonderBusServo::~HiwonderBusServo()
+HiwonderBus& HiwonderBusServo::getBus() const
 {
-	serialClose(fd);
+	return *bus;
 }
 
-const HiwonderBusServo::Buffer& HiwonderBusServo::genericRead( Buffer& buf, uint8_t replySize ) const
+Result<const HiwonderBusServo::Buffer*> HiwonderBusServo::genericRead( Buffer& buf, uint8_t replySize ) const
 {
 	buf[2] = id;
 	buf[buf[3]+2] = checksum(buf);
 	
-	serialFlush(fd);
-	sendBuf(buf);
-	
-	// Read result
-	const Buffer& res= getMessage();
-	
-	if (!checkMessage(res, buf[4], replySize))
-	{
-		throw std::runtime_error("Corrupted message received");
-	}
-	
-	return res;
+	return bus->read(buf, replySize, std::nothrow);
 }
 
-void HiwonderBusServo::moveTimeWrite( int16_t position, uint16_t time)
+void HiwonderBusServo::moveTimeWrite( int16_t position, uint16_t time, bool force)
 {
 	constexpr static uint8_t MoveTimeWriteId = 1;
 	constexpr static uint8_t MoveTimeWriteSize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -402,16 +360,21 @@ void HiwonderBusServo::moveTimeWrite( int16_t position, uint16_t time)
 	buf[8] = getHighByte(time);
 	buf[9] = checksum(buf);
 	
-	sendBuf(buf);
+	sendBuf(buf, force);
 }
 
 HiwonderBusServo::MoveTime HiwonderBusServo::moveTimeRead() const
+{
+	return moveTimeRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::MoveTime> HiwonderBusServo::moveTimeRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t MoveTimeReadId = 2;
 	constexpr static uint8_t MoveTimeReadSize = 3;
 	constexpr static uint8_t MoveTimeReplySize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -421,7 +384,9 @@ HiwonderBusServo::MoveTime HiwonderBusServo::moveTimeRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, MoveTimeReplySize);
+	const auto reply = genericRead(buf, MoveTimeReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	MoveTime result;
 	result.position = resultBuf[5]+(resultBuf[6]<<8);
@@ -434,7 +399,7 @@ void HiwonderBusServo::moveTimeWaitWrite( int16_t position, uint16_t time)
 	constexpr static uint8_t MoveTimeWaitWriteId = 7;
 	constexpr static uint8_t MoveTimeWaitWriteSize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -462,12 +427,17 @@ void HiwonderBusServo::moveTimeWaitWrite( int16_t position, uint16_t time)
 }
 
 HiwonderBusServo::MoveTime HiwonderBusServo::moveTimeWaitRead() const
+{
+	return moveTimeWaitRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::MoveTime> HiwonderBusServo::moveTimeWaitRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t MoveTimeWaitReadId = 8;
 	constexpr static uint8_t MoveTimeWaitReadSize = 3;
 	constexpr static uint8_t MoveTimeWaitReplySize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -477,7 +447,9 @@ HiwonderBusServo::MoveTime HiwonderBusServo::moveTimeWaitRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, MoveTimeWaitReplySize);
+	const auto reply = genericRead(buf, MoveTimeWaitReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	MoveTime result;
 	result.position = resultBuf[5]+(resultBuf[6]<<8);
@@ -490,7 +462,7 @@ void HiwonderBusServo::moveStart()
 	constexpr static uint8_t MoveStartId = 11;
 	constexpr static uint8_t MoveStartSize = 3;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -499,6 +471,7 @@ void HiwonderBusServo::moveStart()
 		MoveStartId,
 		_pholder
 	};
+	buf[2] = id;
 	buf[5] = checksum(buf);
 	
 	sendBuf(buf);
@@ -509,7 +482,7 @@ void HiwonderBusServo::moveStop()
 	constexpr static uint8_t MoveStopId = 12;
 	constexpr static uint8_t MoveStopSize = 3;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -518,6 +491,7 @@ void HiwonderBusServo::moveStop()
 		MoveStopId,
 		_pholder
 	};
+	buf[2] = id;
 	buf[5] = checksum(buf);
 	
 	sendBuf(buf);
@@ -528,7 +502,7 @@ void HiwonderBusServo::idWrite(uint8_t newId)
 	constexpr static uint8_t IdWriteId = 13;
 	constexpr static uint8_t IdWriteSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -547,12 +521,17 @@ void HiwonderBusServo::idWrite(uint8_t newId)
 }
 
 uint8_t HiwonderBusServo::idRead() const
+{
+	return idRead(std::nothrow).value();
+}
+
+Result<uint8_t> HiwonderBusServo::idRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t idReadId = 14;
 	constexpr static uint8_t idReadSize = 3;
 	constexpr static uint8_t idReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -562,18 +541,12 @@ uint8_t HiwonderBusServo::idRead() const
 		_pholder
 	};
 	
-	buf[2] = 254;
+	buf[2] = HiwonderBus::BroadcastId;
 	buf[buf[3]+2] = checksum(buf);
 	
-	serialFlush(fd);
-	sendBuf(buf);
-	
-	// Read result
-	const Buffer& res= getMessage();
-	if (!checkMessage(res, buf[4], idReplySize))
-	{
-		throw std::runtime_error("Corrupted message received");
-	}
+	const auto reply = bus->read(buf, idReplySize, std::nothrow);
+	if (!reply) return reply.error();
+	const Buffer& res = **reply;
 	
 	return res[5];
 }
@@ -583,7 +556,7 @@ void HiwonderBusServo::angleOffsetAdjust( int8_t angleDelta )
 	constexpr static uint8_t AngleOffsetAdjustId = 17;
 	constexpr static uint8_t AngleOffsetAdjustSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -606,7 +579,7 @@ void HiwonderBusServo::angleOffsetWrite()
 	constexpr static uint8_t AngleOffsetWriteId = 18;
 	constexpr static uint8_t AngleOffsetWriteSize = 3;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -623,12 +596,17 @@ void HiwonderBusServo::angleOffsetWrite()
 }
 
 int8_t HiwonderBusServo::angleOffsetRead() const
+{
+	return angleOffsetRead(std::nothrow).value();
+}
+
+Result<int8_t> HiwonderBusServo::angleOffsetRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t AngleOffsetReadId = 19;
 	constexpr static uint8_t AngleOffsetReadSize = 3;
 	constexpr static uint8_t AngleOffsetReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -638,7 +616,9 @@ int8_t HiwonderBusServo::angleOffsetRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, AngleOffsetReplySize);
+	const auto reply = genericRead(buf, AngleOffsetReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return static_cast<int8_t>(resultBuf[5]);
 }
@@ -648,7 +628,7 @@ void HiwonderBusServo::angleLimitWrite( int16_t minLimit, int16_t maxLimit)
 	constexpr static uint8_t AngleLimitWriteId = 20;
 	constexpr static uint8_t AngleLimitWriteSize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -678,12 +658,17 @@ void HiwonderBusServo::angleLimitWrite( int16_t minLimit, int16_t maxLimit)
 }
 
 HiwonderBusServo::Limit HiwonderBusServo::angleLimitRead() const
+{
+	return angleLimitRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::Limit> HiwonderBusServo::angleLimitRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t AngleLimitReadId = 21;
 	constexpr static uint8_t AngleLimitReadSize = 3;
 	constexpr static uint8_t AngleLimitReplySize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -693,7 +678,9 @@ HiwonderBusServo::Limit HiwonderBusServo::angleLimitRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, AngleLimitReplySize);
+	const auto reply = genericRead(buf, AngleLimitReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	Limit limit;
 	limit.minLimit = resultBuf[5]+(resultBuf[6]<<8);
@@ -706,7 +693,7 @@ void HiwonderBusServo::vinLimitWrite( int16_t minLimit, int16_t maxLimit)
 	constexpr static uint8_t VinLimitWriteId = 22;
 	constexpr static uint8_t VinLimitWriteSize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -736,12 +723,17 @@ void HiwonderBusServo::vinLimitWrite( int16_t minLimit, int16_t maxLimit)
 }	
 	
 HiwonderBusServo::Limit HiwonderBusServo::vinLimitRead() const
+{
+	return vinLimitRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::Limit> HiwonderBusServo::vinLimitRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t VinLimitReadId = 23;
 	constexpr static uint8_t VinLimitReadSize = 3;
 	constexpr static uint8_t VinLimitReplySize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -751,7 +743,9 @@ HiwonderBusServo::Limit HiwonderBusServo::vinLimitRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, VinLimitReplySize);
+	const auto reply = genericRead(buf, VinLimitReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	Limit limit;
 	limit.minLimit = resultBuf[5]+(resultBuf[6]<<8);
@@ -764,7 +758,7 @@ void HiwonderBusServo::tempMaxLimitWrite( uint8_t maxTemp)
 	constexpr static uint8_t TempMaxLimitWriteId = 24;
 	constexpr static uint8_t TempMaxLimitWriteSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -786,12 +780,17 @@ void HiwonderBusServo::tempMaxLimitWrite( uint8_t maxTemp)
 }	
 
 uint8_t HiwonderBusServo::tempMaxLimitRead() const
+{
+	return tempMaxLimitRead(std::nothrow).value();
+}
+
+Result<uint8_t> HiwonderBusServo::tempMaxLimitRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t TempMaxLimitReadId = 25;
 	constexpr static uint8_t TempMaxLimitReadSize = 3;
 	constexpr static uint8_t TempMaxLimitReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -801,18 +800,25 @@ uint8_t HiwonderBusServo::tempMaxLimitRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, TempMaxLimitReplySize);
+	const auto reply = genericRead(buf, TempMaxLimitReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return resultBuf[5];
 }
 
 uint8_t HiwonderBusServo::tempRead() const
+{
+	return tempRead(std::nothrow).value();
+}
+
+Result<uint8_t> HiwonderBusServo::tempRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t TempReadId = 26;
 	constexpr static uint8_t TempReadSize = 3;
 	constexpr static uint8_t TempReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -822,18 +828,25 @@ uint8_t HiwonderBusServo::tempRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, TempReplySize);
+	const auto reply = genericRead(buf, TempReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return resultBuf[5];
 }
 	
 uint16_t HiwonderBusServo::vinRead() const
+{
+	return vinRead(std::nothrow).value();
+}
+
+Result<uint16_t> HiwonderBusServo::vinRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t VInReadId = 27;
 	constexpr static uint8_t VInReadSize = 3;
 	constexpr static uint8_t VInReplySize = 5;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -843,18 +856,25 @@ uint16_t HiwonderBusServo::vinRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, VInReplySize);
+	const auto reply = genericRead(buf, VInReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return resultBuf[5]+(resultBuf[6]<<8);
 }
 
 int16_t HiwonderBusServo::posRead() const
+{
+	return posRead(std::nothrow).value();
+}
+
+Result<int16_t> HiwonderBusServo::posRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t posReadId = 28;
 	constexpr static uint8_t posReadSize = 3;
 	constexpr static uint8_t posReplySize = 5;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -864,7 +884,9 @@ int16_t HiwonderBusServo::posRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, posReplySize);
+	const auto reply = genericRead(buf, posReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return resultBuf[5]+(resultBuf[6]<<8);
 }
@@ -874,7 +896,7 @@ void HiwonderBusServo::servoOrMotorModeWrite( Mode mode, int16_t speed )
 	constexpr static uint8_t ServoOrMotorModeWriteId = 29;
 	constexpr static uint8_t ServoOrMotorModeWriteSize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -902,12 +924,17 @@ void HiwonderBusServo::servoOrMotorModeWrite( Mode mode, int16_t speed )
 }
 	
 HiwonderBusServo::ModeRead HiwonderBusServo::servoOrMotorModeRead() const
+{
+	return servoOrMotorModeRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::ModeRead> HiwonderBusServo::servoOrMotorModeRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t servoOrMotorModeReadId = 30;
 	constexpr static uint8_t servoOrMotorModeReadSize = 3;
 	constexpr static uint8_t servoOrMotorModeReplySize = 7;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -917,7 +944,9 @@ HiwonderBusServo::ModeRead HiwonderBusServo::servoOrMotorModeRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, servoOrMotorModeReplySize);
+	const auto reply = genericRead(buf, servoOrMotorModeReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	ModeRead result;
 	result.mode = static_cast<Mode>(resultBuf[5]);
@@ -925,12 +954,12 @@ HiwonderBusServo::ModeRead HiwonderBusServo::servoOrMotorModeRead() const
 	return result;
 }
 
-void HiwonderBusServo::loadOrUnloadWrite( LoadMode loadMode )
+void HiwonderBusServo::loadOrUnloadWrite( LoadMode loadMode, bool force )
 {
 	constexpr static uint8_t LoadOrUnloadWriteId = 31;
 	constexpr static uint8_t LoadOrUnloadWriteSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -945,16 +974,21 @@ void HiwonderBusServo::loadOrUnloadWrite( LoadMode loadMode )
 	buf[5] = static_cast<uint8_t>(loadMode);
 	buf[6] = checksum(buf);
 	
-	sendBuf(buf);
+	sendBuf(buf, force);
 }
 
 HiwonderBusServo::LoadMode HiwonderBusServo::loadOrUnloadRead() const
+{
+	return loadOrUnloadRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::LoadMode> HiwonderBusServo::loadOrUnloadRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t LoadOrUnloadReadId = 32;
 	constexpr static uint8_t LoadOrUnloadReadSize = 3;
 	constexpr static uint8_t LoadOrUnloadReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -964,17 +998,19 @@ HiwonderBusServo::LoadMode HiwonderBusServo::loadOrUnloadRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, LoadOrUnloadReplySize);
+	const auto reply = genericRead(buf, LoadOrUnloadReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return static_cast<LoadMode>(resultBuf[5]);
 }
 
-void HiwonderBusServo::ledCtrlWrite(PowerLed powerLed)
+void HiwonderBusServo::ledCtrlWrite(PowerLed powerLed, bool force)
 {
 	constexpr static uint8_t LedCtrlWriteId = 33;
 	constexpr static uint8_t LedCtrlWriteSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -989,16 +1025,21 @@ void HiwonderBusServo::ledCtrlWrite(PowerLed powerLed)
 	buf[5] = static_cast<uint8_t>(powerLed);
 	buf[6] = checksum(buf);
 	
-	sendBuf(buf);
+	sendBuf(buf, force);
 }
 	
 HiwonderBusServo::PowerLed HiwonderBusServo::ledCtrlRead() const
+{
+	return ledCtrlRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::PowerLed> HiwonderBusServo::ledCtrlRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t LedCtrlReadId = 34;
 	constexpr static uint8_t LedCtrlReadSize = 3;
 	constexpr static uint8_t LedCtrlReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -1008,7 +1049,9 @@ HiwonderBusServo::PowerLed HiwonderBusServo::ledCtrlRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, LedCtrlReplySize);
+	const auto reply = genericRead(buf, LedCtrlReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	return static_cast<PowerLed>(resultBuf[5]);
 }
@@ -1018,7 +1061,7 @@ void HiwonderBusServo::ledErrorWrite( bool overTemperature, bool overVoltage, bo
 	constexpr static uint8_t LedErrorWriteId = 35;
 	constexpr static uint8_t LedErrorWriteSize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -1037,12 +1080,17 @@ void HiwonderBusServo::ledErrorWrite( bool overTemperature, bool overVoltage, bo
 }
 
 HiwonderBusServo::LedError HiwonderBusServo::ledErrorRead() const
+{
+	return ledErrorRead(std::nothrow).value();
+}
+
+Result<HiwonderBusServo::LedError> HiwonderBusServo::ledErrorRead( std::nothrow_t ) const
 {
 	constexpr static uint8_t LedErrorReadId = 36;
 	constexpr static uint8_t LedErrorReadSize = 3;
 	constexpr static uint8_t LedErrorReplySize = 4;
 	
-	static Buffer buf
+	Buffer buf
 	{
 		FrameHeader, 
 		FrameHeader,
@@ -1052,7 +1100,9 @@ HiwonderBusServo::LedError HiwonderBusServo::ledErrorRead() const
 		_pholder
 	};
 	
-	const Buffer& resultBuf = genericRead(buf, LedErrorReplySize);
+	const auto reply = genericRead(buf, LedErrorReplySize);
+	if (!reply) return reply.error();
+	const Buffer& resultBuf = **reply;
 	
 	LedError result;
 	result.overTemperature = resultBuf[5] & 0x1;
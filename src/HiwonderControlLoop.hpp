@@ -0,0 +1,320 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_CONTROL_LOOP
+#define HIWONDER_RPI_CONTROL_LOOP
+
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+#include <sched.h>
+#include <sys/mman.h>
+
+namespace HiwonderRpi
+{
+
+/// Run a callback at a fixed period, with absolute-time wakeups.
+/// Compared to a loop with delay(), wakeups do not accumulate drift and,
+///     when real-time settings are requested, jitter stays in the order of
+///     tens of microseconds on a Raspberry PI with an isolated core.
+/// The loop runs in the calling thread: run() blocks until the callback
+///     returns false or stop() is called (from the callback or another thread).
+class ControlLoop
+{
+public:
+	/// What to do when one or more wakeups were missed (the callback took
+	///     longer than the period, or the thread was preempted)
+	enum class OverrunAction: uint8_t
+	{
+		CatchUp = 0,  /// Run the missed cycles back-to-back, keeping the original schedule
+		Skip = 1,     /// Drop the missed cycles, next wakeup stays aligned to the original schedule
+		Restart = 2   /// Drop the missed cycles and restart the schedule from now
+	};
+
+	/// Policy called on overrun, with the number of missed wakeups.
+	using OverrunPolicy = std::function<OverrunAction(uint64_t missed)>;
+
+	/// Cycle callback, with the cycle number. Return false to stop the loop.
+	using Callback = std::function<bool(uint64_t cycle)>;
+
+	struct Config
+	{
+		/// Period of the loop in nanoseconds
+		int64_t periodNs = 10000000;
+		/// CPU core to pin the loop to, -1 to keep the current affinity
+		int cpu = -1;
+		/// SCHED_FIFO priority [1,99], 0 to keep the current scheduler
+		int priority = 0;
+		/// Lock current and future memory pages (avoids page-faults in the loop)
+		bool lockMemory = false;
+	};
+
+	/// Wakeup latency is accumulated in a power-of-two histogram (in microseconds):
+	///     bucket i counts latencies in [2^(i-1), 2^i) us, bucket 0 is < 1us.
+	constexpr static size_t LatencyBuckets = 24;
+
+	struct Stats
+	{
+		uint64_t cycles = 0;       /// Number of callbacks executed
+		uint64_t overruns = 0;     /// Number of times the deadline was missed
+		uint64_t missed = 0;       /// Total number of missed wakeups (each counted once, even if caught up)
+		int64_t minLatencyNs = std::numeric_limits<int64_t>::max();
+		int64_t maxLatencyNs = 0;
+		int64_t sumLatencyNs = 0;
+		std::array<uint64_t, LatencyBuckets> histogram{};
+
+		/// Average wakeup latency in ns
+		double meanLatencyNs() const;
+
+		/// Upper bound of the wakeup latency for the given percentile (in ns)
+		/// @arg percentile: in [0,100]
+		int64_t latencyPercentileNs( double percentile ) const;
+	};
+
+	/// Create the control loop, this does not apply any setting yet.
+	ControlLoop( const Config& config );
+
+	/// Replace the policy applied on overrun (default: Skip)
+	void setOverrunPolicy( OverrunPolicy policy );
+
+	/// Apply the real-time settings (affinity, scheduler, memory lock) to the
+	///     calling thread, then run the callback every period.
+	/// @throw runtime_error if a real-time setting could not be applied (usually not root)
+	void run( const Callback& callback );
+
+	/// Request the loop to stop after the current cycle. Before run() is
+	///     called (e.g. from another thread), the next run returns at once.
+	void stop();
+
+	/// Statistics of the last/current run. Only consistent when read from
+	///     the callback or after run() returned.
+	const Stats& stats() const;
+
+	/// Scheduled wakeup time of the current cycle (CLOCK_MONOTONIC, in ns),
+	///     to be read from the callback. Unlike the clock, it does not
+	///     include the wakeup latency.
+	int64_t wakeupTimeNs() const;
+
+	/// Reset all the statistics
+	void resetStats();
+
+private:
+	/// Return the current time of the monotonic clock in ns
+	inline static int64_t now();
+
+	/// Convert ns to a timespec
+	inline static timespec toTimespec( int64_t ns );
+
+	/// Apply affinity, scheduler and memory settings to the calling thread
+	inline void applyRealTime() const;
+
+	/// Save one wakeup latency in the statistics
+	inline void recordLatency( int64_t latencyNs );
+
+	Config config;
+	OverrunPolicy overrunPolicy;
+	Stats stat;
+	int64_t scheduled = 0;
+	// Set by stop(), cleared when run() returns
+	std::atomic<bool> stopRequested{false};
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+double ControlLoop::Stats::meanLatencyNs() const
+{
+	return cycles ? static_cast<double>(sumLatencyNs)/cycles : 0.0;
+}
+
+int64_t ControlLoop::Stats::latencyPercentileNs( double percentile ) const
+{
+	const double target = cycles*percentile/100.0;
+	uint64_t acc = 0;
+	for (size_t i=0; i<LatencyBuckets; ++i)
+	{
+		acc += histogram[i];
+		if (acc>=target && acc>0)
+		{
+			return std::min(maxLatencyNs, static_cast<int64_t>(1000)<<i);
+		}
+	}
+	return maxLatencyNs;
+}
+
+ControlLoop::ControlLoop( const Config& config ): config(config),
+    overrunPolicy([](uint64_t){ return OverrunAction::Skip; })
+{
+	if (config.periodNs<=0)
+	{
+		throw std::runtime_error("Control loop period must be positive");
+	}
+}
+
+void ControlLoop::setOverrunPolicy( OverrunPolicy policy )
+{
+	overrunPolicy = std::move(policy);
+}
+
+int64_t ControlLoop::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<int64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+timespec ControlLoop::toTimespec( int64_t ns )
+{
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(ns/1000000000);
+	ts.tv_nsec = static_cast<long>(ns%1000000000);
+	return ts;
+}
+
+void ControlLoop::applyRealTime() const
+{
+	if (config.cpu>=0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(config.cpu, &set);
+		if (0!=sched_setaffinity(0, sizeof(set), &set))
+		{
+			throw std::runtime_error("Unable to pin the control loop to the requested CPU");
+		}
+	}
+
+	if (config.priority>0)
+	{
+		sched_param param{};
+		param.sched_priority = config.priority;
+		if (0!=sched_setscheduler(0, SCHED_FIFO, &param))
+		{
+			throw std::runtime_error("Unable to set SCHED_FIFO scheduler");
+		}
+	}
+
+	if (config.lockMemory && 0!=mlockall(MCL_CURRENT|MCL_FUTURE))
+	{
+		throw std::runtime_error("Unable to lock memory");
+	}
+}
+
+void ControlLoop::recordLatency( int64_t latencyNs )
+{
+	if (latencyNs<0) latencyNs=0;
+
+	stat.minLatencyNs = std::min(stat.minLatencyNs, latencyNs);
+	stat.maxLatencyNs = std::max(stat.maxLatencyNs, latencyNs);
+	stat.sumLatencyNs += latencyNs;
+
+	size_t bucket = 0;
+	for (int64_t us = latencyNs/1000; us>0 && bucket<LatencyBuckets-1; us>>=1) ++bucket;
+	stat.histogram[bucket]++;
+}
+
+void ControlLoop::run( const Callback& callback )
+{
+	applyRealTime();
+
+	int64_t next = now() + config.periodNs;
+	// Last wakeup already counted as missed (caught-up cycles are late, but
+	//     were counted by the overrun that delayed them)
+	int64_t countedUntil = std::numeric_limits<int64_t>::min();
+
+	while (!stopRequested)
+	{
+		const timespec wakeup = toTimespec(next);
+		while (EINTR==clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, nullptr)) continue;
+
+		recordLatency(now()-next);
+		scheduled = next;
+
+		if (!callback(stat.cycles++))
+		{
+			break;
+		}
+
+		next += config.periodNs;
+
+		// Deadline check: the next wakeup is already in the past
+		const int64_t end = now();
+		if (end>=next)
+		{
+			const uint64_t missed = static_cast<uint64_t>((end-next)/config.periodNs)+1;
+			const int64_t last = next + static_cast<int64_t>(missed-1)*config.periodNs;
+			if (last<=countedUntil)
+			{
+				// Catching up on wakeups already counted
+				continue;
+			}
+			stat.overruns++;
+			stat.missed += countedUntil<next ? missed : static_cast<uint64_t>((last-countedUntil)/config.periodNs);
+			countedUntil = last;
+
+			switch (overrunPolicy(missed))
+			{
+				case OverrunAction::CatchUp:
+					break;
+				case OverrunAction::Skip:
+					next += static_cast<int64_t>(missed)*config.periodNs;
+					break;
+				case OverrunAction::Restart:
+					next = end + config.periodNs;
+					break;
+			}
+		}
+	}
+
+	stopRequested = false;
+}
+
+void ControlLoop::stop()
+{
+	stopRequested = true;
+}
+
+const ControlLoop::Stats& ControlLoop::stats() const
+{
+	return stat;
+}
+
+int64_t ControlLoop::wakeupTimeNs() const
+{
+	return scheduled;
+}
+
+void ControlLoop::resetStats()
+{
+	stat = Stats();
+}
+
+}
+#endif //HIWONDER_RPI_CONTROL_LOOP
@@ -0,0 +1,289 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_DISCOVERY
+#define HIWONDER_RPI_DISCOVERY
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderBusGroup.hpp"
+#include "HiwonderBusServo.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Find the servos connected to a bus, or to all the buses of a group.
+/// Each ID is probed with an addressed ID_READ, waiting for the reply only
+///     for the wire time of the request and reply plus a small margin.
+/// The bus is half-duplex: probes can not overlap without their replies
+///     colliding. Instead, probe frames are prepared upfront and the next one
+///     is sent as soon as the previous reply is complete (or timed out);
+///     buses of a group are scanned in parallel.
+class ServoDiscovery
+{
+public:
+	/// Default servo turnaround margin, in us
+	constexpr static uint32_t DefaultMarginUs = 500;
+
+	struct Config
+	{
+		uint8_t firstId = 0;
+		uint8_t lastId = 253;
+		/// Servo turnaround margin added to the wire time, in us
+		uint32_t marginUs = DefaultMarginUs;
+		/// Read the inventory (position, vin, temp and limits) of found servos
+		bool inventory = true;
+	};
+
+	struct ServoInfo
+	{
+		uint8_t id = 0;
+		uint8_t bus = 0;                   /// bus index in the group (0 for a single bus)
+		bool complete = false;             /// inventory read without error
+		int16_t position = 0;
+		uint16_t vin = 0;
+		uint8_t temp = 0;
+		HiwonderBusServo::Limit angleLimit;
+		HiwonderBusServo::Limit vinLimit;
+		uint8_t tempMaxLimit = 0;
+	};
+
+	/// Return the time to wait for the reply of a probe, in us
+	/// @arg baud: baud rate of the bus
+	/// @arg marginUs: servo turnaround margin
+	static uint32_t probeTimeoutUs( int baud, uint32_t marginUs );
+
+	/// Return true if a servo answers on <id>, waiting at most for the probe timeout
+	static bool probe( HiwonderBus& bus, uint8_t id, uint32_t marginUs=DefaultMarginUs );
+
+	/// Scan one bus
+	static std::vector<ServoInfo> scan( HiwonderBus& bus, const Config& config );
+	static std::vector<ServoInfo> scan( HiwonderBus& bus );
+
+	/// Scan all the buses of a group in parallel, and assign each servo
+	///     found to its bus. The result is sorted by id.
+	/// @throw the first transport error of a bus (e.g. a device that can not
+	///     be opened), once all the buses are done
+	static std::vector<ServoInfo> scan( BusGroup& group, const Config& config );
+	static std::vector<ServoInfo> scan( BusGroup& group );
+
+private:
+	constexpr static uint8_t IdReadId = 14;
+	constexpr static uint8_t IdReadSize = 3;
+	constexpr static uint8_t IdReplySize = 4;
+
+	/// Return the ID_READ request for a servo
+	inline static HiwonderBus::Buffer probeFrame( uint8_t id );
+
+	/// Send a probe (with the reply timeout already set), return true if the servo answered
+	inline static bool sendProbe( HiwonderBus& bus, const HiwonderBus::Buffer& probe );
+
+	/// Read the inventory of a found servo
+	inline static void readInventory( HiwonderBus& bus, ServoInfo& info );
+
+	/// Probe settings of a bus (short reply timeout, no retries, no adaptive
+	///     timeouts) while in scope; the previous settings are restored on
+	///     destruction, also when a transport error is thrown
+	class ProbeSettings
+	{
+	public:
+		inline ProbeSettings( HiwonderBus& bus, uint32_t marginUs );
+		ProbeSettings( const ProbeSettings& ) = delete;
+		ProbeSettings& operator=( const ProbeSettings& ) = delete;
+		inline ~ProbeSettings();
+
+	private:
+		HiwonderBus& bus;
+		const uint32_t timeoutUs;
+		const HiwonderBus::RetryPolicy policy;
+		const ReplyLatency::Config latency;
+	};
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+uint32_t ServoDiscovery::probeTimeoutUs( int baud, uint32_t marginUs )
+{
+	// 10 bits per byte (start, 8 data, stop)
+	constexpr uint32_t WireBytes = (IdReadSize+3)+(IdReplySize+3);
+	return static_cast<uint32_t>(WireBytes*10*1000000ull/std::max(baud, 1)) + marginUs;
+}
+
+HiwonderBus::Buffer ServoDiscovery::probeFrame( uint8_t id )
+{
+	HiwonderBus::Buffer buf{HiwonderBus::FrameHeader, HiwonderBus::FrameHeader, id, IdReadSize, IdReadId};
+	buf[5] = HiwonderBus::checksum(buf);
+	return buf;
+}
+
+bool ServoDiscovery::sendProbe( HiwonderBus& bus, const HiwonderBus::Buffer& probe )
+{
+	// A timeout means no servo with this id
+	const auto reply = bus.read(probe, IdReplySize, std::nothrow);
+	return reply && (**reply)[5]==probe[2];
+}
+
+ServoDiscovery::ProbeSettings::ProbeSettings( HiwonderBus& bus, uint32_t marginUs ):
+    bus(bus), timeoutUs(bus.replyTimeout()), policy(bus.retryPolicy()), latency(bus.getReplyLatency().getConfig())
+{
+	bus.setReplyTimeout(probeTimeoutUs(bus.getTransport().baud(), marginUs));
+	bus.setRetryPolicy(HiwonderBus::RetryPolicy());
+	ReplyLatency::Config config = latency;
+	config.enabled = false;
+	bus.getReplyLatency().setConfig(config);
+}
+
+ServoDiscovery::ProbeSettings::~ProbeSettings()
+{
+	bus.getReplyLatency().setConfig(latency);
+	bus.setRetryPolicy(policy);
+	bus.setReplyTimeout(timeoutUs);
+}
+
+bool ServoDiscovery::probe( HiwonderBus& bus, uint8_t id, uint32_t marginUs )
+{
+	const ProbeSettings settings(bus, marginUs);
+	return sendProbe(bus, probeFrame(id));
+}
+
+void ServoDiscovery::readInventory( HiwonderBus& bus, ServoInfo& info )
+{
+	const HiwonderBusServo servo(bus, info.id);
+	info.complete = false;
+
+	const auto position = servo.posRead(std::nothrow);
+	if (!position) return;
+	info.position = *position;
+	const auto vin = servo.vinRead(std::nothrow);
+	if (!vin) return;
+	info.vin = *vin;
+	const auto temp = servo.tempRead(std::nothrow);
+	if (!temp) return;
+	info.temp = *temp;
+	const auto angleLimit = servo.angleLimitRead(std::nothrow);
+	if (!angleLimit) return;
+	info.angleLimit = *angleLimit;
+	const auto vinLimit = servo.vinLimitRead(std::nothrow);
+	if (!vinLimit) return;
+	info.vinLimit = *vinLimit;
+	const auto tempMaxLimit = servo.tempMaxLimitRead(std::nothrow);
+	if (!tempMaxLimit) return;
+	info.tempMaxLimit = *tempMaxLimit;
+
+	info.complete = true;
+}
+
+std::vector<ServoDiscovery::ServoInfo> ServoDiscovery::scan( HiwonderBus& bus, const Config& config )
+{
+	std::vector<ServoInfo> found;
+
+	// Prepare all the probe frames
+	std::vector<HiwonderBus::Buffer> probes;
+	for (unsigned id=config.firstId; id<=config.lastId && id<HiwonderBus::BroadcastId; ++id)
+	{
+		probes.push_back(probeFrame(static_cast<uint8_t>(id)));
+	}
+
+	// Most ids are expected to be missing: no retries, and probes are sent
+	//     even to degraded servos without being accounted as failures
+	{
+		const ProbeSettings settings(bus, config.marginUs);
+		for (const auto& probe: probes)
+		{
+			if (sendProbe(bus, probe))
+			{
+				ServoInfo info;
+				info.id = probe[2];
+				found.push_back(info);
+			}
+		}
+	}
+
+	if (config.inventory)
+	{
+		for (auto& info: found) readInventory(bus, info);
+	}
+	return found;
+}
+
+std::vector<ServoDiscovery::ServoInfo> ServoDiscovery::scan( HiwonderBus& bus )
+{
+	return scan(bus, Config());
+}
+
+std::vector<ServoDiscovery::ServoInfo> ServoDiscovery::scan( BusGroup& group, const Config& config )
+{
+	std::vector<std::vector<ServoInfo>> perBus(group.busCount());
+	std::vector<std::exception_ptr> errors(group.busCount());
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		group.getExecutor(b).post([&perBus, &errors, &config, b](HiwonderBus& bus)
+		{
+			try
+			{
+				perBus[b] = scan(bus, config);
+			}
+			catch(...)
+			{
+				errors[b] = std::current_exception();
+			}
+		});
+	}
+
+	// All the jobs must be done before leaving: they write to perBus and errors
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		group.getExecutor(b).wait();
+	}
+	for (const auto& error: errors)
+	{
+		if (error) std::rethrow_exception(error);
+	}
+
+	std::vector<ServoInfo> found;
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		for (auto info: perBus[b])
+		{
+			info.bus = static_cast<uint8_t>(b);
+			group.assign(info.id, b);
+			found.push_back(info);
+		}
+	}
+
+	std::sort(found.begin(), found.end(), [](const ServoInfo& a, const ServoInfo& b){ return a.id<b.id; });
+	return found;
+}
+
+std::vector<ServoDiscovery::ServoInfo> ServoDiscovery::scan( BusGroup& group )
+{
+	return scan(group, Config());
+}
+
+}
+#endif //HIWONDER_RPI_DISCOVERY
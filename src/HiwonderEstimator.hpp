@@ -0,0 +1,245 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_ESTIMATOR
+#define HIWONDER_RPI_ESTIMATOR
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "HiwonderBusServo.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Estimate the position of a servo between reads, to avoid a posRead round trip
+///     when the servo is just following the last moveTimeWrite.
+/// The servo is assumed to follow the commanded move: a linear motion from the
+///     estimated position to the target, in the given time (or at max speed).
+/// A scalar Kalman filter tracks the error between the real and the commanded
+///     position (random walk, faster while moving); its variance grows with time
+///     until a real read is needed.
+class PositionEstimator
+{
+public:
+	struct Config
+	{
+		/// Growth of the tracking error variance while holding (units^2/s)
+		float holdNoise = 1.0f;
+		/// Growth of the tracking error variance while moving (units^2/s)
+		float moveNoise = 200.0f;
+		/// Variance of a posRead (units^2)
+		float readNoise = 4.0f;
+		/// A real read is issued above this standard deviation (units)
+		float threshold = 8.0f;
+		/// Max speed of the servo, used for moves with time=0 (units/s)
+		float maxSpeed = 1400.0f;
+	};
+
+	struct Stats
+	{
+		uint64_t reads = 0;      /// posRead issued on the bus
+		uint64_t estimates = 0;  /// posRead answered from the estimation
+	};
+
+	/// Create the estimator; the position is unknown until the first read.
+	PositionEstimator();
+	PositionEstimator( const Config& config );
+
+	/// Return the current time in seconds, the default time base of this class
+	static double clock();
+
+	/// Send a move to the servo and record it as the commanded motion
+	void moveTimeWrite( HiwonderBusServo& servo, int16_t position, uint16_t time=0, double now=clock() );
+
+	/// Return the estimated position, or read it from the servo if the
+	///     uncertainty is above the threshold.
+	int16_t posRead( const HiwonderBusServo& servo, double now=clock() );
+
+	/// Record a commanded move, without sending it
+	void command( int16_t position, uint16_t time, double now=clock() );
+
+	/// Correct the estimation with a position read from the servo
+	void update( int16_t measured, double now=clock() );
+
+	/// Return the predicted position (servo units)
+	float predict( double now=clock() ) const;
+
+	/// Return the standard deviation of the prediction (servo units)
+	float uncertainty( double now=clock() ) const;
+
+	/// Return true if the uncertainty is above the threshold
+	bool needsRead( double now=clock() ) const;
+
+	/// Forget the state (e.g. the servo was unloaded and moved by hand)
+	void reset();
+
+	const Stats& stats() const;
+
+private:
+	/// Return the commanded position at a given time
+	inline float commanded( double now ) const;
+
+	/// Return the variance of the tracking error at a given time
+	inline float variance( double now ) const;
+
+	Config config;
+	Stats stat;
+
+	// Commanded move: linear from startPos to targetPos in [startTime, endTime]
+	float startPos = 0.0f;
+	float targetPos = 0.0f;
+	double startTime = 0.0;
+	double endTime = 0.0;
+
+	// Tracking error (real-commanded) and its variance at errorTime
+	float error = 0.0f;
+	float errorVar = std::numeric_limits<float>::infinity();
+	double errorTime = 0.0;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+PositionEstimator::PositionEstimator(): PositionEstimator(Config())
+{
+}
+
+PositionEstimator::PositionEstimator( const Config& config ): config(config)
+{
+}
+
+double PositionEstimator::clock()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+float PositionEstimator::commanded( double now ) const
+{
+	if (now>=endTime) return targetPos;
+	if (now<=startTime) return startPos;
+	return startPos + (targetPos-startPos)*static_cast<float>((now-startTime)/(endTime-startTime));
+}
+
+float PositionEstimator::variance( double now ) const
+{
+	// The motion part is only accumulated over the overlap with the move
+	const double dt = std::max(0.0, now-errorTime);
+	const double moving = std::max(0.0, std::min(now, endTime)-std::max(errorTime, startTime));
+	return errorVar + static_cast<float>(config.holdNoise*dt + config.moveNoise*moving);
+}
+
+void PositionEstimator::command( int16_t position, uint16_t time, double now )
+{
+	position = std::max(0_int16, std::min(position, 1000_int16));
+
+	// Fold the current error into the new move start
+	const float current = predict(now);
+	errorVar = variance(now);
+	errorTime = now;
+	error = 0.0f;
+
+	const float distance = std::abs(position-current);
+	const double duration = std::max(time/1000.0, static_cast<double>(distance/config.maxSpeed));
+	startPos = current;
+	targetPos = position;
+	startTime = now;
+	endTime = now+duration;
+}
+
+void PositionEstimator::update( int16_t measured, double now )
+{
+	const float var = variance(now);
+	const float predicted = commanded(now)+error;
+
+	if (std::isinf(var))
+	{
+		// First measurement: no prior
+		error = measured-commanded(now);
+		errorVar = config.readNoise;
+	}
+	else
+	{
+		const float gain = var/(var+config.readNoise);
+		error += gain*(measured-predicted);
+		errorVar = (1.0f-gain)*var;
+	}
+	errorTime = now;
+
+	if (now>=endTime)
+	{
+		// Move is over, the servo holds where it is
+		startPos = targetPos = commanded(now)+error;
+		error = 0.0f;
+	}
+}
+
+float PositionEstimator::predict( double now ) const
+{
+	return commanded(now)+error;
+}
+
+float PositionEstimator::uncertainty( double now ) const
+{
+	return std::sqrt(variance(now));
+}
+
+bool PositionEstimator::needsRead( double now ) const
+{
+	return variance(now) > config.threshold*config.threshold;
+}
+
+void PositionEstimator::reset()
+{
+	*this = PositionEstimator(config);
+}
+
+const PositionEstimator::Stats& PositionEstimator::stats() const
+{
+	return stat;
+}
+
+void PositionEstimator::moveTimeWrite( HiwonderBusServo& servo, int16_t position, uint16_t time, double now )
+{
+	servo.moveTimeWrite(position, time);
+	command(position, time, now);
+}
+
+int16_t PositionEstimator::posRead( const HiwonderBusServo& servo, double now )
+{
+	if (needsRead(now))
+	{
+		const int16_t measured = servo.posRead();
+		update(measured, now);
+		stat.reads++;
+		return measured;
+	}
+	stat.estimates++;
+	return static_cast<int16_t>(std::lround(predict(now)));
+}
+
+}
+#endif //HIWONDER_RPI_ESTIMATOR
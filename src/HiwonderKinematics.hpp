@@ -0,0 +1,295 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_KINEMATICS
+#define HIWONDER_RPI_KINEMATICS
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "HiwonderSimd.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Batched forward/inverse kinematics for 3-DOF serial chains:
+///     coxa (yaw), femur (pitch) and tibia (pitch), as found in hexapod legs
+///     or simple arms.
+/// All limbs are processed together in structure-of-arrays layout,
+///     Simd::Vec::Lanes limbs at a time (NEON on the PI, SSE/AVX on x86).
+///
+/// Frame of each limb: origin on the coxa axis, x forward, y left, z up.
+/// Joint angles are 0 when the chain is straight and horizontal along x;
+///     femur positive up, tibia relative to the femur (negative = bent down).
+/// Angles are directly converted to/from servo units (0.24deg, 500 = 0rad) using
+///     the calibration of each servo: offset, direction and angle limits.
+class LegKinematics
+{
+public:
+	enum JointIndex: uint8_t
+	{
+		Coxa = 0,
+		Femur = 1,
+		Tibia = 2
+	};
+	constexpr static size_t JointCount = 3;
+
+	/// Segment lengths of a limb (any unit, same as the positions)
+	struct Geometry
+	{
+		float coxa = 0.0f;
+		float femur = 1.0f;
+		float tibia = 1.0f;
+	};
+
+	/// Calibration of a servo in the chain, in servo units
+	struct Joint
+	{
+		int16_t offset = 0;        /// Servo position for 0 rad is 500+offset
+		int8_t direction = 1;      /// 1 or -1 if the servo is mounted reversed
+		int16_t minLimit = 0;      /// Same as angleLimitRead
+		int16_t maxLimit = 1000;
+	};
+
+	/// Servo positions of all the limbs for one joint, [limb]
+	using Units = std::array<int16_t*, JointCount>;
+	using ConstUnits = std::array<const int16_t*, JointCount>;
+
+	/// Create the solver for a number of limbs; all limbs default to Geometry() and Joint()
+	LegKinematics( size_t limbs );
+
+	/// Number of limbs
+	size_t limbs() const;
+
+	/// Set the geometry and calibration of a limb
+	void setLimb( size_t limb, const Geometry& geometry, const std::array<Joint, JointCount>& joints );
+
+	/// Inverse kinematics for all limbs, in knee-up configuration.
+	/// Unreachable targets give the nearest reachable pose; results are clamped
+	///     to the angle limits of each servo.
+	/// @arg x, y, z: foot targets, [limb]
+	/// @arg units: output servo positions for each joint, [joint][limb]
+	void inverse( const float* x, const float* y, const float* z, const Units& units ) const;
+
+	/// Forward kinematics for all limbs.
+	/// @arg units: servo positions for each joint (e.g. from posRead), [joint][limb]
+	/// @arg x, y, z: output foot positions, [limb]
+	void forward( const ConstUnits& units, float* x, float* y, float* z ) const;
+
+private:
+	/// Servo units per radian
+	constexpr static float UnitsPerRad = 180.0f/(Simd::Pi*0.24f);
+
+	/// Compute Lanes limbs starting at <limb>, into float units [joint][lane]
+	inline void inverseBlock( size_t limb, const float* x, const float* y, const float* z,
+	    float (&out)[JointCount][Simd::Vec::Lanes] ) const;
+
+	/// Compute Lanes limbs starting at <limb>, from float units [joint][lane]
+	inline void forwardBlock( size_t limb, const float (&in)[JointCount][Simd::Vec::Lanes],
+	    float* x, float* y, float* z ) const;
+
+	size_t count;
+	size_t padded; // count rounded up to a multiple of Lanes
+
+	// Per limb parameters, padded
+	std::vector<float> coxaLength;
+	std::vector<float> femurLength;
+	std::vector<float> tibiaLength;
+	// Per joint and limb parameters, [joint][limb], padded
+	std::array<std::vector<float>, JointCount> center; // 500+offset
+	std::array<std::vector<float>, JointCount> scale;  // direction*UnitsPerRad
+	std::array<std::vector<float>, JointCount> minUnit;
+	std::array<std::vector<float>, JointCount> maxUnit;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+LegKinematics::LegKinematics( size_t limbs ): count(limbs),
+    padded((limbs+Simd::Vec::Lanes-1)/Simd::Vec::Lanes*Simd::Vec::Lanes),
+    coxaLength(padded, Geometry().coxa),
+    femurLength(padded, Geometry().femur),
+    tibiaLength(padded, Geometry().tibia)
+{
+	for (size_t j=0; j<JointCount; ++j)
+	{
+		center[j].assign(padded, 500.0f);
+		scale[j].assign(padded, UnitsPerRad);
+		minUnit[j].assign(padded, 0.0f);
+		maxUnit[j].assign(padded, 1000.0f);
+	}
+}
+
+size_t LegKinematics::limbs() const
+{
+	return count;
+}
+
+void LegKinematics::setLimb( size_t limb, const Geometry& geometry, const std::array<Joint, JointCount>& joints )
+{
+	if (limb>=count)
+	{
+		throw std::runtime_error("Invalid limb index");
+	}
+
+	coxaLength[limb] = geometry.coxa;
+	femurLength[limb] = geometry.femur;
+	tibiaLength[limb] = geometry.tibia;
+	for (size_t j=0; j<JointCount; ++j)
+	{
+		center[j][limb] = 500.0f + joints[j].offset;
+		scale[j][limb] = (joints[j].direction<0 ? -1.0f : 1.0f)*UnitsPerRad;
+		minUnit[j][limb] = joints[j].minLimit;
+		maxUnit[j][limb] = joints[j].maxLimit;
+	}
+}
+
+void LegKinematics::inverseBlock( size_t limb, const float* x, const float* y, const float* z,
+    float (&out)[JointCount][Simd::Vec::Lanes] ) const
+{
+	using namespace Simd;
+
+	const Vec vx = load(x);
+	const Vec vy = load(y);
+	const Vec vz = load(z);
+	const Vec coxa = load(&coxaLength[limb]);
+	const Vec femur = load(&femurLength[limb]);
+	const Vec tibia = load(&tibiaLength[limb]);
+	const Vec eps = set(1e-6f);
+
+	// Coxa: yaw toward the target
+	const Vec yaw = atan2(vy, vx);
+
+	// Femur/tibia: planar 2-link problem in the vertical plane of the leg
+	const Vec r = sqrt(vx*vx + vy*vy) - coxa;
+	const Vec d2 = r*r + vz*vz;
+	const Vec d = max(sqrt(d2), eps);
+	const Vec alpha = acos((femur*femur + d2 - tibia*tibia)/(set(2.0f)*femur*d));
+	const Vec knee = acos((femur*femur + tibia*tibia - d2)/(set(2.0f)*femur*tibia));
+
+	const Vec angles[JointCount] = { yaw, atan2(vz, r) + alpha, knee - set(Pi) };
+	for (size_t j=0; j<JointCount; ++j)
+	{
+		const Vec units = load(&center[j][limb]) + load(&scale[j][limb])*angles[j];
+		store(out[j], clamp(units, load(&minUnit[j][limb]), load(&maxUnit[j][limb])));
+	}
+}
+
+void LegKinematics::forwardBlock( size_t limb, const float (&in)[JointCount][Simd::Vec::Lanes],
+    float* x, float* y, float* z ) const
+{
+	using namespace Simd;
+
+	Vec angles[JointCount];
+	for (size_t j=0; j<JointCount; ++j)
+	{
+		angles[j] = (load(in[j]) - load(&center[j][limb]))/load(&scale[j][limb]);
+	}
+
+	Vec sinYaw, cosYaw, sinFemur, cosFemur, sinTibia, cosTibia;
+	sincos(angles[Coxa], sinYaw, cosYaw);
+	sincos(angles[Femur], sinFemur, cosFemur);
+	sincos(angles[Tibia], sinTibia, cosTibia);
+
+	// Absolute tibia angle by angle addition (keeps sincos input in [-Pi,Pi])
+	const Vec sinFoot = sinFemur*cosTibia + cosFemur*sinTibia;
+	const Vec cosFoot = cosFemur*cosTibia - sinFemur*sinTibia;
+
+	const Vec femur = load(&femurLength[limb]);
+	const Vec tibia = load(&tibiaLength[limb]);
+	const Vec r = load(&coxaLength[limb]) + femur*cosFemur + tibia*cosFoot;
+
+	store(x, r*cosYaw);
+	store(y, r*sinYaw);
+	store(z, femur*sinFemur + tibia*sinFoot);
+}
+
+void LegKinematics::inverse( const float* x, const float* y, const float* z, const Units& units ) const
+{
+	constexpr size_t Lanes = Simd::Vec::Lanes;
+	float out[JointCount][Lanes];
+
+	for (size_t limb=0; limb<count; limb+=Lanes)
+	{
+		const size_t n = std::min(Lanes, count-limb);
+		if (n==Lanes)
+		{
+			inverseBlock(limb, x+limb, y+limb, z+limb, out);
+		}
+		else
+		{
+			// Tail: pad the inputs with a reachable target
+			float tx[Lanes], ty[Lanes], tz[Lanes];
+			for (size_t i=0; i<Lanes; ++i)
+			{
+				tx[i] = i<n ? x[limb+i] : 1.0f;
+				ty[i] = i<n ? y[limb+i] : 0.0f;
+				tz[i] = i<n ? z[limb+i] : 0.0f;
+			}
+			inverseBlock(limb, tx, ty, tz, out);
+		}
+
+		for (size_t j=0; j<JointCount; ++j)
+		{
+			for (size_t i=0; i<n; ++i)
+			{
+				// Units are clamped to the (non-negative) servo range: +0.5 rounds
+				units[j][limb+i] = static_cast<int16_t>(out[j][i]+0.5f);
+			}
+		}
+	}
+}
+
+void LegKinematics::forward( const ConstUnits& units, float* x, float* y, float* z ) const
+{
+	constexpr size_t Lanes = Simd::Vec::Lanes;
+	float in[JointCount][Lanes];
+	float tx[Lanes], ty[Lanes], tz[Lanes];
+
+	for (size_t limb=0; limb<count; limb+=Lanes)
+	{
+		const size_t n = std::min(Lanes, count-limb);
+		for (size_t j=0; j<JointCount; ++j)
+		{
+			for (size_t i=0; i<Lanes; ++i)
+			{
+				in[j][i] = i<n ? units[j][limb+i] : 500.0f;
+			}
+		}
+
+		forwardBlock(limb, in, tx, ty, tz);
+
+		for (size_t i=0; i<n; ++i)
+		{
+			x[limb+i] = tx[i];
+			y[limb+i] = ty[i];
+			z[limb+i] = tz[i];
+		}
+	}
+}
+
+}
+#endif //HIWONDER_RPI_KINEMATICS
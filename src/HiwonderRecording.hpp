@@ -0,0 +1,335 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_RECORDING
+#define HIWONDER_RPI_RECORDING
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HiwonderBusGroup.hpp"
+#include "HiwonderControlLoop.hpp"
+
+namespace HiwonderRpi
+{
+
+/// File format of a recorded motion, shared by MotionRecorder and MotionRecording:
+///     a header, the servo ids (padded to an even size), then one frame per
+///     sample: the positions of all the servos (int16, servo units).
+/// Samples are taken at a fixed period, so frames have no timestamp, and the
+///     number of frames is given by the file size: a recording interrupted
+///     before close() is still valid up to its last complete frame.
+struct MotionFile
+{
+	constexpr static char Magic[8] = {'H','W','M','O','T','N','0','1'};
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t periodUs;       /// Time between two frames
+		uint16_t servoCount;
+		uint16_t reserved;
+	};
+
+	/// Offset of the first frame
+	static size_t framesOffset( size_t servoCount )
+	{
+		return sizeof(Header) + ((servoCount+1)&~size_t(1));
+	}
+};
+
+/// Write a recorded motion, one frame at a time.
+/// Frames go through a stream buffer: memory does not grow with the length
+///     of the recording.
+class MotionRecorder
+{
+public:
+	/// Create the file and write its header
+	/// @arg ids: recorded servos, the order of the positions in each frame
+	/// @arg periodUs: time between two frames
+	/// @throw runtime_error if the file can not be written
+	MotionRecorder( const std::string& path, const std::vector<uint8_t>& ids, uint32_t periodUs );
+
+	/// Append a frame: one position per servo, in the order of the ids
+	/// @throw runtime_error on write error
+	void append( const int16_t* positions );
+
+	/// Number of frames written
+	uint64_t frameCount() const;
+
+	/// Flush and close the file
+	/// @throw runtime_error on write error
+	void close();
+
+private:
+	std::ofstream out;
+	std::string path;
+	size_t servoCount;
+	uint64_t frames = 0;
+};
+
+/// A recorded motion, memory-mapped: frames are read in place and pages
+///     already played are released, so long recordings play back with
+///     constant memory.
+class MotionRecording
+{
+public:
+	/// Memory-map a recorded motion
+	/// @throw runtime_error if the file can not be mapped or is not valid
+	static MotionRecording load( const std::string& path );
+
+	MotionRecording( const MotionRecording& ) = delete;
+	MotionRecording& operator=( const MotionRecording& ) = delete;
+	MotionRecording( MotionRecording&& other ) noexcept;
+	MotionRecording& operator=( MotionRecording&& other ) noexcept;
+	~MotionRecording();
+
+	/// Time between two frames, in us
+	uint32_t periodUs() const;
+
+	/// Recorded servos
+	size_t servoCount() const;
+	const uint8_t* ids() const;
+
+	/// Number of complete frames
+	uint64_t frameCount() const;
+
+	/// Return the positions of a frame, [servoCount()] (no bound check)
+	const int16_t* frame( uint64_t index ) const;
+
+	/// Send the frames to the servos as group moves at the recorded period
+	///     (blocking). Each move lasts one period, so servos interpolate
+	///     between frames. The servos must be assigned to a bus of the group.
+	/// Frames are taken from the loop schedule: skipped cycles do not slow down
+	///     the motion, and each frame is sent at most once.
+	/// @arg loopConfig: real-time settings for the loop, the period is overwritten
+	/// @return the statistics of the loop
+	ControlLoop::Stats play( BusGroup& group, ControlLoop::Config loopConfig = ControlLoop::Config() ) const;
+
+private:
+	/// Pages of frames released at once, once played
+	constexpr static size_t ReleaseBytes = 1<<20;
+
+	MotionRecording() = default;
+
+	inline const MotionFile::Header& header() const;
+
+	/// Release the pages of the frames before <index> not released yet
+	inline void release( uint64_t index, size_t& released ) const;
+
+	void* mapped = nullptr;
+	size_t mappedSize = 0;
+	const uint8_t* image = nullptr;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+MotionRecorder::MotionRecorder( const std::string& path, const std::vector<uint8_t>& ids, uint32_t periodUs ):
+    out(path, std::ios::binary), path(path), servoCount(ids.size())
+{
+	if (ids.empty() || ids.size()>0xFFFF || 0==periodUs)
+	{
+		throw std::runtime_error("Invalid motion recording parameters");
+	}
+
+	MotionFile::Header header{};
+	std::memcpy(header.magic, MotionFile::Magic, sizeof(MotionFile::Magic));
+	header.periodUs = periodUs;
+	header.servoCount = static_cast<uint16_t>(ids.size());
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<uint8_t> padded(ids);
+	padded.resize(MotionFile::framesOffset(ids.size())-sizeof(header), 0);
+	out.write(reinterpret_cast<const char*>(padded.data()), padded.size());
+	if (!out)
+	{
+		throw std::runtime_error("Unable to write motion recording " + path);
+	}
+}
+
+void MotionRecorder::append( const int16_t* positions )
+{
+	out.write(reinterpret_cast<const char*>(positions), servoCount*sizeof(int16_t));
+	if (!out)
+	{
+		throw std::runtime_error("Unable to write motion recording " + path);
+	}
+	++frames;
+}
+
+uint64_t MotionRecorder::frameCount() const
+{
+	return frames;
+}
+
+void MotionRecorder::close()
+{
+	out.close();
+	if (!out)
+	{
+		throw std::runtime_error("Unable to write motion recording " + path);
+	}
+}
+
+MotionRecording MotionRecording::load( const std::string& path )
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd<0)
+	{
+		throw std::runtime_error("Unable to open motion recording " + path);
+	}
+	struct stat info;
+	if (0!=fstat(fd, &info) || static_cast<size_t>(info.st_size)<sizeof(MotionFile::Header))
+	{
+		::close(fd);
+		throw std::runtime_error("Invalid motion recording " + path);
+	}
+
+	void* addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (MAP_FAILED==addr)
+	{
+		throw std::runtime_error("Unable to map motion recording " + path);
+	}
+	madvise(addr, info.st_size, MADV_SEQUENTIAL);
+
+	MotionRecording result;
+	result.mapped = addr;
+	result.mappedSize = info.st_size;
+	result.image = static_cast<const uint8_t*>(addr);
+
+	const auto& head = result.header();
+	if (0!=std::memcmp(head.magic, MotionFile::Magic, sizeof(MotionFile::Magic)) ||
+	    0==head.servoCount || 0==head.periodUs ||
+	    MotionFile::framesOffset(head.servoCount)>result.mappedSize)
+	{
+		throw std::runtime_error("Invalid or incompatible motion recording " + path);
+	}
+	return result;
+}
+
+MotionRecording::MotionRecording( MotionRecording&& other ) noexcept
+{
+	*this = std::move(other);
+}
+
+MotionRecording& MotionRecording::operator=( MotionRecording&& other ) noexcept
+{
+	if (this!=&other)
+	{
+		if (mapped) munmap(mapped, mappedSize);
+		mapped = other.mapped;
+		mappedSize = other.mappedSize;
+		image = other.image;
+		other.mapped = nullptr;
+		other.mappedSize = 0;
+		other.image = nullptr;
+	}
+	return *this;
+}
+
+MotionRecording::~MotionRecording()
+{
+	if (mapped) munmap(mapped, mappedSize);
+}
+
+const MotionFile::Header& MotionRecording::header() const
+{
+	return *reinterpret_cast<const MotionFile::Header*>(image);
+}
+
+uint32_t MotionRecording::periodUs() const
+{
+	return header().periodUs;
+}
+
+size_t MotionRecording::servoCount() const
+{
+	return header().servoCount;
+}
+
+const uint8_t* MotionRecording::ids() const
+{
+	return image+sizeof(MotionFile::Header);
+}
+
+uint64_t MotionRecording::frameCount() const
+{
+	return (mappedSize-MotionFile::framesOffset(servoCount()))/(servoCount()*sizeof(int16_t));
+}
+
+const int16_t* MotionRecording::frame( uint64_t index ) const
+{
+	return reinterpret_cast<const int16_t*>(image+MotionFile::framesOffset(servoCount()))+index*servoCount();
+}
+
+void MotionRecording::release( uint64_t index, size_t& released ) const
+{
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t played = reinterpret_cast<const uint8_t*>(frame(index))-image;
+	if (played-released<ReleaseBytes) return;
+
+	const size_t end = played/page*page;
+	madvise(static_cast<uint8_t*>(mapped)+released, end-released, MADV_DONTNEED);
+	released = end;
+}
+
+ControlLoop::Stats MotionRecording::play( BusGroup& group, ControlLoop::Config loopConfig ) const
+{
+	const uint64_t frames = frameCount();
+	if (0==frames) return ControlLoop::Stats();
+
+	loopConfig.periodNs = static_cast<int64_t>(periodUs())*1000;
+	ControlLoop loop(loopConfig);
+	const uint16_t timeMs = static_cast<uint16_t>(std::min<uint32_t>(periodUs()/1000, 0xFFFF));
+
+	size_t released = 0;
+	int64_t beginNs = 0;
+	loop.run([&](uint64_t cycle)
+	{
+		// From the schedule, not the clock: wakeup latency does not repeat or
+		//     skip frames, and skipped wakeups skip their frames
+		if (0==cycle) beginNs = loop.wakeupTimeNs();
+		const uint64_t elapsedUs = static_cast<uint64_t>(loop.wakeupTimeNs()-beginNs)/1000;
+		// Nearest frame (wakeups restarted after an overrun are off the period grid)
+		const uint64_t index = std::min<uint64_t>((elapsedUs+periodUs()/2)/periodUs(), frames-1);
+		group.moveTimeWrite(ids(), frame(index), servoCount(), timeMs);
+		release(index, released);
+		return index+1<frames;
+	});
+	return loop.stats();
+}
+
+}
+#endif //HIWONDER_RPI_RECORDING
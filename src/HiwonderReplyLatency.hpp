@@ -0,0 +1,249 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_REPLY_LATENCY
+#define HIWONDER_RPI_REPLY_LATENCY
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace HiwonderRpi
+{
+
+/// Learn online the reply latency of each servo, to wait for replies only as
+///     long as needed, and to detect servos that stopped answering.
+/// The latency is the servo turnaround: the time from the end of the request
+///     on the wire to the start of the reply, so that commands with different
+///     frame sizes share the same statistics. It is tracked with an EWMA of
+///     mean and variance, and the timeout is set at a percentile of it (normal
+///     approximation) plus a margin, on top of the wire time of the frames.
+/// Servos not answering <degradeAfter> times in a row are degraded: their reads
+///     are only sent once every <degradedInterval> requests, until they answer.
+/// Used by HiwonderBus (see HiwonderBus::getReplyLatency), disabled by default.
+class ReplyLatency
+{
+public:
+	struct Config
+	{
+		bool enabled = false;
+		/// Weight of a new sample in the averages, in (0,1]
+		float alpha = 0.05f;
+		/// Percentile of the turnaround distribution covered by the timeout, in (50,100)
+		float percentile = 99.5f;
+		/// Added to the timeout (scheduling jitter, UART FIFO delays...)
+		uint32_t marginUs = 300;
+		/// Bounds of the timeout (the upper bound is the bus reply timeout)
+		uint32_t minTimeoutUs = 500;
+		/// Samples needed before the learnt timeout is used
+		uint16_t minSamples = 8;
+		/// Consecutive failed reads to degrade a servo, 0 to never degrade
+		uint8_t degradeAfter = 3;
+		/// A degraded servo is requested once every this number of reads
+		uint16_t degradedInterval = 10;
+	};
+
+	/// Statistics of one servo
+	struct Servo
+	{
+		float meanUs = 0.f;       /// Mean turnaround
+		float varianceUs2 = 0.f;  /// Variance of the turnaround
+		uint32_t samples = 0;
+		uint8_t failures = 0;     /// Consecutive failed reads
+		bool degraded = false;
+		uint16_t skipped = 0;     /// Reads skipped since the last one sent (degraded)
+	};
+
+	ReplyLatency();
+	ReplyLatency( const Config& config );
+
+	void setConfig( const Config& config );
+	const Config& getConfig() const;
+
+	/// Return the timeout of a reply of a servo
+	/// @arg wireUs: time to transmit the request and the reply
+	/// @arg maxTimeoutUs: timeout when nothing is learnt yet, and upper bound
+	uint32_t timeoutUs( uint8_t id, uint32_t wireUs, uint32_t maxTimeoutUs ) const;
+
+	/// Return the turnaround of a servo at the configured percentile, or
+	///     <fallbackUs> if not enough is learnt (or disabled)
+	uint32_t turnaroundUs( uint8_t id, uint32_t fallbackUs ) const;
+
+	/// Return true if the read should be skipped (the servo is degraded);
+	///     counts it as skipped
+	bool skip( uint8_t id );
+
+	/// Save a successful reply with its turnaround (ignored if disabled)
+	void success( uint8_t id, uint32_t turnaroundUs );
+
+	/// Save a failed read (no reply, ignored if disabled)
+	void failure( uint8_t id );
+
+	/// Statistics of a servo
+	const Servo& servo( uint8_t id ) const;
+
+	/// Forget the statistics of a servo, or of all servos with id=254
+	void reset( uint8_t id=254 );
+
+private:
+	/// Return the standard normal quantile for a probability in (0,1)
+	inline static float normalQuantile( float p );
+
+	Config config;
+	float quantile;   // Number of standard deviations of config.percentile
+	std::array<Servo, 256> servos{};
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+ReplyLatency::ReplyLatency(): ReplyLatency(Config())
+{
+}
+
+ReplyLatency::ReplyLatency( const Config& config )
+{
+	setConfig(config);
+}
+
+float ReplyLatency::normalQuantile( float p )
+{
+	// Abramowitz and Stegun 26.2.23, |error| < 4.5e-4
+	const bool upper = p>0.5f;
+	const float q = upper ? 1.f-p : p;
+	const float t = std::sqrt(-2.f*std::log(q));
+	const float z = t - (2.515517f + 0.802853f*t + 0.010328f*t*t)/
+	    (1.f + 1.432788f*t + 0.189269f*t*t + 0.001308f*t*t*t);
+	return upper ? z : -z;
+}
+
+void ReplyLatency::setConfig( const Config& config )
+{
+	if (config.percentile<=50.f || config.percentile>=100.f || config.alpha<=0.f || config.alpha>1.f)
+	{
+		throw std::runtime_error("Invalid reply latency configuration");
+	}
+	this->config = config;
+	quantile = normalQuantile(config.percentile/100.f);
+}
+
+const ReplyLatency::Config& ReplyLatency::getConfig() const
+{
+	return config;
+}
+
+uint32_t ReplyLatency::timeoutUs( uint8_t id, uint32_t wireUs, uint32_t maxTimeoutUs ) const
+{
+	const Servo& s = servos[id];
+	if (!config.enabled || s.samples<config.minSamples)
+	{
+		return maxTimeoutUs;
+	}
+	const uint32_t timeout = wireUs + turnaroundUs(id, 0) + config.marginUs;
+	return std::min(std::max(timeout, config.minTimeoutUs), maxTimeoutUs);
+}
+
+uint32_t ReplyLatency::turnaroundUs( uint8_t id, uint32_t fallbackUs ) const
+{
+	const Servo& s = servos[id];
+	if (!config.enabled || s.samples<config.minSamples)
+	{
+		return fallbackUs;
+	}
+	const float learnt = s.meanUs + quantile*std::sqrt(s.varianceUs2);
+	return static_cast<uint32_t>(std::max(learnt, 0.f));
+}
+
+bool ReplyLatency::skip( uint8_t id )
+{
+	Servo& s = servos[id];
+	if (!config.enabled || !s.degraded)
+	{
+		return false;
+	}
+	if (++s.skipped>=config.degradedInterval)
+	{
+		s.skipped = 0;
+		return false;
+	}
+	return true;
+}
+
+void ReplyLatency::success( uint8_t id, uint32_t turnaroundUs )
+{
+	if (!config.enabled)
+	{
+		return;
+	}
+	Servo& s = servos[id];
+	s.failures = 0;
+	s.degraded = false;
+	s.skipped = 0;
+
+	const float sample = static_cast<float>(turnaroundUs);
+	if (0==s.samples++)
+	{
+		s.meanUs = sample;
+		s.varianceUs2 = 0.f;
+		return;
+	}
+	// Exponentially weighted mean and variance (West, 1979)
+	const float diff = sample-s.meanUs;
+	const float increment = config.alpha*diff;
+	s.meanUs += increment;
+	s.varianceUs2 = (1.f-config.alpha)*(s.varianceUs2 + diff*increment);
+}
+
+void ReplyLatency::failure( uint8_t id )
+{
+	if (!config.enabled)
+	{
+		return;
+	}
+	Servo& s = servos[id];
+	if (s.failures<255) s.failures++;
+	if (config.degradeAfter>0 && s.failures>=config.degradeAfter)
+	{
+		s.degraded = true;
+	}
+}
+
+const ReplyLatency::Servo& ReplyLatency::servo( uint8_t id ) const
+{
+	return servos[id];
+}
+
+void ReplyLatency::reset( uint8_t id )
+{
+	if (254==id)
+	{
+		servos.fill(Servo());
+		return;
+	}
+	servos[id] = Servo();
+}
+
+}
+#endif //HIWONDER_RPI_REPLY_LATENCY
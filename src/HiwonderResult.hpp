@@ -0,0 +1,151 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_RESULT
+#define HIWONDER_RPI_RESULT
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace HiwonderRpi
+{
+
+/// Errors of a bus transaction
+enum class Error: uint8_t
+{
+	None = 0,
+	Timeout = 1,       /// The reply did not arrive in time (no servo, or bus too busy)
+	Checksum = 2,      /// The reply is corrupted
+	Length = 3,        /// The reply size is not the expected one (or not a valid frame)
+	WrongCommand = 4,  /// The reply is for another command
+	WrongId = 5,       /// The reply comes from another servo
+	Budget = 6,        /// The cycle time budget is exhausted, the request was not sent
+	Degraded = 7       /// The servo stopped answering, the request was not sent (see ReplyLatency)
+};
+
+/// Return a human readable description of an error
+inline const char* errorMessage( Error error );
+
+/// Value or error of a bus transaction, used by the non-throwing API
+///     (the overloads taking std::nothrow). It never allocates.
+/// T must be default-constructible.
+template <typename T>
+class Result
+{
+public:
+	Result( const T& value );
+	Result( Error error );
+
+	/// Return true if the transaction succeeded
+	bool ok() const;
+	explicit operator bool() const;
+
+	/// Return the error, Error::None on success
+	Error error() const;
+
+	/// Return the value
+	/// @throw runtime_error if the transaction failed
+	const T& value() const;
+
+	/// Return the value, or <fallback> if the transaction failed
+	T valueOr( const T& fallback ) const;
+
+	/// Return the value, without check
+	const T& operator*() const;
+
+private:
+	T val{};
+	Error err;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+const char* errorMessage( Error error )
+{
+	switch (error)
+	{
+		case Error::None: return "No error";
+		case Error::Timeout: return "Unable to retrieve message from servo (timeout)";
+		case Error::Checksum: return "Corrupted message received (checksum)";
+		case Error::Length: return "Corrupted message received (length)";
+		case Error::WrongCommand: return "Unexpected message received (command)";
+		case Error::WrongId: return "Unexpected message received (servo id)";
+		case Error::Budget: return "Bus time budget of the cycle exhausted";
+		case Error::Degraded: return "Servo degraded (not answering), request skipped";
+	}
+	return "Unknown error";
+}
+
+template <typename T>
+Result<T>::Result( const T& value ): val(value), err(Error::None)
+{
+}
+
+template <typename T>
+Result<T>::Result( Error error ): err(error)
+{
+}
+
+template <typename T>
+bool Result<T>::ok() const
+{
+	return Error::None==err;
+}
+
+template <typename T>
+Result<T>::operator bool() const
+{
+	return ok();
+}
+
+template <typename T>
+Error Result<T>::error() const
+{
+	return err;
+}
+
+template <typename T>
+const T& Result<T>::value() const
+{
+	if (!ok())
+	{
+		throw std::runtime_error(errorMessage(err));
+	}
+	return val;
+}
+
+template <typename T>
+T Result<T>::valueOr( const T& fallback ) const
+{
+	return ok() ? val : fallback;
+}
+
+template <typename T>
+const T& Result<T>::operator*() const
+{
+	return val;
+}
+
+}
+#endif //HIWONDER_RPI_RESULT
@@ -0,0 +1,501 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_ROBOT_DESCRIPTION
+#define HIWONDER_RPI_ROBOT_DESCRIPTION
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace HiwonderRpi
+{
+
+/// Description of a robot: joints (servo id, bus, limits, offset, direction,
+///     default pose) and buses.
+///
+/// Text format, one entry per line, '#' starts a comment:
+///     bus <index> <device> <baud>
+///     joint <name> <id> <bus> <minLimit> <maxLimit> <offset> <direction> <default>
+/// Without bus lines, bus 0 is /dev/ttyAMA0 at 115200.
+///
+/// Whatever the source, the description is held as one flat binary image:
+///     a header, the joint table, the bus table, a name hash table and the
+///     strings. This image is also the precompiled file format (saveBinary),
+///     which loadBinary memory-maps as is: no parsing, no allocation per joint.
+/// Joints are addressed by Handle (their index): find() resolves a name in
+///     O(1) once at setup, the hot path never does string lookups.
+class RobotDescription
+{
+public:
+	using Handle = uint16_t;
+	constexpr static Handle InvalidHandle = 0xFFFF;
+
+	/// One joint, 16 bytes
+	struct Joint
+	{
+		uint8_t id;
+		uint8_t bus;
+		int8_t direction;          /// 1 or -1 if the servo is mounted reversed
+		uint8_t reserved;
+		int16_t minLimit;          /// servo units
+		int16_t maxLimit;
+		int16_t offset;
+		int16_t defaultPosition;
+		uint32_t nameOffset;       /// in the string table
+	};
+
+	struct Bus
+	{
+		uint32_t baud;
+		uint32_t deviceOffset;     /// in the string table
+	};
+
+	/// Parse a description in text format
+	/// @throw runtime_error with the line number on syntax or validation error
+	static RobotDescription fromText( std::istream& in );
+
+	/// Parse a description file in text format
+	static RobotDescription loadText( const std::string& path );
+
+	/// Memory-map a precompiled description
+	/// @throw runtime_error if the file can not be mapped or is not valid
+	static RobotDescription loadBinary( const std::string& path );
+
+	/// Write the precompiled form of the description
+	void saveBinary( const std::string& path ) const;
+
+	RobotDescription( RobotDescription&& other ) noexcept;
+	RobotDescription& operator=( RobotDescription&& other ) noexcept;
+	RobotDescription( const RobotDescription& ) = delete;
+	RobotDescription& operator=( const RobotDescription& ) = delete;
+	~RobotDescription();
+
+	/// Number of joints
+	size_t jointCount() const;
+
+	/// Joint table, [jointCount()]
+	const Joint* joints() const;
+
+	/// Return a joint (no bound check)
+	const Joint& joint( Handle handle ) const;
+
+	/// Return the name of a joint
+	const char* name( Handle handle ) const;
+
+	/// Return the handle of a joint by name, or InvalidHandle
+	Handle find( const char* name ) const;
+
+	/// Number of buses
+	size_t busCount() const;
+
+	/// Return a bus (no bound check)
+	const Bus& bus( size_t index ) const;
+
+	/// Return the device of a bus
+	const char* device( size_t index ) const;
+
+private:
+	constexpr static char Magic[8] = {'H','W','R','O','B','O','T','1'};
+
+	/// Start of the image, all offsets are from here
+	struct Header
+	{
+		char magic[8];
+		uint32_t size;           /// Total size of the image in bytes
+		uint32_t jointCount;
+		uint32_t busCount;
+		uint32_t hashSize;       /// Power of 2
+		uint32_t jointsOffset;
+		uint32_t busesOffset;
+		uint32_t hashOffset;     /// Table of Handle, InvalidHandle for empty slots
+		uint32_t stringsOffset;
+	};
+
+	RobotDescription() = default;
+
+	/// Hash of a name (FNV-1a)
+	inline static uint32_t hash( const char* name );
+
+	/// Build the image from parsed tables
+	inline static RobotDescription build( const std::vector<Joint>& joints, const std::vector<std::string>& names,
+	    const std::vector<Bus>& buses, const std::vector<std::string>& devices );
+
+	/// Check the consistency of the image: tables inside the image, strings
+	///     inside the string table, and handles and bus indices in range
+	inline void validate() const;
+
+	inline const Header& header() const;
+
+	std::vector<uint8_t> owned;    // Image built in memory
+	void* mapped = nullptr;        // or memory-mapped image
+	size_t mappedSize = 0;
+	const uint8_t* image = nullptr;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+uint32_t RobotDescription::hash( const char* name )
+{
+	uint32_t h = 2166136261u;
+	for (; *name; ++name)
+	{
+		h = (h ^ static_cast<uint8_t>(*name))*16777619u;
+	}
+	return h;
+}
+
+const RobotDescription::Header& RobotDescription::header() const
+{
+	return *reinterpret_cast<const Header*>(image);
+}
+
+RobotDescription RobotDescription::build( const std::vector<Joint>& jointsIn, const std::vector<std::string>& names,
+    const std::vector<Bus>& busesIn, const std::vector<std::string>& devices )
+{
+	auto align = [](size_t v){ return (v+7)&~static_cast<size_t>(7); };
+
+	uint32_t hashSize = 1;
+	while (hashSize<2*jointsIn.size()) hashSize<<=1;
+
+	Header head{};
+	std::memcpy(head.magic, Magic, sizeof(Magic));
+	head.jointCount = static_cast<uint32_t>(jointsIn.size());
+	head.busCount = static_cast<uint32_t>(busesIn.size());
+	head.hashSize = hashSize;
+	head.jointsOffset = static_cast<uint32_t>(align(sizeof(Header)));
+	head.busesOffset = static_cast<uint32_t>(align(head.jointsOffset+jointsIn.size()*sizeof(Joint)));
+	head.hashOffset = static_cast<uint32_t>(align(head.busesOffset+busesIn.size()*sizeof(Bus)));
+	head.stringsOffset = static_cast<uint32_t>(align(head.hashOffset+hashSize*sizeof(Handle)));
+
+	// String table
+	std::vector<char> strings;
+	std::vector<Joint> joints = jointsIn;
+	std::vector<Bus> buses = busesIn;
+	for (size_t i=0; i<joints.size(); ++i)
+	{
+		joints[i].nameOffset = static_cast<uint32_t>(strings.size());
+		strings.insert(strings.end(), names[i].c_str(), names[i].c_str()+names[i].size()+1);
+	}
+	for (size_t i=0; i<buses.size(); ++i)
+	{
+		buses[i].deviceOffset = static_cast<uint32_t>(strings.size());
+		strings.insert(strings.end(), devices[i].c_str(), devices[i].c_str()+devices[i].size()+1);
+	}
+	head.size = static_cast<uint32_t>(head.stringsOffset+strings.size());
+
+	// Open addressing with linear probing
+	std::vector<Handle> table(hashSize, InvalidHandle);
+	for (size_t i=0; i<joints.size(); ++i)
+	{
+		uint32_t slot = hash(names[i].c_str())&(hashSize-1);
+		while (InvalidHandle!=table[slot]) slot = (slot+1)&(hashSize-1);
+		table[slot] = static_cast<Handle>(i);
+	}
+
+	RobotDescription result;
+	result.owned.assign(head.size, 0);
+	uint8_t* out = result.owned.data();
+	std::memcpy(out, &head, sizeof(head));
+	if (!joints.empty()) std::memcpy(out+head.jointsOffset, joints.data(), joints.size()*sizeof(Joint));
+	if (!buses.empty()) std::memcpy(out+head.busesOffset, buses.data(), buses.size()*sizeof(Bus));
+	std::memcpy(out+head.hashOffset, table.data(), table.size()*sizeof(Handle));
+	if (!strings.empty()) std::memcpy(out+head.stringsOffset, strings.data(), strings.size());
+	result.image = out;
+	return result;
+}
+
+RobotDescription RobotDescription::fromText( std::istream& in )
+{
+	std::vector<Joint> joints;
+	std::vector<std::string> names;
+	std::vector<Bus> buses;
+	std::vector<std::string> devices;
+
+	auto fail = [](size_t line, const std::string& msg)
+	{
+		throw std::runtime_error("Robot description, line " + std::to_string(line) + ": " + msg);
+	};
+
+	std::string text;
+	for (size_t line=1; std::getline(in, text); ++line)
+	{
+		text = text.substr(0, text.find('#'));
+		std::istringstream fields(text);
+		std::string kind;
+		if (!(fields >> kind)) continue; // empty line
+
+		if ("bus"==kind)
+		{
+			size_t index;
+			std::string device;
+			uint32_t baud;
+			if (!(fields >> index >> device >> baud)) fail(line, "expected: bus <index> <device> <baud>");
+			if (index!=buses.size()) fail(line, "bus indices must be consecutive from 0");
+			buses.push_back(Bus{baud, 0});
+			devices.push_back(device);
+		}
+		else if ("joint"==kind)
+		{
+			std::string name;
+			int id, bus, minLimit, maxLimit, offset, direction, defaultPosition;
+			if (!(fields >> name >> id >> bus >> minLimit >> maxLimit >> offset >> direction >> defaultPosition))
+			{
+				fail(line, "expected: joint <name> <id> <bus> <minLimit> <maxLimit> <offset> <direction> <default>");
+			}
+			if (id<0 || id>253) fail(line, "servo id must be in [0,253]");
+			if (bus<0 || bus>=254) fail(line, "invalid bus index");
+			if (minLimit<0 || maxLimit>1000 || minLimit>=maxLimit) fail(line, "limits must be in [0,1000] with min<max");
+			if (offset<-125 || offset>125) fail(line, "offset must be in [-125,125]");
+			if (1!=direction && -1!=direction) fail(line, "direction must be 1 or -1");
+			if (defaultPosition<minLimit || defaultPosition>maxLimit) fail(line, "default position must be within limits");
+			for (const auto& other: names)
+			{
+				if (other==name) fail(line, "duplicated joint name " + name);
+			}
+			for (const auto& other: joints)
+			{
+				if (other.id==id && other.bus==bus) fail(line, "servo id " + std::to_string(id) + " already used on this bus");
+			}
+			if (joints.size()>=InvalidHandle) fail(line, "too many joints");
+
+			Joint joint{};
+			joint.id = static_cast<uint8_t>(id);
+			joint.bus = static_cast<uint8_t>(bus);
+			joint.direction = static_cast<int8_t>(direction);
+			joint.minLimit = static_cast<int16_t>(minLimit);
+			joint.maxLimit = static_cast<int16_t>(maxLimit);
+			joint.offset = static_cast<int16_t>(offset);
+			joint.defaultPosition = static_cast<int16_t>(defaultPosition);
+			joints.push_back(joint);
+			names.push_back(name);
+		}
+		else
+		{
+			fail(line, "unknown entry " + kind);
+		}
+	}
+
+	if (buses.empty())
+	{
+		buses.push_back(Bus{115200, 0});
+		devices.push_back("/dev/ttyAMA0");
+	}
+	for (const auto& joint: joints)
+	{
+		if (joint.bus>=buses.size())
+		{
+			throw std::runtime_error("Robot description: joint on an undeclared bus");
+		}
+	}
+
+	return build(joints, names, buses, devices);
+}
+
+RobotDescription RobotDescription::loadText( const std::string& path )
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		throw std::runtime_error("Unable to open robot description " + path);
+	}
+	return fromText(in);
+}
+
+RobotDescription RobotDescription::loadBinary( const std::string& path )
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd<0)
+	{
+		throw std::runtime_error("Unable to open robot description " + path);
+	}
+	struct stat info;
+	if (0!=fstat(fd, &info) || static_cast<size_t>(info.st_size)<sizeof(Header))
+	{
+		::close(fd);
+		throw std::runtime_error("Invalid robot description " + path);
+	}
+
+	void* addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (MAP_FAILED==addr)
+	{
+		throw std::runtime_error("Unable to map robot description " + path);
+	}
+
+	RobotDescription result;
+	result.mapped = addr;
+	result.mappedSize = info.st_size;
+	result.image = static_cast<const uint8_t*>(addr);
+	result.validate();
+	return result;
+}
+
+void RobotDescription::validate() const
+{
+	const Header& head = header();
+	const size_t size = owned.empty() ? mappedSize : owned.size();
+	const bool valid = 0==std::memcmp(head.magic, Magic, sizeof(Magic)) &&
+	    head.size<=size &&
+	    head.hashSize>0 && 0==(head.hashSize&(head.hashSize-1)) &&
+	    head.jointsOffset+static_cast<size_t>(head.jointCount)*sizeof(Joint)<=head.size &&
+	    head.busesOffset+static_cast<size_t>(head.busCount)*sizeof(Bus)<=head.size &&
+	    head.hashOffset+static_cast<size_t>(head.hashSize)*sizeof(Handle)<=head.size &&
+	    head.stringsOffset<head.size && '\0'==image[head.size-1] &&
+	    head.jointCount<InvalidHandle;
+	if (!valid)
+	{
+		throw std::runtime_error("Invalid or incompatible robot description");
+	}
+
+	// The image ends with a NUL: a string starting in the table ends in it
+	const size_t stringsSize = head.size-head.stringsOffset;
+	for (size_t i=0; i<head.jointCount; ++i)
+	{
+		if (joints()[i].nameOffset>=stringsSize || joints()[i].bus>=head.busCount)
+		{
+			throw std::runtime_error("Invalid robot description: joint out of bounds");
+		}
+	}
+	for (size_t i=0; i<head.busCount; ++i)
+	{
+		if (bus(i).deviceOffset>=stringsSize)
+		{
+			throw std::runtime_error("Invalid robot description: bus out of bounds");
+		}
+	}
+	const Handle* table = reinterpret_cast<const Handle*>(image+head.hashOffset);
+	for (size_t i=0; i<head.hashSize; ++i)
+	{
+		if (InvalidHandle!=table[i] && table[i]>=head.jointCount)
+		{
+			throw std::runtime_error("Invalid robot description: name table out of bounds");
+		}
+	}
+}
+
+void RobotDescription::saveBinary( const std::string& path ) const
+{
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(image), header().size);
+	if (!out)
+	{
+		throw std::runtime_error("Unable to write robot description " + path);
+	}
+}
+
+RobotDescription::RobotDescription( RobotDescription&& other ) noexcept
+{
+	*this = std::move(other);
+}
+
+RobotDescription& RobotDescription::operator=( RobotDescription&& other ) noexcept
+{
+	if (this!=&other)
+	{
+		if (mapped) munmap(mapped, mappedSize);
+		owned = std::move(other.owned);
+		mapped = other.mapped;
+		mappedSize = other.mappedSize;
+		image = mapped ? other.image : owned.data();
+		other.mapped = nullptr;
+		other.mappedSize = 0;
+		other.image = nullptr;
+	}
+	return *this;
+}
+
+RobotDescription::~RobotDescription()
+{
+	if (mapped) munmap(mapped, mappedSize);
+}
+
+size_t RobotDescription::jointCount() const
+{
+	return header().jointCount;
+}
+
+const RobotDescription::Joint* RobotDescription::joints() const
+{
+	return reinterpret_cast<const Joint*>(image+header().jointsOffset);
+}
+
+const RobotDescription::Joint& RobotDescription::joint( Handle handle ) const
+{
+	return joints()[handle];
+}
+
+const char* RobotDescription::name( Handle handle ) const
+{
+	return reinterpret_cast<const char*>(image+header().stringsOffset+joint(handle).nameOffset);
+}
+
+RobotDescription::Handle RobotDescription::find( const char* name ) const
+{
+	const Header& head = header();
+	const Handle* table = reinterpret_cast<const Handle*>(image+head.hashOffset);
+	const uint32_t mask = head.hashSize-1;
+
+	for (uint32_t slot = hash(name)&mask, i=0; i<head.hashSize; slot=(slot+1)&mask, ++i)
+	{
+		const Handle handle = table[slot];
+		if (InvalidHandle==handle)
+		{
+			return InvalidHandle;
+		}
+		if (0==std::strcmp(this->name(handle), name))
+		{
+			return handle;
+		}
+	}
+	return InvalidHandle;
+}
+
+size_t RobotDescription::busCount() const
+{
+	return header().busCount;
+}
+
+const RobotDescription::Bus& RobotDescription::bus( size_t index ) const
+{
+	return reinterpret_cast<const Bus*>(image+header().busesOffset)[index];
+}
+
+const char* RobotDescription::device( size_t index ) const
+{
+	return reinterpret_cast<const char*>(image+header().stringsOffset+bus(index).deviceOffset);
+}
+
+}
+#endif //HIWONDER_RPI_ROBOT_DESCRIPTION
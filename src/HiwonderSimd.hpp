@@ -0,0 +1,226 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_SIMD
+#define HIWONDER_RPI_SIMD
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace HiwonderRpi
+{
+
+/// Minimal portable float vector, used to batch computations across limbs/servos.
+/// The backend is selected at compile time: AVX (8 lanes), SSE2 or NEON (4 lanes),
+///     or plain scalar code (1 lane) when none is available.
+/// Only the operations needed by this library are provided.
+namespace Simd
+{
+
+#if defined(__AVX__)
+
+struct Vec
+{
+	constexpr static size_t Lanes = 8;
+	__m256 v;
+};
+struct Mask { __m256 m; };
+
+inline Vec load( const float* p ) { return {_mm256_loadu_ps(p)}; }
+inline void store( float* p, Vec a ) { _mm256_storeu_ps(p, a.v); }
+inline Vec set( float f ) { return {_mm256_set1_ps(f)}; }
+inline Vec operator+( Vec a, Vec b ) { return {_mm256_add_ps(a.v, b.v)}; }
+inline Vec operator-( Vec a, Vec b ) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline Vec operator*( Vec a, Vec b ) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline Vec operator/( Vec a, Vec b ) { return {_mm256_div_ps(a.v, b.v)}; }
+inline Vec sqrt( Vec a ) { return {_mm256_sqrt_ps(a.v)}; }
+inline Vec min( Vec a, Vec b ) { return {_mm256_min_ps(a.v, b.v)}; }
+inline Vec max( Vec a, Vec b ) { return {_mm256_max_ps(a.v, b.v)}; }
+inline Vec abs( Vec a ) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+inline Mask operator<( Vec a, Vec b ) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline Vec select( Mask m, Vec a, Vec b ) { return {_mm256_blendv_ps(b.v, a.v, m.m)}; }
+
+#elif defined(__SSE2__)
+
+struct Vec
+{
+	constexpr static size_t Lanes = 4;
+	__m128 v;
+};
+struct Mask { __m128 m; };
+
+inline Vec load( const float* p ) { return {_mm_loadu_ps(p)}; }
+inline void store( float* p, Vec a ) { _mm_storeu_ps(p, a.v); }
+inline Vec set( float f ) { return {_mm_set1_ps(f)}; }
+inline Vec operator+( Vec a, Vec b ) { return {_mm_add_ps(a.v, b.v)}; }
+inline Vec operator-( Vec a, Vec b ) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Vec operator*( Vec a, Vec b ) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Vec operator/( Vec a, Vec b ) { return {_mm_div_ps(a.v, b.v)}; }
+inline Vec sqrt( Vec a ) { return {_mm_sqrt_ps(a.v)}; }
+inline Vec min( Vec a, Vec b ) { return {_mm_min_ps(a.v, b.v)}; }
+inline Vec max( Vec a, Vec b ) { return {_mm_max_ps(a.v, b.v)}; }
+inline Vec abs( Vec a ) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+inline Mask operator<( Vec a, Vec b ) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline Vec select( Mask m, Vec a, Vec b ) { return {_mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v))}; }
+
+#elif defined(__ARM_NEON)
+
+struct Vec
+{
+	constexpr static size_t Lanes = 4;
+	float32x4_t v;
+};
+struct Mask { uint32x4_t m; };
+
+inline Vec load( const float* p ) { return {vld1q_f32(p)}; }
+inline void store( float* p, Vec a ) { vst1q_f32(p, a.v); }
+inline Vec set( float f ) { return {vdupq_n_f32(f)}; }
+inline Vec operator+( Vec a, Vec b ) { return {vaddq_f32(a.v, b.v)}; }
+inline Vec operator-( Vec a, Vec b ) { return {vsubq_f32(a.v, b.v)}; }
+inline Vec operator*( Vec a, Vec b ) { return {vmulq_f32(a.v, b.v)}; }
+inline Vec min( Vec a, Vec b ) { return {vminq_f32(a.v, b.v)}; }
+inline Vec max( Vec a, Vec b ) { return {vmaxq_f32(a.v, b.v)}; }
+inline Vec abs( Vec a ) { return {vabsq_f32(a.v)}; }
+inline Mask operator<( Vec a, Vec b ) { return {vcltq_f32(a.v, b.v)}; }
+inline Vec select( Mask m, Vec a, Vec b ) { return {vbslq_f32(m.m, a.v, b.v)}; }
+#if defined(__aarch64__)
+inline Vec operator/( Vec a, Vec b ) { return {vdivq_f32(a.v, b.v)}; }
+inline Vec sqrt( Vec a ) { return {vsqrtq_f32(a.v)}; }
+#else
+// ARMv7 NEON has no division nor square root: estimate + 2 Newton-Raphson steps
+inline Vec operator/( Vec a, Vec b )
+{
+	float32x4_t r = vrecpeq_f32(b.v);
+	r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+	r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+	return {vmulq_f32(a.v, r)};
+}
+inline Vec sqrt( Vec a )
+{
+	float32x4_t e = vrsqrteq_f32(a.v);
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+	// sqrt(0) would be 0*inf
+	return {vbslq_f32(vcgtq_f32(a.v, vdupq_n_f32(0.0f)), vmulq_f32(a.v, e), vdupq_n_f32(0.0f))};
+}
+#endif
+
+#else
+
+struct Vec
+{
+	constexpr static size_t Lanes = 1;
+	float v;
+};
+struct Mask { bool m; };
+
+inline Vec load( const float* p ) { return {*p}; }
+inline void store( float* p, Vec a ) { *p = a.v; }
+inline Vec set( float f ) { return {f}; }
+inline Vec operator+( Vec a, Vec b ) { return {a.v+b.v}; }
+inline Vec operator-( Vec a, Vec b ) { return {a.v-b.v}; }
+inline Vec operator*( Vec a, Vec b ) { return {a.v*b.v}; }
+inline Vec operator/( Vec a, Vec b ) { return {a.v/b.v}; }
+inline Vec sqrt( Vec a ) { return {std::sqrt(a.v)}; }
+inline Vec min( Vec a, Vec b ) { return {a.v<b.v ? a.v : b.v}; }
+inline Vec max( Vec a, Vec b ) { return {a.v>b.v ? a.v : b.v}; }
+inline Vec abs( Vec a ) { return {std::fabs(a.v)}; }
+inline Mask operator<( Vec a, Vec b ) { return {a.v<b.v}; }
+inline Vec select( Mask m, Vec a, Vec b ) { return m.m ? a : b; }
+
+#endif
+
+constexpr float Pi = 3.14159265358979f;
+
+/// Clamp each lane to [lo,hi]
+inline Vec clamp( Vec a, Vec lo, Vec hi )
+{
+	return min(max(a, lo), hi);
+}
+
+/// Four-quadrant arctangent, max error about 1e-5 rad
+inline Vec atan2( Vec y, Vec x )
+{
+	const Vec zero = set(0.0f);
+	const Vec ax = abs(x);
+	const Vec ay = abs(y);
+	const Vec hi = max(ax, ay);
+	// a in [0,1]; for x==y==0, return 0
+	const Vec a = min(ax, ay)/select(hi<set(1e-30f), set(1.0f), hi);
+	const Vec r = a*a;
+
+	// Minimax polynomial of atan on [0,1]
+	Vec p = set(-0.01172120f);
+	p = p*r + set(0.05265332f);
+	p = p*r + set(-0.11643287f);
+	p = p*r + set(0.19354346f);
+	p = p*r + set(-0.33262347f);
+	p = p*r + set(0.99997726f);
+	p = p*a;
+
+	p = select(ax<ay, set(Pi/2)-p, p);
+	p = select(x<zero, set(Pi)-p, p);
+	return select(y<zero, zero-p, p);
+}
+
+/// Arccosine, input is clamped to [-1,1]
+inline Vec acos( Vec x )
+{
+	x = clamp(x, set(-1.0f), set(1.0f));
+	return atan2(sqrt(set(1.0f)-x*x), x);
+}
+
+/// Sine and cosine for angles in [-Pi,Pi], max error about 1e-6
+/// Computed on the half angle (Taylor series converge fast on [-Pi/2,Pi/2])
+///     then doubled.
+inline void sincos( Vec x, Vec& sin, Vec& cos )
+{
+	const Vec h = x*set(0.5f);
+	const Vec h2 = h*h;
+
+	Vec s = set(-1.0f/39916800.0f);
+	s = s*h2 + set(1.0f/362880.0f);
+	s = s*h2 + set(-1.0f/5040.0f);
+	s = s*h2 + set(1.0f/120.0f);
+	s = s*h2 + set(-1.0f/6.0f);
+	s = (s*h2 + set(1.0f))*h;
+
+	Vec c = set(-1.0f/3628800.0f);
+	c = c*h2 + set(1.0f/40320.0f);
+	c = c*h2 + set(-1.0f/720.0f);
+	c = c*h2 + set(1.0f/24.0f);
+	c = c*h2 + set(-0.5f);
+	c = c*h2 + set(1.0f);
+
+	sin = set(2.0f)*s*c;
+	cos = set(1.0f)-set(2.0f)*s*s;
+}
+
+}
+
+}
+#endif //HIWONDER_RPI_SIMD
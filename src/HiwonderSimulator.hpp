@@ -0,0 +1,479 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_SIMULATOR
+#define HIWONDER_RPI_SIMULATOR
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderTransport.hpp"
+
+namespace HiwonderRpi
+{
+
+/// In-memory bus with simulated servos, answering the protocol like the
+///     hardware does (replies are available as soon as the request is written).
+/// Used to run the library without hardware (tests, benchmarks, development
+///     on a PC). Moves are linear from the current position to the target.
+/// Faults can be injected in the replies at configurable rates (see Faults),
+///     from a seeded generator: a run with the same seed and the same requests
+///     gets the same faults.
+/// It does not allocate after construction.
+class SimulatedTransport: public HiwonderTransport
+{
+public:
+	/// State of one simulated servo, in protocol units
+	struct Servo
+	{
+		bool present = false;
+		int16_t startPosition = 500;   /// Position when the current move started
+		int16_t target = 500;
+		uint16_t moveTimeMs = 0;
+		std::chrono::steady_clock::time_point moveStart{};
+		int8_t angleOffset = 0;
+		int16_t angleMin = 0;
+		int16_t angleMax = 1000;
+		int16_t vinMin = 4500;
+		int16_t vinMax = 12000;
+		uint8_t tempMaxLimit = 85;
+		uint16_t vin = 7400;           /// mV
+		uint8_t temp = 30;             /// deg celsius
+		uint8_t mode = 0;
+		int16_t speed = 0;
+		uint8_t load = 1;
+		uint8_t powerLed = 0;
+		uint8_t ledError = 7;
+	};
+
+	/// Faults injected in the replies, each as a probability in [0,1]
+	struct Faults
+	{
+		float dropByte = 0.f;         /// Each byte of a reply is lost
+		float flipChecksum = 0.f;     /// The checksum of a reply is inverted
+		float garbage = 0.f;          /// 1 to 4 random bytes precede a reply
+		float delay = 0.f;            /// A reply arrives delayUs late
+		uint32_t delayUs = 0;
+		float duplicate = 0.f;        /// A reply is sent twice
+		float silent = 0.f;           /// A request gets no reply
+		uint64_t seed = 1;
+	};
+
+	struct Stats
+	{
+		uint64_t frames = 0;     /// Valid frames received
+		uint64_t corrupted = 0;  /// Frames dropped (bad size or checksum)
+		uint64_t replies = 0;    /// Replies sent
+		uint64_t faults = 0;     /// Faults injected
+	};
+
+	/// @arg baud: reported baud rate (the simulation has no wire delay)
+	SimulatedTransport( int baud=115200 );
+
+	/// Connect a servo with the given id (at its default state)
+	void addServo( uint8_t id );
+
+	/// Disconnect a servo
+	void removeServo( uint8_t id );
+
+	/// Access to the state of a servo
+	Servo& servo( uint8_t id );
+
+	/// Return the current position of a servo (following its move)
+	int16_t position( uint8_t id ) const;
+
+	/// Set the faults to inject (none by default), and restart their generator from the seed
+	void setFaults( const Faults& faults );
+	const Faults& getFaults() const;
+
+	const Stats& stats() const;
+
+	void write( const uint8_t* data, size_t size ) override;
+	int available() override;
+	int getByte() override;
+	void discardInput() override;
+	int baud() const override;
+
+private:
+	using Buffer = HiwonderBus::Buffer;
+
+	/// Size of the reply queue (must be a power of 2)
+	constexpr static size_t OutputSize = 4096;
+
+	/// Process one complete frame
+	inline void handleFrame( const Buffer& frame );
+
+	/// Apply a command to one servo, answering reads
+	inline void handleCommand( uint8_t id, const Buffer& frame );
+
+	/// Queue a reply with the given payload
+	inline void reply( uint8_t id, uint8_t command, const uint8_t* payload, uint8_t size );
+
+	/// Start a move of a servo to <target>
+	inline void startMove( Servo& s, int16_t target, uint16_t timeMs );
+
+	/// Append a byte to the replies
+	inline void push( uint8_t byte );
+
+	/// Next value of the fault generator (xorshift64*)
+	inline uint64_t random();
+
+	/// Return true with the given probability
+	inline bool chance( float probability );
+
+	std::array<Servo, HiwonderBus::BroadcastId> servos{};
+	int baudRate;
+	// Frame being received
+	Buffer frame{};
+	size_t received = 0;
+	// Replies not read yet (ring buffer)
+	std::array<uint8_t, OutputSize> output{};
+	size_t head = 0;
+	size_t tail = 0;
+	// Delayed reply: bytes from <delayedFrom> are not available before <delayedUntil>
+	bool delayed = false;
+	size_t delayedFrom = 0;
+	std::chrono::steady_clock::time_point delayedUntil;
+	Faults fault;
+	uint64_t rng = 1;
+	Stats stat;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+SimulatedTransport::SimulatedTransport( int baud ): baudRate(baud)
+{
+}
+
+void SimulatedTransport::addServo( uint8_t id )
+{
+	servos.at(id) = Servo();
+	servos[id].present = true;
+}
+
+void SimulatedTransport::removeServo( uint8_t id )
+{
+	servos.at(id).present = false;
+}
+
+SimulatedTransport::Servo& SimulatedTransport::servo( uint8_t id )
+{
+	return servos.at(id);
+}
+
+int16_t SimulatedTransport::position( uint8_t id ) const
+{
+	const Servo& s = servos.at(id);
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+	    std::chrono::steady_clock::now()-s.moveStart).count();
+	if (elapsed>=s.moveTimeMs)
+	{
+		return s.target;
+	}
+	return static_cast<int16_t>(s.startPosition + (s.target-s.startPosition)*elapsed/s.moveTimeMs);
+}
+
+void SimulatedTransport::setFaults( const Faults& faults )
+{
+	fault = faults;
+	rng = faults.seed ? faults.seed : 1;
+}
+
+const SimulatedTransport::Faults& SimulatedTransport::getFaults() const
+{
+	return fault;
+}
+
+uint64_t SimulatedTransport::random()
+{
+	rng ^= rng>>12;
+	rng ^= rng<<25;
+	rng ^= rng>>27;
+	return rng*2685821657736338717ull;
+}
+
+bool SimulatedTransport::chance( float probability )
+{
+	if (probability<=0.f) return false;
+	const bool hit = (random()>>11)*(1.0/9007199254740992.0)<probability;
+	if (hit) stat.faults++;
+	return hit;
+}
+
+const SimulatedTransport::Stats& SimulatedTransport::stats() const
+{
+	return stat;
+}
+
+void SimulatedTransport::write( const uint8_t* data, size_t size )
+{
+	for (size_t i=0; i<size; ++i)
+	{
+		const uint8_t byte = data[i];
+		// Resynchronize on the frame header
+		if (received<2 && HiwonderBus::FrameHeader!=byte)
+		{
+			received = 0;
+			continue;
+		}
+		frame[received++] = byte;
+
+		if (4==received && (frame[3]<3 || frame[3]+3u>frame.size()))
+		{
+			stat.corrupted++;
+			received = 0;
+			continue;
+		}
+		if (received>=4 && received==frame[3]+3u)
+		{
+			received = 0;
+			if (frame[frame[3]+2]!=HiwonderBus::checksum(frame))
+			{
+				stat.corrupted++;
+				continue;
+			}
+			stat.frames++;
+			handleFrame(frame);
+		}
+	}
+}
+
+int SimulatedTransport::available()
+{
+	if (delayed)
+	{
+		if (std::chrono::steady_clock::now()<delayedUntil)
+		{
+			return static_cast<int>(delayedFrom>head ? delayedFrom-head : 0);
+		}
+		delayed = false;
+	}
+	return static_cast<int>(tail-head);
+}
+
+int SimulatedTransport::getByte()
+{
+	if (available()<=0)
+	{
+		return -1;
+	}
+	return output[head++ & (OutputSize-1)];
+}
+
+void SimulatedTransport::discardInput()
+{
+	// Ends an expired delay; a delayed reply not arrived yet is kept
+	available();
+	head = delayed ? std::max(head, delayedFrom) : tail;
+}
+
+int SimulatedTransport::baud() const
+{
+	return baudRate;
+}
+
+void SimulatedTransport::handleFrame( const Buffer& frame )
+{
+	const uint8_t id = frame[2];
+	if (HiwonderBus::BroadcastId!=id)
+	{
+		if (id<servos.size() && servos[id].present) handleCommand(id, frame);
+		return;
+	}
+
+	// Broadcast: all servos apply writes; for reads, the bus carries only
+	//     one answer (on hardware, a single servo must be connected)
+	for (size_t i=0; i<servos.size(); ++i)
+	{
+		if (!servos[i].present) continue;
+		const uint64_t replies = stat.replies;
+		handleCommand(static_cast<uint8_t>(i), frame);
+		if (replies!=stat.replies) break;
+	}
+}
+
+void SimulatedTransport::startMove( Servo& s, int16_t target, uint16_t timeMs )
+{
+	const uint8_t id = static_cast<uint8_t>(&s-servos.data());
+	s.startPosition = position(id);
+	s.target = std::min(std::max(target, s.angleMin), s.angleMax);
+	s.moveTimeMs = timeMs;
+	s.moveStart = std::chrono::steady_clock::now();
+}
+
+void SimulatedTransport::push( uint8_t byte )
+{
+	output[tail++ & (OutputSize-1)] = byte;
+	// On overflow, the oldest bytes are lost (as a full UART FIFO would)
+	if (tail-head>OutputSize) head = tail-OutputSize;
+}
+
+void SimulatedTransport::reply( uint8_t id, uint8_t command, const uint8_t* payload, uint8_t size )
+{
+	if (chance(fault.silent)) return;
+
+	Buffer buf{HiwonderBus::FrameHeader, HiwonderBus::FrameHeader, id, static_cast<uint8_t>(size+3), command};
+	std::copy(payload, payload+size, buf.begin()+5);
+	buf[size+5] = HiwonderBus::checksum(buf);
+	if (chance(fault.flipChecksum)) buf[size+5] = static_cast<uint8_t>(~buf[size+5]);
+
+	if (!delayed && chance(fault.delay))
+	{
+		delayed = true;
+		delayedFrom = tail;
+		delayedUntil = std::chrono::steady_clock::now()+std::chrono::microseconds(fault.delayUs);
+	}
+	if (chance(fault.garbage))
+	{
+		for (uint64_t n=random()%4; n<4; ++n) push(static_cast<uint8_t>(random()));
+	}
+	for (int copy=chance(fault.duplicate) ? 2 : 1; copy>0; --copy)
+	{
+		for (size_t i=0; i<size+6u; ++i)
+		{
+			if (!chance(fault.dropByte)) push(buf[i]);
+		}
+	}
+	stat.replies++;
+}
+
+void SimulatedTransport::handleCommand( uint8_t id, const Buffer& f )
+{
+	Servo& s = servos[id];
+	auto u16 = [&f](size_t i){ return static_cast<int16_t>(f[i]+(f[i+1]<<8)); };
+	const uint8_t command = f[4];
+
+	switch (command)
+	{
+		case 1: // MOVE_TIME_WRITE
+			startMove(s, u16(5), static_cast<uint16_t>(u16(7)));
+			break;
+		case 2: // MOVE_TIME_READ
+		case 8: // MOVE_TIME_WAIT_READ
+		{
+			const uint8_t payload[] = {static_cast<uint8_t>(s.target), static_cast<uint8_t>(s.target>>8),
+			    static_cast<uint8_t>(s.moveTimeMs), static_cast<uint8_t>(s.moveTimeMs>>8)};
+			reply(id, command, payload, 4);
+			break;
+		}
+		case 12: // MOVE_STOP
+			startMove(s, position(id), 0);
+			break;
+		case 13: // ID_WRITE
+			if (f[5]<servos.size() && f[5]!=id)
+			{
+				servos[f[5]] = s;
+				s.present = false;
+			}
+			break;
+		case 14: // ID_READ
+			reply(id, command, &id, 1);
+			break;
+		case 17: // ANGLE_OFFSET_ADJUST
+			s.angleOffset = static_cast<int8_t>(f[5]);
+			break;
+		case 19: // ANGLE_OFFSET_READ
+		{
+			const uint8_t payload = static_cast<uint8_t>(s.angleOffset);
+			reply(id, command, &payload, 1);
+			break;
+		}
+		case 20: // ANGLE_LIMIT_WRITE
+			s.angleMin = u16(5);
+			s.angleMax = u16(7);
+			break;
+		case 21: // ANGLE_LIMIT_READ
+		case 23: // VIN_LIMIT_READ
+		{
+			const int16_t lo = 21==command ? s.angleMin : s.vinMin;
+			const int16_t hi = 21==command ? s.angleMax : s.vinMax;
+			const uint8_t payload[] = {static_cast<uint8_t>(lo), static_cast<uint8_t>(lo>>8),
+			    static_cast<uint8_t>(hi), static_cast<uint8_t>(hi>>8)};
+			reply(id, command, payload, 4);
+			break;
+		}
+		case 22: // VIN_LIMIT_WRITE
+			s.vinMin = u16(5);
+			s.vinMax = u16(7);
+			break;
+		case 24: // TEMP_MAX_LIMIT_WRITE
+			s.tempMaxLimit = f[5];
+			break;
+		case 25: // TEMP_MAX_LIMIT_READ
+			reply(id, command, &s.tempMaxLimit, 1);
+			break;
+		case 26: // TEMP_READ
+			reply(id, command, &s.temp, 1);
+			break;
+		case 27: // VIN_READ
+		{
+			const uint8_t payload[] = {static_cast<uint8_t>(s.vin), static_cast<uint8_t>(s.vin>>8)};
+			reply(id, command, payload, 2);
+			break;
+		}
+		case 28: // POS_READ
+		{
+			const int16_t pos = position(id);
+			const uint8_t payload[] = {static_cast<uint8_t>(pos), static_cast<uint8_t>(pos>>8)};
+			reply(id, command, payload, 2);
+			break;
+		}
+		case 29: // SERVO_OR_MOTOR_MODE_WRITE
+			s.mode = f[5];
+			s.speed = u16(7);
+			break;
+		case 30: // SERVO_OR_MOTOR_MODE_READ
+		{
+			const uint8_t payload[] = {s.mode, 0, static_cast<uint8_t>(s.speed), static_cast<uint8_t>(s.speed>>8)};
+			reply(id, command, payload, 4);
+			break;
+		}
+		case 31: // LOAD_OR_UNLOAD_WRITE
+			s.load = f[5];
+			break;
+		case 32: // LOAD_OR_UNLOAD_READ
+			reply(id, command, &s.load, 1);
+			break;
+		case 33: // LED_CTRL_WRITE
+			s.powerLed = f[5];
+			break;
+		case 34: // LED_CTRL_READ
+			reply(id, command, &s.powerLed, 1);
+			break;
+		case 35: // LED_ERROR_WRITE
+			s.ledError = f[5];
+			break;
+		case 36: // LED_ERROR_READ
+			reply(id, command, &s.ledError, 1);
+			break;
+		default: // Not simulated (angle offset save, wait moves...)
+			break;
+	}
+}
+
+}
+#endif //HIWONDER_RPI_SIMULATOR
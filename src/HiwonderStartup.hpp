@@ -0,0 +1,168 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_STARTUP
+#define HIWONDER_RPI_STARTUP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+#include "HiwonderBus.hpp"
+#include "HiwonderBusGroup.hpp"
+#include "HiwonderDiscovery.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Bring up a robot: open the bus(es) and check that all the configured
+///     servos answer, in a single pass with short probe timeouts.
+/// Servo and bus constructors do not access the hardware, so this is the only
+///     startup cost; the report gives its timing.
+class Startup
+{
+public:
+	struct Report
+	{
+		bool ok = false;               /// All the servos answered
+		uint32_t openUs = 0;           /// Time to open the device(s), wiringPi setup included
+		uint32_t validateUs = 0;       /// Time to probe all the servos
+		uint32_t totalUs = 0;          /// Total startup time
+		std::vector<uint8_t> missing;  /// Servos that did not answer
+	};
+
+	/// Open the bus and probe all the servos
+	/// @arg ids: servos expected on the bus
+	/// @arg marginUs: servo turnaround margin (see ServoDiscovery::probeTimeoutUs)
+	/// @throw runtime_error if the device can not be opened
+	static Report run( HiwonderBus& bus, const std::vector<uint8_t>& ids,
+	    uint32_t marginUs=ServoDiscovery::DefaultMarginUs );
+
+	/// Open all the buses of the group and probe the servos assigned to each
+	///     bus, all buses in parallel. Servos not assigned are reported missing.
+	static Report run( BusGroup& group, const std::vector<uint8_t>& ids,
+	    uint32_t marginUs=ServoDiscovery::DefaultMarginUs );
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/// Return the elapsed time since <start> in us
+	inline static uint32_t elapsedUs( Clock::time_point start );
+
+	/// Open a bus and probe the servos of <ids> for which <select> is true
+	template <typename Select>
+	inline static Report runBus( HiwonderBus& bus, const std::vector<uint8_t>& ids,
+	    uint32_t marginUs, Select select );
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+uint32_t Startup::elapsedUs( Clock::time_point start )
+{
+	return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-start).count());
+}
+
+template <typename Select>
+Startup::Report Startup::runBus( HiwonderBus& bus, const std::vector<uint8_t>& ids,
+    uint32_t marginUs, Select select )
+{
+	Report report;
+	const auto start = Clock::now();
+
+	bus.open();
+	report.openUs = elapsedUs(start);
+
+	const auto validateStart = Clock::now();
+	for (auto id: ids)
+	{
+		if (select(id) && !ServoDiscovery::probe(bus, id, marginUs))
+		{
+			report.missing.push_back(id);
+		}
+	}
+	report.validateUs = elapsedUs(validateStart);
+	report.totalUs = elapsedUs(start);
+	report.ok = report.missing.empty();
+	return report;
+}
+
+Startup::Report Startup::run( HiwonderBus& bus, const std::vector<uint8_t>& ids, uint32_t marginUs )
+{
+	return runBus(bus, ids, marginUs, [](uint8_t){ return true; });
+}
+
+Startup::Report Startup::run( BusGroup& group, const std::vector<uint8_t>& ids, uint32_t marginUs )
+{
+	const auto start = Clock::now();
+	Report report;
+
+	for (auto id: ids)
+	{
+		if (BusGroup::NoBus==group.busOf(id)) report.missing.push_back(id);
+	}
+
+	std::vector<Report> perBus(group.busCount());
+	std::vector<std::exception_ptr> errors(group.busCount());
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		group.getExecutor(b).post([&, b](HiwonderBus& bus)
+		{
+			try
+			{
+				perBus[b] = runBus(bus, ids, marginUs, [&group, b](uint8_t id){ return group.busOf(id)==b; });
+			}
+			catch(...)
+			{
+				errors[b] = std::current_exception();
+			}
+		});
+	}
+
+	// All the jobs must be done before leaving: they write to perBus and errors
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		group.getExecutor(b).wait();
+	}
+	for (size_t b=0; b<group.busCount(); ++b)
+	{
+		if (errors[b])
+		{
+			std::rethrow_exception(errors[b]);
+		}
+		// Buses run in parallel: the slowest one gives the time
+		report.openUs = std::max(report.openUs, perBus[b].openUs);
+		report.validateUs = std::max(report.validateUs, perBus[b].validateUs);
+		report.missing.insert(report.missing.end(), perBus[b].missing.begin(), perBus[b].missing.end());
+	}
+
+	std::sort(report.missing.begin(), report.missing.end());
+	report.totalUs = elapsedUs(start);
+	report.ok = report.missing.empty();
+	return report;
+}
+
+}
+#endif //HIWONDER_RPI_STARTUP
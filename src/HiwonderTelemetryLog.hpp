@@ -0,0 +1,642 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_TELEMETRY_LOG
+#define HIWONDER_RPI_TELEMETRY_LOG
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "HiwonderBusGroup.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Binary log of the telemetry of a set of servos (see ServoTelemetry).
+///
+/// File: a header and the servo ids, then blocks of up to keyframeInterval
+///     samples. Each block starts with a header (time range, sample count,
+///     payload size) and is self-contained: it is a keyframe, seeking to a time
+///     only reads block headers.
+/// Block payload, by column:
+///     - timestamps: delta of the delta to the previous one (0 at a fixed rate)
+///     - per servo: valid and loaded bitmaps, then the position, vin and temp
+///       columns as deltas to the previous sample (the first sample of the
+///       block is a delta to 0)
+/// Each column of deltas is a sequence of varints: a zigzag delta shifted
+///     left with bit 0 clear, or a run of zero deltas as (length<<1)|1.
+/// Telemetry changes slowly between samples: a position delta takes one byte,
+///     unchanged vin and temp take a couple of bytes per block, so a sample of
+///     a servo takes a little more than one byte instead of ~25 in CSV.
+struct TelemetryLogFormat
+{
+	constexpr static char Magic[8] = {'H','W','T','L','O','G','0','1'};
+	constexpr static uint32_t BlockSync = 0x4B4C4254; // "TBLK"
+
+	struct Header
+	{
+		char magic[8];
+		uint16_t servoCount;
+		uint16_t keyframeInterval;
+		uint32_t reserved;
+	};
+
+	struct BlockHeader
+	{
+		uint32_t sync;
+		uint32_t payloadBytes;
+		uint64_t firstUs;        /// Time of the first sample
+		uint64_t lastUs;         /// Time of the last sample
+		uint32_t samples;
+		uint32_t reserved;
+	};
+};
+
+/// Write a telemetry log from a control or bus thread.
+/// append() only copies the sample into a queue sized up-front: it never
+///     blocks, does not allocate and does not touch the file. A background
+///     thread encodes the queued samples and writes them block by block.
+///     If the queue is full (the storage stalls), samples are dropped and counted.
+class TelemetryLogWriter
+{
+public:
+	struct Config
+	{
+		/// Samples per block (a keyframe each)
+		uint16_t keyframeInterval = 256;
+		/// Samples the queue can hold before dropping
+		uint32_t queueSamples = 1024;
+		/// Sleep of the writer thread when the queue is empty, in ms
+		uint32_t idleMs = 10;
+	};
+
+	/// Create the log file and start the writer thread
+	/// @arg ids: logged servos, the order of the telemetry in each sample
+	/// @throw runtime_error if the file can not be created
+	TelemetryLogWriter( const std::string& path, const std::vector<uint8_t>& ids );
+	TelemetryLogWriter( const std::string& path, const std::vector<uint8_t>& ids, const Config& config );
+	TelemetryLogWriter( const TelemetryLogWriter& ) = delete;
+	TelemetryLogWriter& operator=( const TelemetryLogWriter& ) = delete;
+	~TelemetryLogWriter();
+
+	/// Queue a sample, one telemetry per servo (in the order of the ids).
+	/// To be called from a single thread.
+	/// @return false if the queue is full and the sample was dropped
+	bool append( uint64_t timestampUs, const ServoTelemetry* telemetry );
+
+	/// Write the queued samples, stop the writer thread and close the file
+	/// @throw runtime_error if a write failed
+	void close();
+
+	/// Number of samples dropped because the queue was full
+	uint64_t dropped() const;
+
+	/// Number of bytes written to the file so far
+	uint64_t bytes() const;
+
+private:
+	/// Writer thread: encode the queued samples until closed
+	inline void run();
+
+	/// Encode and write the pending block
+	inline void writeBlock();
+
+	std::FILE* file = nullptr;
+	const size_t servoCount;
+	const Config config;
+
+	// Queue, single producer (append) and single consumer (writer thread)
+	std::vector<uint64_t> queueTimes;
+	std::vector<ServoTelemetry> queueTelemetry;  // [queueSamples][servoCount]
+	std::atomic<uint64_t> head{0};
+	std::atomic<uint64_t> tail{0};
+	std::atomic<uint64_t> droppedSamples{0};
+
+	// Writer thread only
+	std::vector<uint64_t> blockTimes;
+	std::vector<ServoTelemetry> blockTelemetry;   // [keyframeInterval][servoCount]
+	std::vector<int64_t> deltas;
+	std::vector<uint8_t> payload;
+
+	std::atomic<uint64_t> written{0};
+	std::atomic<bool> running{true};
+	std::atomic<bool> failed{false};
+	std::thread thread;
+};
+
+/// Read a telemetry log: range queries and CSV export.
+/// Only the block headers are read on open; a query decodes the blocks
+///     overlapping the range, one at a time.
+class TelemetryLogReader
+{
+public:
+	/// Receive one sample: its time and the telemetry of each servo (see ids())
+	using Callback = std::function<void(uint64_t timestampUs, const ServoTelemetry* telemetry)>;
+
+	/// Open a log and index its blocks. A truncated last block (the writer
+	///     did not close the file) is ignored.
+	/// @throw runtime_error if the file can not be read or is not a telemetry log
+	TelemetryLogReader( const std::string& path );
+
+	/// Logged servos
+	const std::vector<uint8_t>& ids() const;
+
+	/// Number of samples in the log
+	uint64_t sampleCount() const;
+
+	/// Number of blocks (keyframes)
+	size_t blockCount() const;
+
+	/// Time of the first and last sample (0 if the log is empty)
+	uint64_t startUs() const;
+	uint64_t endUs() const;
+
+	/// Call <callback> for each sample with fromUs <= time <= toUs, in order
+	/// @throw runtime_error if a block is corrupted
+	void read( uint64_t fromUs, uint64_t toUs, const Callback& callback ) const;
+
+	/// Write the samples in [fromUs, toUs] as CSV, one line per servo and sample:
+	///     time_us,id,valid,position,vin,temp,loaded
+	void exportCsv( std::ostream& out, uint64_t fromUs=0,
+	    uint64_t toUs=std::numeric_limits<uint64_t>::max() ) const;
+
+private:
+	struct Block
+	{
+		uint64_t offset;           /// of the payload in the file
+		TelemetryLogFormat::BlockHeader header;
+	};
+
+	/// Decode the payload of a block into times [samples] and telemetry [samples][servoCount]
+	inline void decode( std::ifstream& in, const Block& block, std::vector<uint64_t>& times,
+	    std::vector<ServoTelemetry>& telemetry ) const;
+
+	std::string path;
+	std::vector<uint8_t> servoIds;
+	std::vector<Block> blocks;
+	uint64_t samples = 0;
+};
+
+namespace TelemetryLogCoding
+{
+	/// Append an unsigned varint (7 bits per byte, high bit set if more follow)
+	inline void putVarint( std::vector<uint8_t>& out, uint64_t value );
+
+	/// Return a signed value as zigzag (small magnitudes give small values)
+	inline uint64_t zigzag( int64_t value );
+	inline int64_t unzigzag( uint64_t value );
+
+	/// Read an unsigned varint at <pos>
+	/// @throw runtime_error past <end>
+	inline uint64_t getVarint( const uint8_t*& pos, const uint8_t* end );
+
+	/// Append a column of deltas, runs of zeros collapsed
+	inline void putDeltas( std::vector<uint8_t>& out, const int64_t* deltas, size_t count );
+
+	/// Read a column of <count> deltas at <pos>
+	/// @throw runtime_error if the column is corrupted
+	inline void getDeltas( const uint8_t*& pos, const uint8_t* end, int64_t* deltas, size_t count );
+}
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+void TelemetryLogCoding::putVarint( std::vector<uint8_t>& out, uint64_t value )
+{
+	while (value>=0x80)
+	{
+		out.push_back(static_cast<uint8_t>(value|0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t TelemetryLogCoding::zigzag( int64_t value )
+{
+	return (static_cast<uint64_t>(value)<<1) ^ static_cast<uint64_t>(value>>63);
+}
+
+int64_t TelemetryLogCoding::unzigzag( uint64_t value )
+{
+	return static_cast<int64_t>(value>>1) ^ -static_cast<int64_t>(value&1);
+}
+
+uint64_t TelemetryLogCoding::getVarint( const uint8_t*& pos, const uint8_t* end )
+{
+	uint64_t value = 0;
+	for (unsigned shift=0; shift<64; shift+=7)
+	{
+		if (pos>=end)
+		{
+			throw std::runtime_error("Corrupted telemetry log block");
+		}
+		const uint8_t byte = *pos++;
+		value |= static_cast<uint64_t>(byte&0x7F)<<shift;
+		if (!(byte&0x80)) return value;
+	}
+	throw std::runtime_error("Corrupted telemetry log block");
+}
+
+void TelemetryLogCoding::putDeltas( std::vector<uint8_t>& out, const int64_t* deltas, size_t count )
+{
+	for (size_t i=0; i<count;)
+	{
+		size_t run = 0;
+		while (i+run<count && 0==deltas[i+run]) ++run;
+		if (run>1)
+		{
+			putVarint(out, (static_cast<uint64_t>(run)<<1)|1);
+			i += run;
+		}
+		else
+		{
+			putVarint(out, zigzag(deltas[i++])<<1);
+		}
+	}
+}
+
+void TelemetryLogCoding::getDeltas( const uint8_t*& pos, const uint8_t* end, int64_t* deltas, size_t count )
+{
+	for (size_t i=0; i<count;)
+	{
+		const uint64_t value = getVarint(pos, end);
+		if (value&1)
+		{
+			const uint64_t run = value>>1;
+			if (run>count-i)
+			{
+				throw std::runtime_error("Corrupted telemetry log block");
+			}
+			std::fill(deltas+i, deltas+i+run, 0);
+			i += run;
+		}
+		else
+		{
+			deltas[i++] = unzigzag(value>>1);
+		}
+	}
+}
+
+TelemetryLogWriter::TelemetryLogWriter( const std::string& path, const std::vector<uint8_t>& ids ):
+    TelemetryLogWriter(path, ids, Config())
+{
+}
+
+TelemetryLogWriter::TelemetryLogWriter( const std::string& path, const std::vector<uint8_t>& ids, const Config& config ):
+    servoCount(ids.size()), config(config),
+    queueTimes(config.queueSamples), queueTelemetry(static_cast<size_t>(config.queueSamples)*ids.size())
+{
+	if (ids.empty() || ids.size()>0xFFFF || 0==config.keyframeInterval || 0==config.queueSamples)
+	{
+		throw std::runtime_error("Invalid telemetry log parameters");
+	}
+	file = std::fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		throw std::runtime_error("Unable to create telemetry log " + path);
+	}
+
+	TelemetryLogFormat::Header header{};
+	std::memcpy(header.magic, TelemetryLogFormat::Magic, sizeof(TelemetryLogFormat::Magic));
+	header.servoCount = static_cast<uint16_t>(ids.size());
+	header.keyframeInterval = config.keyframeInterval;
+	if (1!=std::fwrite(&header, sizeof(header), 1, file) || ids.size()!=std::fwrite(ids.data(), 1, ids.size(), file))
+	{
+		std::fclose(file);
+		throw std::runtime_error("Unable to write telemetry log " + path);
+	}
+	written = sizeof(header)+ids.size();
+
+	blockTimes.reserve(config.keyframeInterval);
+	deltas.reserve(config.keyframeInterval);
+	blockTelemetry.reserve(static_cast<size_t>(config.keyframeInterval)*servoCount);
+	thread = std::thread([this]{ run(); });
+}
+
+TelemetryLogWriter::~TelemetryLogWriter()
+{
+	try
+	{
+		close();
+	}
+	catch(...)
+	{
+	}
+}
+
+bool TelemetryLogWriter::append( uint64_t timestampUs, const ServoTelemetry* telemetry )
+{
+	const uint64_t h = head.load(std::memory_order_relaxed);
+	if (h-tail.load(std::memory_order_acquire)>=config.queueSamples)
+	{
+		droppedSamples.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	const size_t slot = h%config.queueSamples;
+	queueTimes[slot] = timestampUs;
+	std::copy(telemetry, telemetry+servoCount, queueTelemetry.begin()+slot*servoCount);
+	head.store(h+1, std::memory_order_release);
+	return true;
+}
+
+void TelemetryLogWriter::run()
+{
+	while (true)
+	{
+		// Read running first: samples queued before close() are written
+		const bool stop = !running.load(std::memory_order_acquire);
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		const uint64_t h = head.load(std::memory_order_acquire);
+		for (; t<h; ++t)
+		{
+			const size_t slot = t%config.queueSamples;
+			blockTimes.push_back(queueTimes[slot]);
+			blockTelemetry.insert(blockTelemetry.end(), queueTelemetry.begin()+slot*servoCount,
+			    queueTelemetry.begin()+(slot+1)*servoCount);
+			tail.store(t+1, std::memory_order_release);
+			if (blockTimes.size()==config.keyframeInterval) writeBlock();
+		}
+		if (stop) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(config.idleMs));
+	}
+	writeBlock();
+}
+
+void TelemetryLogWriter::writeBlock()
+{
+	using namespace TelemetryLogCoding;
+	const size_t count = blockTimes.size();
+	if (0==count) return;
+
+	payload.clear();
+	deltas.resize(count);
+	deltas[0] = 0;
+	for (size_t i=1; i<count; ++i)
+	{
+		const int64_t period = static_cast<int64_t>(blockTimes[i]-blockTimes[i-1]);
+		deltas[i] = 1==i ? period : period-static_cast<int64_t>(blockTimes[i-1]-blockTimes[i-2]);
+	}
+	putDeltas(payload, deltas.data()+1, count-1);
+	for (size_t s=0; s<servoCount; ++s)
+	{
+		const auto at = [&](size_t i) -> const ServoTelemetry& { return blockTelemetry[i*servoCount+s]; };
+		for (auto flag: {&ServoTelemetry::valid, &ServoTelemetry::loaded})
+		{
+			for (size_t i=0; i<count; i+=8)
+			{
+				uint8_t bits = 0;
+				for (size_t b=0; b<8 && i+b<count; ++b) bits |= (at(i+b).*flag ? 1 : 0)<<b;
+				payload.push_back(bits);
+			}
+		}
+		const auto column = [&](auto field)
+		{
+			int64_t previous = 0;
+			for (size_t i=0; i<count; ++i)
+			{
+				const int64_t value = at(i).*field;
+				deltas[i] = value-previous;
+				previous = value;
+			}
+			putDeltas(payload, deltas.data(), count);
+		};
+		column(&ServoTelemetry::position);
+		column(&ServoTelemetry::vin);
+		column(&ServoTelemetry::temp);
+	}
+
+	TelemetryLogFormat::BlockHeader header{};
+	header.sync = TelemetryLogFormat::BlockSync;
+	header.payloadBytes = static_cast<uint32_t>(payload.size());
+	header.firstUs = blockTimes.front();
+	header.lastUs = blockTimes.back();
+	header.samples = static_cast<uint32_t>(count);
+	if (1!=std::fwrite(&header, sizeof(header), 1, file) ||
+	    payload.size()!=std::fwrite(payload.data(), 1, payload.size(), file))
+	{
+		failed = true;
+	}
+	written += sizeof(header)+payload.size();
+
+	blockTimes.clear();
+	blockTelemetry.clear();
+}
+
+void TelemetryLogWriter::close()
+{
+	if (!thread.joinable()) return;
+	running.store(false, std::memory_order_release);
+	thread.join();
+	if (0!=std::fclose(file))
+	{
+		failed = true;
+	}
+	file = nullptr;
+	if (failed)
+	{
+		throw std::runtime_error("Unable to write telemetry log");
+	}
+}
+
+uint64_t TelemetryLogWriter::dropped() const
+{
+	return droppedSamples.load(std::memory_order_relaxed);
+}
+
+uint64_t TelemetryLogWriter::bytes() const
+{
+	return written.load(std::memory_order_relaxed);
+}
+
+TelemetryLogReader::TelemetryLogReader( const std::string& path ): path(path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+	{
+		throw std::runtime_error("Unable to open telemetry log " + path);
+	}
+	TelemetryLogFormat::Header header{};
+	in.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!in || 0!=std::memcmp(header.magic, TelemetryLogFormat::Magic, sizeof(TelemetryLogFormat::Magic)) ||
+	    0==header.servoCount)
+	{
+		throw std::runtime_error("Invalid or incompatible telemetry log " + path);
+	}
+	servoIds.resize(header.servoCount);
+	in.read(reinterpret_cast<char*>(servoIds.data()), servoIds.size());
+	if (!in)
+	{
+		throw std::runtime_error("Invalid or incompatible telemetry log " + path);
+	}
+
+	in.seekg(0, std::ios::end);
+	const uint64_t size = static_cast<uint64_t>(in.tellg());
+	uint64_t offset = sizeof(header)+servoIds.size();
+	while (offset+sizeof(TelemetryLogFormat::BlockHeader)<=size)
+	{
+		Block block;
+		in.seekg(offset);
+		in.read(reinterpret_cast<char*>(&block.header), sizeof(block.header));
+		block.offset = offset+sizeof(block.header);
+		if (!in || TelemetryLogFormat::BlockSync!=block.header.sync || 0==block.header.samples ||
+		    block.offset+block.header.payloadBytes>size)
+		{
+			break;
+		}
+		blocks.push_back(block);
+		samples += block.header.samples;
+		offset = block.offset+block.header.payloadBytes;
+	}
+}
+
+const std::vector<uint8_t>& TelemetryLogReader::ids() const
+{
+	return servoIds;
+}
+
+uint64_t TelemetryLogReader::sampleCount() const
+{
+	return samples;
+}
+
+size_t TelemetryLogReader::blockCount() const
+{
+	return blocks.size();
+}
+
+uint64_t TelemetryLogReader::startUs() const
+{
+	return blocks.empty() ? 0 : blocks.front().header.firstUs;
+}
+
+uint64_t TelemetryLogReader::endUs() const
+{
+	return blocks.empty() ? 0 : blocks.back().header.lastUs;
+}
+
+void TelemetryLogReader::decode( std::ifstream& in, const Block& block, std::vector<uint64_t>& times,
+    std::vector<ServoTelemetry>& telemetry ) const
+{
+	using namespace TelemetryLogCoding;
+	std::vector<uint8_t> payload(block.header.payloadBytes);
+	in.seekg(block.offset);
+	in.read(reinterpret_cast<char*>(payload.data()), payload.size());
+	if (!in)
+	{
+		throw std::runtime_error("Unable to read telemetry log " + path);
+	}
+
+	const size_t count = block.header.samples;
+	const size_t servoCount = servoIds.size();
+	const uint8_t* pos = payload.data();
+	const uint8_t* end = pos+payload.size();
+
+	std::vector<int64_t> deltas(count);
+	getDeltas(pos, end, deltas.data(), count-1);
+	times.resize(count);
+	times[0] = block.header.firstUs;
+	int64_t period = 0;
+	for (size_t i=1; i<count; ++i)
+	{
+		period += deltas[i-1];
+		times[i] = times[i-1]+period;
+	}
+
+	telemetry.assign(count*servoCount, ServoTelemetry());
+	const size_t bitmapBytes = (count+7)/8;
+	for (size_t s=0; s<servoCount; ++s)
+	{
+		const auto at = [&](size_t i) -> ServoTelemetry& { return telemetry[i*servoCount+s]; };
+		for (auto flag: {&ServoTelemetry::valid, &ServoTelemetry::loaded})
+		{
+			if (static_cast<size_t>(end-pos)<bitmapBytes)
+			{
+				throw std::runtime_error("Corrupted telemetry log block");
+			}
+			for (size_t i=0; i<count; ++i) at(i).*flag = (pos[i/8]>>(i%8))&1;
+			pos += bitmapBytes;
+		}
+		const auto column = [&](auto field)
+		{
+			using Type = std::remove_reference_t<decltype(at(0).*field)>;
+			getDeltas(pos, end, deltas.data(), count);
+			int64_t value = 0;
+			for (size_t i=0; i<count; ++i)
+			{
+				value += deltas[i];
+				at(i).*field = static_cast<Type>(value);
+			}
+		};
+		column(&ServoTelemetry::position);
+		column(&ServoTelemetry::vin);
+		column(&ServoTelemetry::temp);
+	}
+}
+
+void TelemetryLogReader::read( uint64_t fromUs, uint64_t toUs, const Callback& callback ) const
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint64_t> times;
+	std::vector<ServoTelemetry> telemetry;
+	// Blocks are in time order: skip to the first one ending after fromUs
+	auto block = std::lower_bound(blocks.begin(), blocks.end(), fromUs,
+	    [](const Block& b, uint64_t us){ return b.header.lastUs<us; });
+	for (; block!=blocks.end() && block->header.firstUs<=toUs; ++block)
+	{
+		decode(in, *block, times, telemetry);
+		for (size_t i=0; i<times.size(); ++i)
+		{
+			if (times[i]>=fromUs && times[i]<=toUs) callback(times[i], &telemetry[i*servoIds.size()]);
+		}
+	}
+}
+
+void TelemetryLogReader::exportCsv( std::ostream& out, uint64_t fromUs, uint64_t toUs ) const
+{
+	out << "time_us,id,valid,position,vin,temp,loaded\n";
+	read(fromUs, toUs, [&](uint64_t timestampUs, const ServoTelemetry* telemetry)
+	{
+		for (size_t s=0; s<servoIds.size(); ++s)
+		{
+			const auto& t = telemetry[s];
+			out << timestampUs << ',' << static_cast<int>(servoIds[s]) << ',' << t.valid << ','
+			    << t.position << ',' << t.vin << ',' << static_cast<int>(t.temp) << ',' << t.loaded << '\n';
+		}
+	});
+}
+
+}
+#endif //HIWONDER_RPI_TELEMETRY_LOG
@@ -0,0 +1,405 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_TRACE
+#define HIWONDER_RPI_TRACE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HiwonderTransport.hpp"
+
+namespace HiwonderRpi
+{
+
+/// File format of a bus trace: a header, then events in time order.
+/// An event is a kind, its time since the start of the capture in us, a
+///     length and the bytes: the bytes written (Tx), the bytes that became
+///     available to read at this time (Rx), or none when the input was
+///     discarded (Discard: the Rx bytes before it were never read).
+struct TraceFormat
+{
+	constexpr static char Magic[8] = {'H','W','T','R','A','C','E','1'};
+
+	enum class Kind: uint8_t
+	{
+		Tx = 0,
+		Rx = 1,
+		Discard = 2
+	};
+
+	struct Header
+	{
+		char magic[8];
+		int32_t baud;
+		uint32_t reserved;
+	};
+
+	struct EventHeader
+	{
+		uint64_t timeUs;
+		uint16_t size;
+		Kind kind;
+		uint8_t reserved;
+		uint32_t reserved2;
+	};
+
+	struct Event
+	{
+		Kind kind;
+		uint64_t timeUs;
+		std::vector<uint8_t> bytes;
+	};
+};
+
+/// Capture the traffic of a transport, e.g. on a robot in the field.
+/// Received bytes are pulled from the wrapped transport as soon as they are
+///     seen, and stamped with that time: the trace keeps the arrival time of
+///     every byte, including the ones the bus discards.
+/// Events are streamed to the file (buffered), memory does not grow with
+///     the length of the capture.
+class TraceRecorder: public HiwonderTransport
+{
+public:
+	/// @arg transport: transport to capture
+	/// @arg path: trace file
+	/// @throw runtime_error if the file can not be created
+	TraceRecorder( std::unique_ptr<HiwonderTransport> transport, const std::string& path );
+
+	void open() override;
+	void write( const uint8_t* data, size_t size ) override;
+	void drain() override;
+	int available() override;
+	int getByte() override;
+	void discardInput() override;
+	int baud() const override;
+
+	/// Write the buffered events to the file
+	void flush();
+
+	/// Number of events captured
+	uint64_t eventCount() const;
+
+private:
+	/// Move the bytes available on the transport to the input, as one Rx event
+	inline void pull();
+
+	/// Append an event to the file
+	inline void record( TraceFormat::Kind kind, const uint8_t* data, size_t size );
+
+	std::unique_ptr<HiwonderTransport> transport;
+	std::ofstream out;
+	std::chrono::steady_clock::time_point start;
+	std::deque<uint8_t> input;
+	std::vector<uint8_t> pulled;
+	uint64_t events = 0;
+};
+
+/// Replay a trace through the driver: the bus writes its requests as usual,
+///     and the replies are the captured bytes, each made available at the
+///     same delay after the matching request as in the capture.
+/// With the same sequence of operations, the bus (getMessage, checks,
+///     retries, timeouts) sees byte-for-byte the same input at the same
+///     relative times, which reproduces a field failure; the replay also
+///     benchmarks the captured workload without hardware.
+/// A write not matching the captured request is counted (see Stats) and the
+///     replay continues from it.
+class TraceReplay: public HiwonderTransport
+{
+public:
+	enum class Timing: uint8_t
+	{
+		Original = 0,  /// Bytes arrive at the captured delay after each request
+		Immediate = 1  /// Bytes are available as soon as the request is written
+	};
+
+	struct Stats
+	{
+		uint64_t writes = 0;      /// Requests written by the bus
+		uint64_t mismatches = 0;  /// Requests differing from the capture (or past its end)
+		uint64_t rxBytes = 0;     /// Captured bytes made available
+	};
+
+	/// Load a trace
+	/// @throw runtime_error if the file can not be read or is not a trace
+	TraceReplay( const std::string& path, Timing timing=Timing::Original );
+
+	void write( const uint8_t* data, size_t size ) override;
+	int available() override;
+	int getByte() override;
+	void discardInput() override;
+	int baud() const override;
+
+	/// True once all the events of the trace were replayed
+	bool finished() const;
+
+	const Stats& stats() const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/// Move the bytes due by now to the input
+	inline void arrive();
+
+	std::vector<TraceFormat::Event> events;
+	int traceBaud = 0;
+	Timing timing;
+	size_t next = 0;                 // next event not replayed
+	Clock::time_point anchor;        // replay time of the last request
+	uint64_t anchorUs = 0;           // its capture time
+	std::deque<uint8_t> input;
+	Stats stat;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+TraceRecorder::TraceRecorder( std::unique_ptr<HiwonderTransport> transport, const std::string& path ):
+    transport(std::move(transport)), out(path, std::ios::binary), start(std::chrono::steady_clock::now())
+{
+	TraceFormat::Header header{};
+	std::memcpy(header.magic, TraceFormat::Magic, sizeof(TraceFormat::Magic));
+	header.baud = this->transport->baud();
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!out)
+	{
+		throw std::runtime_error("Unable to create trace " + path);
+	}
+}
+
+void TraceRecorder::record( TraceFormat::Kind kind, const uint8_t* data, size_t size )
+{
+	const auto now = std::chrono::steady_clock::now();
+	const uint64_t timeUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now-start).count());
+	// Split to fit the 16 bits length
+	size_t done = 0;
+	do
+	{
+		TraceFormat::EventHeader header{};
+		header.timeUs = timeUs;
+		header.size = static_cast<uint16_t>(std::min<size_t>(size-done, 0xFFFF));
+		header.kind = kind;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(data+done), header.size);
+		++events;
+		done += header.size;
+	}
+	while (done<size);
+}
+
+void TraceRecorder::pull()
+{
+	pulled.clear();
+	for (int n=transport->available(); n>0; --n)
+	{
+		const int byte = transport->getByte();
+		if (byte<0) break;
+		pulled.push_back(static_cast<uint8_t>(byte));
+	}
+	if (!pulled.empty())
+	{
+		record(TraceFormat::Kind::Rx, pulled.data(), pulled.size());
+		input.insert(input.end(), pulled.begin(), pulled.end());
+	}
+}
+
+void TraceRecorder::open()
+{
+	transport->open();
+}
+
+void TraceRecorder::write( const uint8_t* data, size_t size )
+{
+	record(TraceFormat::Kind::Tx, data, size);
+	transport->write(data, size);
+}
+
+void TraceRecorder::drain()
+{
+	transport->drain();
+}
+
+int TraceRecorder::available()
+{
+	pull();
+	return static_cast<int>(input.size());
+}
+
+int TraceRecorder::getByte()
+{
+	if (input.empty()) pull();
+	if (input.empty()) return -1;
+	const int byte = input.front();
+	input.pop_front();
+	return byte;
+}
+
+void TraceRecorder::discardInput()
+{
+	pull();
+	input.clear();
+	transport->discardInput();
+	record(TraceFormat::Kind::Discard, pulled.data(), 0);
+}
+
+int TraceRecorder::baud() const
+{
+	return transport->baud();
+}
+
+void TraceRecorder::flush()
+{
+	out.flush();
+	if (!out)
+	{
+		throw std::runtime_error("Unable to write trace");
+	}
+}
+
+uint64_t TraceRecorder::eventCount() const
+{
+	return events;
+}
+
+TraceReplay::TraceReplay( const std::string& path, Timing timing ): timing(timing)
+{
+	std::ifstream in(path, std::ios::binary);
+	TraceFormat::Header header{};
+	in.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!in || 0!=std::memcmp(header.magic, TraceFormat::Magic, sizeof(TraceFormat::Magic)))
+	{
+		throw std::runtime_error("Unable to read trace " + path);
+	}
+	traceBaud = header.baud;
+
+	// A truncated last event (capture interrupted) is ignored
+	TraceFormat::EventHeader event;
+	while (in.read(reinterpret_cast<char*>(&event), sizeof(event)))
+	{
+		TraceFormat::Event e{event.kind, event.timeUs, std::vector<uint8_t>(event.size)};
+		if (!in.read(reinterpret_cast<char*>(e.bytes.data()), event.size)) break;
+		events.push_back(std::move(e));
+	}
+	anchor = Clock::now();
+}
+
+void TraceReplay::arrive()
+{
+	if (next>=events.size() || TraceFormat::Kind::Rx!=events[next].kind) return;
+	const auto now = Clock::now();
+	while (next<events.size() && TraceFormat::Kind::Rx==events[next].kind)
+	{
+		const auto& event = events[next];
+		const auto due = anchor + std::chrono::microseconds(event.timeUs-anchorUs);
+		if (Timing::Original==timing && due>now) break;
+		input.insert(input.end(), event.bytes.begin(), event.bytes.end());
+		stat.rxBytes += event.bytes.size();
+		++next;
+	}
+}
+
+void TraceReplay::write( const uint8_t* data, size_t size )
+{
+	++stat.writes;
+	// Bytes captured before this request arrive now (a captured discard the
+	//     bus did not repeat is ignored)
+	while (next<events.size() && TraceFormat::Kind::Tx!=events[next].kind)
+	{
+		if (TraceFormat::Kind::Rx==events[next].kind)
+		{
+			input.insert(input.end(), events[next].bytes.begin(), events[next].bytes.end());
+			stat.rxBytes += events[next].bytes.size();
+		}
+		++next;
+	}
+
+	if (next>=events.size())
+	{
+		++stat.mismatches;
+		return;
+	}
+	const auto& event = events[next];
+	if (event.bytes.size()!=size || !std::equal(event.bytes.begin(), event.bytes.end(), data))
+	{
+		++stat.mismatches;
+	}
+	anchor = Clock::now();
+	anchorUs = event.timeUs;
+	++next;
+}
+
+int TraceReplay::available()
+{
+	arrive();
+	return static_cast<int>(input.size());
+}
+
+int TraceReplay::getByte()
+{
+	arrive();
+	if (input.empty()) return -1;
+	const int byte = input.front();
+	input.pop_front();
+	return byte;
+}
+
+void TraceReplay::discardInput()
+{
+	arrive();
+	input.clear();
+
+	// The bytes discarded in the capture are dropped, even if they are not due
+	//     yet (the replay reached the discard earlier than the capture did)
+	size_t event = next;
+	while (event<events.size() && TraceFormat::Kind::Rx==events[event].kind) ++event;
+	if (event<events.size() && TraceFormat::Kind::Discard==events[event].kind)
+	{
+		next = event+1;
+	}
+}
+
+int TraceReplay::baud() const
+{
+	return traceBaud;
+}
+
+bool TraceReplay::finished() const
+{
+	return next>=events.size();
+}
+
+const TraceReplay::Stats& TraceReplay::stats() const
+{
+	return stat;
+}
+
+}
+#endif //HIWONDER_RPI_TRACE
@@ -0,0 +1,358 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_TRAJECTORY
+#define HIWONDER_RPI_TRAJECTORY
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "HiwonderBusServo.hpp"
+#include "HiwonderControlLoop.hpp"
+
+namespace HiwonderRpi
+{
+
+/// Multi-joint trajectory through timed waypoints.
+/// Positions are in servo units (multiples of 0.24deg, [0,1000]).
+/// Each segment between two waypoints is a polynomial per joint, stored in
+///     structure-of-arrays layout: [segment][coefficient][joint]. Evaluation is a
+///     Horner scheme where every step is a contiguous loop over the joints, which
+///     the compiler vectorises, so the cost per joint stays flat.
+/// Velocities at waypoints are Catmull-Rom tangents (zero at the first and last waypoint).
+class Trajectory
+{
+public:
+	enum class Interpolation: uint8_t
+	{
+		Cubic = 0,   /// Continuous position and velocity
+		Quintic = 1  /// Continuous position and velocity, zero acceleration at waypoints
+	};
+
+	/// Create an empty trajectory
+	/// @arg joints: number of servos driven by the trajectory
+	/// @arg interpolation: polynomial used between waypoints
+	Trajectory( size_t joints, Interpolation interpolation=Interpolation::Cubic );
+
+	/// Append a waypoint.
+	/// @arg time: time of the waypoint in seconds, must be greater than the previous one
+	/// @arg positions: one target per joint, in servo units
+	/// @throw runtime_error if time is not increasing
+	void addWaypoint( float time, const float* positions );
+
+	/// Remove all waypoints
+	void clear();
+
+	/// Number of joints
+	size_t joints() const;
+
+	/// Number of waypoints
+	size_t waypoints() const;
+
+	/// Time of the first waypoint (in seconds)
+	float startTime() const;
+
+	/// Time of the last waypoint (in seconds)
+	float endTime() const;
+
+	/// Evaluate all joints at time t (clamped to the trajectory time range).
+	/// @arg t: time in seconds
+	/// @arg out: output array of joints() positions, in servo units
+	void evaluate( float t, float* out ) const;
+
+	/// Same as above, rounded and clamped to [0,1000]
+	/// Note: uses an internal scratch buffer, not safe to call concurrently on the same object.
+	void evaluate( float t, int16_t* out ) const;
+
+private:
+	/// Return the number of coefficients of each segment polynomial
+	inline size_t order() const;
+
+	/// Return the Catmull-Rom velocity of a joint at a waypoint (units/s)
+	inline float velocity( size_t waypoint, size_t joint ) const;
+
+	/// Compute the coefficients of the segment [segment, segment+1]
+	inline void buildSegment( size_t segment );
+
+	size_t jointCount;
+	Interpolation interpolation;
+	std::vector<float> times;   // [waypoint]
+	std::vector<float> points;  // [waypoint][joint]
+	std::vector<float> coeffs;  // [segment][coefficient][joint], in normalized segment time
+	mutable std::vector<float> scratch; // [joint]
+};
+
+/// Sample a trajectory at a fixed rate and emit each sample as one frame of
+///     setpoints for all the joints.
+/// Each setpoint is sent with a move time equal to the period, so servos
+///     interpolate linearly between two consecutive frames.
+class TrajectoryStreamer
+{
+public:
+	/// Receive one frame: all joint positions (servo units) and the time to reach them (ms)
+	using Sink = std::function<void(const int16_t* positions, size_t joints, uint16_t timeMs)>;
+
+	/// @arg trajectory: trajectory to stream (must outlive the streamer)
+	/// @arg rateHz: number of frames per second
+	/// @arg sink: destination of the frames
+	TrajectoryStreamer( const Trajectory& trajectory, float rateHz, Sink sink );
+
+	/// Evaluate the trajectory at time t (in seconds) and emit the frame
+	void emit( float t );
+
+	/// Stream the whole trajectory at the configured rate (blocking).
+	/// @arg loopConfig: real-time settings for the loop, the period is overwritten by the rate
+	/// @return the statistics of the loop
+	ControlLoop::Stats play( ControlLoop::Config loopConfig = ControlLoop::Config() );
+
+	/// Return a sink sending each joint position to the servo of the same index
+	///     with moveTimeWrite. The frames of a tick are queued and sent at once
+	///     on each bus (see HiwonderBus::hold). The buses must outlive the sink.
+	static Sink servoSink( std::vector<HiwonderBusServo*> servos );
+
+	/// Same as above, with servo handles (copied into the sink)
+	static Sink servoSink( std::vector<HiwonderBusServo> servos );
+
+private:
+	const Trajectory& trajectory;
+	float rateHz;
+	Sink sink;
+	std::vector<int16_t> frame;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+Trajectory::Trajectory( size_t joints, Interpolation interpolation ):
+    jointCount(joints), interpolation(interpolation), scratch(joints)
+{
+}
+
+size_t Trajectory::order() const
+{
+	return Interpolation::Quintic==interpolation ? 6 : 4;
+}
+
+size_t Trajectory::joints() const
+{
+	return jointCount;
+}
+
+size_t Trajectory::waypoints() const
+{
+	return times.size();
+}
+
+float Trajectory::startTime() const
+{
+	return times.empty() ? 0.0f : times.front();
+}
+
+float Trajectory::endTime() const
+{
+	return times.empty() ? 0.0f : times.back();
+}
+
+void Trajectory::clear()
+{
+	times.clear();
+	points.clear();
+	coeffs.clear();
+}
+
+float Trajectory::velocity( size_t waypoint, size_t joint ) const
+{
+	if (0==waypoint || waypoint+1>=times.size())
+	{
+		return 0.0f;
+	}
+	const float* prev = &points[(waypoint-1)*jointCount];
+	const float* next = &points[(waypoint+1)*jointCount];
+	return (next[joint]-prev[joint])/(times[waypoint+1]-times[waypoint-1]);
+}
+
+void Trajectory::buildSegment( size_t segment )
+{
+	const size_t n = jointCount;
+	const float dt = times[segment+1]-times[segment];
+	const float* p0 = &points[segment*n];
+	const float* p1 = &points[(segment+1)*n];
+	float* c = &coeffs[segment*order()*n];
+
+	for (size_t j=0; j<n; ++j)
+	{
+		// Velocities scaled to the normalized segment time [0,1]
+		const float m0 = velocity(segment, j)*dt;
+		const float m1 = velocity(segment+1, j)*dt;
+		const float d = p1[j]-p0[j];
+
+		c[0*n+j] = p0[j];
+		c[1*n+j] = m0;
+		if (Interpolation::Quintic==interpolation)
+		{
+			c[2*n+j] = 0.0f;
+			c[3*n+j] = 10.0f*d - 6.0f*m0 - 4.0f*m1;
+			c[4*n+j] = -15.0f*d + 8.0f*m0 + 7.0f*m1;
+			c[5*n+j] = 6.0f*d - 3.0f*m0 - 3.0f*m1;
+		}
+		else
+		{
+			c[2*n+j] = 3.0f*d - 2.0f*m0 - m1;
+			c[3*n+j] = -2.0f*d + m0 + m1;
+		}
+	}
+}
+
+void Trajectory::addWaypoint( float time, const float* positions )
+{
+	if (!times.empty() && time<=times.back())
+	{
+		throw std::runtime_error("Trajectory waypoints must have increasing time");
+	}
+
+	times.push_back(time);
+	points.insert(points.end(), positions, positions+jointCount);
+
+	const size_t count = times.size();
+	if (count<2)
+	{
+		return;
+	}
+	coeffs.resize((count-1)*order()*jointCount);
+
+	// The new waypoint changes the tangent of the previous one:
+	//     only the two last segments are affected.
+	if (count>2)
+	{
+		buildSegment(count-3);
+	}
+	buildSegment(count-2);
+}
+
+void Trajectory::evaluate( float t, float* out ) const
+{
+	const size_t n = jointCount;
+	if (times.empty())
+	{
+		return;
+	}
+	if (times.size()==1 || t<=times.front())
+	{
+		std::copy(points.begin(), points.begin()+n, out);
+		return;
+	}
+	if (t>=times.back())
+	{
+		std::copy(points.end()-n, points.end(), out);
+		return;
+	}
+
+	const size_t segment = std::upper_bound(times.begin(), times.end(), t)-times.begin()-1;
+	const float s = (t-times[segment])/(times[segment+1]-times[segment]);
+	const size_t ord = order();
+	const float* c = &coeffs[segment*ord*n];
+
+	// Horner scheme, one contiguous pass over all joints per coefficient
+	const float* top = c+(ord-1)*n;
+	for (size_t j=0; j<n; ++j) out[j] = top[j];
+	for (size_t k=ord-1; k-->0;)
+	{
+		const float* ck = c+k*n;
+		for (size_t j=0; j<n; ++j) out[j] = out[j]*s + ck[j];
+	}
+}
+
+void Trajectory::evaluate( float t, int16_t* out ) const
+{
+	float* values = scratch.data();
+	evaluate(t, values);
+	for (size_t j=0; j<jointCount; ++j)
+	{
+		out[j] = static_cast<int16_t>(std::lround(std::min(1000.0f, std::max(0.0f, values[j]))));
+	}
+}
+
+TrajectoryStreamer::TrajectoryStreamer( const Trajectory& trajectory, float rateHz, Sink sink ):
+    trajectory(trajectory), rateHz(rateHz), sink(std::move(sink)), frame(trajectory.joints())
+{
+	if (rateHz<=0.0f)
+	{
+		throw std::runtime_error("Trajectory stream rate must be positive");
+	}
+}
+
+void TrajectoryStreamer::emit( float t )
+{
+	trajectory.evaluate(t, frame.data());
+	sink(frame.data(), frame.size(), static_cast<uint16_t>(std::lround(1000.0f/rateHz)));
+}
+
+ControlLoop::Stats TrajectoryStreamer::play( ControlLoop::Config loopConfig )
+{
+	loopConfig.periodNs = static_cast<int64_t>(1e9/rateHz);
+	ControlLoop loop(loopConfig);
+
+	// Time is taken from the clock (not from the cycle count), so
+	//     skipped cycles do not slow down the motion
+	const float start = trajectory.startTime();
+	const float end = trajectory.endTime();
+	std::chrono::steady_clock::time_point begin;
+	loop.run([&](uint64_t cycle)
+	{
+		if (0==cycle) begin = std::chrono::steady_clock::now();
+		const float t = start + std::chrono::duration<float>(std::chrono::steady_clock::now()-begin).count();
+		emit(std::min(t, end));
+		return t<end;
+	});
+	return loop.stats();
+}
+
+TrajectoryStreamer::Sink TrajectoryStreamer::servoSink( std::vector<HiwonderBusServo*> servos )
+{
+	std::vector<HiwonderBusServo> handles;
+	for (const auto* servo: servos) handles.push_back(*servo);
+	return servoSink(std::move(handles));
+}
+
+TrajectoryStreamer::Sink TrajectoryStreamer::servoSink( std::vector<HiwonderBusServo> servos )
+{
+	return [servos](const int16_t* positions, size_t joints, uint16_t timeMs) mutable
+	{
+		const size_t count = std::min(joints, servos.size());
+		for (size_t j=0; j<count; ++j) servos[j].getBus().hold();
+		for (size_t j=0; j<count; ++j)
+		{
+			servos[j].moveTimeWrite(positions[j], timeMs);
+		}
+		// Already flushed buses have nothing pending
+		for (size_t j=0; j<count; ++j) servos[j].getBus().flush();
+	};
+}
+
+}
+#endif //HIWONDER_RPI_TRAJECTORY
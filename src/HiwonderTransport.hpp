@@ -0,0 +1,201 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_TRANSPORT
+#define HIWONDER_RPI_TRANSPORT
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <termios.h>
+#include <unistd.h>
+
+#include <wiringPi.h>
+#include <wiringSerial.h>
+
+namespace HiwonderRpi
+{
+
+/// Byte stream to/from the servos.
+/// HiwonderBus implements the protocol on top of it; implementations
+///     may be a UART (SerialTransport), an USB adapter, or a simulation.
+class HiwonderTransport
+{
+public:
+	virtual ~HiwonderTransport() = default;
+
+	/// Acquire the underlying device if not done yet.
+	/// Transports open lazily on first use, calling it is only needed to
+	///     control when the cost is paid (or to check for errors early).
+	/// @throw runtime_error if the device can not be opened
+	virtual void open() {}
+
+	/// Send bytes (blocking until all are written)
+	/// @throw runtime_error on write error
+	virtual void write( const uint8_t* data, size_t size ) = 0;
+
+	/// Block until the written bytes are out on the wire.
+	/// write() may return while bytes are still in the driver buffer.
+	virtual void drain() {}
+
+	/// Return the number of bytes ready to be read
+	virtual int available() = 0;
+
+	/// Return the next received byte, or -1 if there is none
+	virtual int getByte() = 0;
+
+	/// Discard all received bytes not read yet (written bytes are not affected)
+	virtual void discardInput() = 0;
+
+	/// Return the baud rate of the link
+	virtual int baud() const = 0;
+};
+
+/// Transport over a serial device (e.g. /dev/ttyAMA0, /dev/ttyUSB0), using wiringSerial
+/// The constructor does not touch the hardware: the device is opened on first
+///     use, and wiringPi is initialized once per process.
+class SerialTransport: public HiwonderTransport
+{
+public:
+	/// Configure the serial device (opened on first use).
+	SerialTransport( const char* device="/dev/ttyAMA0", int baud=115200 );
+	/// Transport can not be copied (UART access is unique)
+	SerialTransport( const SerialTransport& ) = delete;
+	SerialTransport& operator=( const SerialTransport& ) = delete;
+	~SerialTransport() override;
+
+	void open() override;
+	void write( const uint8_t* data, size_t size ) override;
+	void drain() override;
+	int available() override;
+	int getByte() override;
+	void discardInput() override;
+	int baud() const override;
+
+private:
+	/// Initialize wiringPi, only the first call in the process does it
+	inline static void setupWiringPi();
+
+	/// Open the device if not done yet, return the file descriptor
+	inline int device();
+
+	// Access to the device
+	int fd = -1;
+	std::string devicePath;
+	int baudRate = 0;
+};
+
+
+
+
+//*********************************************************
+//                   IMPLEMENTATION
+//*********************************************************
+
+SerialTransport::SerialTransport( const char* device, int baud ): devicePath(device), baudRate(baud)
+{
+}
+
+SerialTransport::~SerialTransport()
+{
+	if (0<=fd)
+	{
+		serialClose(fd);
+	}
+}
+
+void SerialTransport::setupWiringPi()
+{
+	static std::once_flag once;
+	static int setupResult = 0;
+	std::call_once(once, []{ setupResult = wiringPiSetup(); });
+	if (-1==setupResult)
+	{
+		throw std::runtime_error("Unable to setup wiringPi.");
+	}
+}
+
+void SerialTransport::open()
+{
+	if (0<=fd)
+	{
+		return;
+	}
+	setupWiringPi();
+	fd = serialOpen(devicePath.c_str(), baudRate);
+	if (0>fd)
+	{
+		throw std::runtime_error("Unable to setup UART device.");
+	}
+}
+
+int SerialTransport::device()
+{
+	if (0>fd)
+	{
+		open();
+	}
+	return fd;
+}
+
+void SerialTransport::write( const uint8_t* data, size_t size )
+{
+	while (size>0)
+	{
+		const ssize_t done = ::write(device(), data, size);
+		if (done<0)
+		{
+			throw std::runtime_error("Unable to write to UART device");
+		}
+		data += done;
+		size -= static_cast<size_t>(done);
+	}
+}
+
+void SerialTransport::drain()
+{
+	tcdrain(device());
+}
+
+int SerialTransport::available()
+{
+	return serialDataAvail(device());
+}
+
+int SerialTransport::getByte()
+{
+	return serialGetchar(device());
+}
+
+void SerialTransport::discardInput()
+{
+	// Not serialFlush: it also drops the output not sent yet
+	tcflush(device(), TCIFLUSH);
+}
+
+int SerialTransport::baud() const
+{
+	return baudRate;
+}
+
+}
+#endif //HIWONDER_RPI_TRANSPORT
@@ -0,0 +1,128 @@
+/*
+ * This file is part of HiwonderRPI library
+ * 
+ * HiwonderRPI is free software: you can redistribute it and/or modify 
+ * it under ther terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ * 
+ * HiwonderRPI is distributed in the hope that it will be useful, 
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License 
+ * along with HiwonderRPI. If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Author: Adrian Maire escain (at) gmail.com
+ */
+
+#ifndef HIWONDER_RPI_ALLOCATION_COUNTER
+#define HIWONDER_RPI_ALLOCATION_COUNTER
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Count heap allocations of the whole process, to verify that a code path
+ * does not allocate:
+ * {
+ *     AllocationGuard guard;
+ *     steadyStateCycle();
+ *     ASSERT_EQ(guard.count(), 0u);
+ * }
+ *
+ * The global operator new is replaced. With HIWONDER_COUNT_MALLOC (glibc
+ * only), malloc/calloc/realloc are replaced as well, catching C allocations.
+ * Include this header in one translation unit of the test executable only.
+ */
+
+/// Number of allocations since the start of the process
+inline std::atomic<uint64_t>& allocationCount()
+{
+	static std::atomic<uint64_t> count{0};
+	return count;
+}
+
+/// Count the allocations done during its lifetime
+class AllocationGuard
+{
+public:
+	AllocationGuard(): start(allocationCount().load()) {}
+
+	/// Number of allocations since construction
+	uint64_t count() const { return allocationCount().load()-start; }
+
+private:
+	uint64_t start;
+};
+
+
+#if defined(HIWONDER_COUNT_MALLOC) && defined(__GLIBC__)
+extern "C"
+{
+	void* __libc_malloc( size_t size );
+	void* __libc_calloc( size_t count, size_t size );
+	void* __libc_realloc( void* ptr, size_t size );
+
+	void* malloc( size_t size )
+	{
+		allocationCount()++;
+		return __libc_malloc(size);
+	}
+
+	void* calloc( size_t count, size_t size )
+	{
+		allocationCount()++;
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc( void* ptr, size_t size )
+	{
+		allocationCount()++;
+		return __libc_realloc(ptr, size);
+	}
+}
+#define HIWONDER_COUNTED_MALLOC 1
+#else
+#define HIWONDER_COUNTED_MALLOC 0
+#endif
+
+/// operator new on top of malloc, counted once (by malloc if it is hooked)
+inline void* countedNew( size_t size )
+{
+	if (!HIWONDER_COUNTED_MALLOC) allocationCount()++;
+	if (void* ptr = std::malloc(size ? size : 1))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new( size_t size ) { return countedNew(size); }
+void* operator new[]( size_t size ) { return countedNew(size); }
+void* operator new( size_t size, const std::nothrow_t& ) noexcept { try { return countedNew(size); } catch(...) { return nullptr; } }
+void* operator new[]( size_t size, const std::nothrow_t& ) noexcept { try { return countedNew(size); } catch(...) { return nullptr; } }
+void* operator new( size_t size, std::align_val_t align )
+{
+	allocationCount()++;
+	const size_t alignment = static_cast<size_t>(align);
+	if (void* ptr = std::aligned_alloc(alignment, (size+alignment-1)/alignment*alignment))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+void* operator new[]( size_t size, std::align_val_t align ) { return operator new(size, align); }
+void operator delete( void* ptr ) noexcept { std::free(ptr); }
+void operator delete[]( void* ptr ) noexcept { std::free(ptr); }
+void operator delete( void* ptr, size_t ) noexcept { std::free(ptr); }
+void operator delete[]( void* ptr, size_t ) noexcept { std::free(ptr); }
+void operator delete( void* ptr, std::align_val_t ) noexcept { std::free(ptr); }
+void operator delete[]( void* ptr, std::align_val_t ) noexcept { std::free(ptr); }
+void operator delete( void* ptr, size_t, std::align_val_t ) noexcept { std::free(ptr); }
+void operator delete[]( void* ptr, size_t, std::align_val_t ) noexcept { std::free(ptr); }
+
+#endif //HIWONDER_RPI_ALLOCATION_COUNTER
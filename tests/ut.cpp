@@ -17,10 +17,35 @@
  * Author: Adrian Maire escain (at) gmail.com
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <unistd.h>
 
+#include "AllocationCounter.hpp"
+#include "HiwonderBatch.hpp"
+#include "HiwonderBusBudget.hpp"
+#include "HiwonderBusGroup.hpp"
 #include "HiwonderBusServo.hpp"
+#include "HiwonderControlLoop.hpp"
+#include "HiwonderDiscovery.hpp"
+#include "HiwonderEstimator.hpp"
+#include "HiwonderKinematics.hpp"
+#include "HiwonderRecording.hpp"
+#include "HiwonderRobotDescription.hpp"
+#include "HiwonderSimulator.hpp"
+#include "HiwonderStartup.hpp"
+#include "HiwonderTelemetryLog.hpp"
+#include "HiwonderTrace.hpp"
+#include "HiwonderTrajectory.hpp"
 #include "UnitTest.hpp"
 
 constexpr static uint8_t id=1;
@@ -417,3 +442,1623 @@ UNIT_TEST(ledError_read_and_write_match)
 
 	servo.ledErrorWrite(true,true,true);
 }
+
+UNIT_TEST(redundant_writes_are_suppressed_unless_forced)
+{
+	using LoadMode = HiwonderRpi::HiwonderBusServo::LoadMode;
+	HiwonderRpi::HiwonderBus& bus = HiwonderRpi::HiwonderBus::defaultBus();
+	HiwonderRpi::HiwonderBusServo servo(bus, id);
+	
+	servo.loadOrUnloadWrite(LoadMode::Load, true);
+	const auto sent = bus.stats().sent;
+	const auto suppressed = bus.stats().suppressed;
+	
+	servo.loadOrUnloadWrite(LoadMode::Load);
+	ASSERT_EQ(bus.stats().sent, sent);
+	ASSERT_EQ(bus.stats().suppressed, suppressed+1);
+	
+	servo.loadOrUnloadWrite(LoadMode::Load, true);
+	ASSERT_EQ(bus.stats().sent, sent+1);
+}
+
+UNIT_TEST(pending_writes_are_coalesced)
+{
+	HiwonderRpi::HiwonderBus& bus = HiwonderRpi::HiwonderBus::defaultBus();
+	HiwonderRpi::HiwonderBusServo servo(bus, id);
+	
+	const auto coalesced = bus.stats().coalesced;
+	bus.hold();
+	servo.moveTimeWrite(300);
+	servo.moveTimeWrite(400);
+	servo.moveTimeWrite(500);
+	bus.flush();
+	ASSERT_EQ(bus.stats().coalesced, coalesced+2);
+	
+	delay(2000);
+	ASSERT(abs(servo.posRead()-500)<20);
+}
+
+UNIT_TEST(config_cache_answers_reads_and_is_written_through)
+{
+	HiwonderRpi::HiwonderBus& bus = HiwonderRpi::HiwonderBus::defaultBus();
+	HiwonderRpi::HiwonderBusServo servo(bus, id);
+	
+	bus.setConfigCache(true);
+	bus.refreshConfig(id);
+	const auto hits = bus.stats().cacheHits;
+	const auto sent = bus.stats().sent;
+	
+	servo.angleLimitRead();
+	servo.vinLimitRead();
+	servo.tempMaxLimitRead();
+	servo.angleOffsetRead();
+	servo.ledErrorRead();
+	servo.servoOrMotorModeRead();
+	ASSERT_EQ(bus.stats().cacheHits, hits+6);
+	ASSERT_EQ(bus.stats().sent, sent);
+	
+	servo.angleLimitWrite(100,900);
+	auto limits = servo.angleLimitRead();
+	ASSERT_EQ(limits.minLimit, 100);
+	ASSERT_EQ(limits.maxLimit, 900);
+	
+	// Servo still agrees with the cache
+	bus.invalidateConfig(id);
+	limits = servo.angleLimitRead();
+	ASSERT_EQ(limits.minLimit, 100);
+	ASSERT_EQ(limits.maxLimit, 900);
+	
+	servo.angleLimitWrite(0,1000);
+	bus.setConfigCache(false);
+}
+
+UNIT_TEST(controlLoop_runs_at_fixed_period)
+{
+	HiwonderRpi::ControlLoop::Config config;
+	config.periodNs = 2000000; // 2ms
+	HiwonderRpi::ControlLoop loop(config);
+	
+	uint64_t calls = 0;
+	loop.run([&](uint64_t){ return ++calls<50; });
+	
+	const auto& stats = loop.stats();
+	ASSERT_EQ(calls, 50u);
+	ASSERT_EQ(stats.cycles, 50u);
+	ASSERT(stats.minLatencyNs <= stats.maxLatencyNs);
+	ASSERT(stats.latencyPercentileNs(50) <= stats.latencyPercentileNs(99));
+}
+
+UNIT_TEST(controlLoop_overrun_policy_is_called)
+{
+	HiwonderRpi::ControlLoop::Config config;
+	config.periodNs = 1000000; // 1ms
+	HiwonderRpi::ControlLoop loop(config);
+	
+	uint64_t policyCalls = 0;
+	loop.setOverrunPolicy([&](uint64_t)
+	{
+		policyCalls++;
+		return HiwonderRpi::ControlLoop::OverrunAction::Restart;
+	});
+	
+	loop.run([&](uint64_t cycle)
+	{
+		if (cycle==2) delay(5); // Miss some deadlines
+		return cycle<5;
+	});
+	
+	ASSERT(policyCalls >= 1);
+	ASSERT(loop.stats().overruns >= 1);
+	ASSERT(loop.stats().missed >= 4);
+}
+
+UNIT_TEST(controlLoop_caught_up_wakeups_are_missed_once)
+{
+	HiwonderRpi::ControlLoop::Config config;
+	config.periodNs = 1000000; // 1ms
+	HiwonderRpi::ControlLoop loop(config);
+	loop.setOverrunPolicy([](uint64_t){ return HiwonderRpi::ControlLoop::OverrunAction::CatchUp; });
+	
+	loop.run([&](uint64_t cycle)
+	{
+		if (cycle==2) delay(8);
+		return cycle<10;
+	});
+	
+	// Each scheduled wakeup is run (caught up), and counted as missed at most once
+	const auto& stats = loop.stats();
+	ASSERT_EQ(stats.cycles, 11u);
+	ASSERT(stats.missed>=7 && stats.missed<=stats.cycles);
+	ASSERT(stats.overruns>=1 && stats.overruns<=stats.missed);
+}
+
+UNIT_TEST(controlLoop_stop_before_run_is_kept)
+{
+	HiwonderRpi::ControlLoop::Config config;
+	config.periodNs = 1000000; // 1ms
+	HiwonderRpi::ControlLoop loop(config);
+	uint64_t calls = 0;
+	
+	// E.g. a shutdown request from another thread before the loop starts
+	std::thread([&]{ loop.stop(); }).join();
+	loop.run([&](uint64_t){ ++calls; return true; });
+	ASSERT_EQ(calls, 0u);
+	
+	// The request ended that run only
+	loop.run([&](uint64_t){ return ++calls<3; });
+	ASSERT_EQ(calls, 3u);
+}
+
+UNIT_TEST(trajectory_passes_through_waypoints)
+{
+	using Trajectory = HiwonderRpi::Trajectory;
+	for (auto interpolation: {Trajectory::Interpolation::Cubic, Trajectory::Interpolation::Quintic})
+	{
+		Trajectory trajectory(3, interpolation);
+		const float p0[] = {100.0f, 500.0f, 900.0f};
+		const float p1[] = {300.0f, 500.0f, 700.0f};
+		const float p2[] = {500.0f, 400.0f, 100.0f};
+		trajectory.addWaypoint(0.0f, p0);
+		trajectory.addWaypoint(1.0f, p1);
+		trajectory.addWaypoint(3.0f, p2);
+		
+		int16_t out[3];
+		trajectory.evaluate(1.0f, out);
+		ASSERT_EQ(out[0], 300);
+		ASSERT_EQ(out[1], 500);
+		ASSERT_EQ(out[2], 700);
+		
+		trajectory.evaluate(5.0f, out);
+		ASSERT_EQ(out[0], 500);
+		ASSERT_EQ(out[2], 100);
+		
+		// Monotonic waypoints give a monotonic motion
+		int16_t previous = 100;
+		for (float t=0.0f; t<=3.0f; t+=0.05f)
+		{
+			trajectory.evaluate(t, out);
+			ASSERT(out[0] >= previous);
+			previous = out[0];
+		}
+	}
+}
+
+UNIT_TEST(trajectoryStreamer_emits_frames_at_rate)
+{
+	HiwonderRpi::Trajectory trajectory(2);
+	const float p0[] = {0.0f, 1000.0f};
+	const float p1[] = {1000.0f, 0.0f};
+	trajectory.addWaypoint(0.0f, p0);
+	trajectory.addWaypoint(0.1f, p1);
+	
+	size_t frames = 0;
+	int16_t last[2] = {-1,-1};
+	HiwonderRpi::TrajectoryStreamer streamer(trajectory, 200.0f,
+	    [&](const int16_t* positions, size_t joints, uint16_t timeMs)
+	{
+		frames++;
+		ASSERT_EQ(joints, 2u);
+		ASSERT_EQ(timeMs, 5);
+		last[0] = positions[0];
+		last[1] = positions[1];
+	});
+	const auto start = std::chrono::steady_clock::now();
+	const auto stats = streamer.play();
+	const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+	
+	// One frame per cycle, never faster than the rate (cycles can be missed
+	//     on a loaded machine: the count is only bounded by the elapsed time)
+	ASSERT(elapsedUs>=100000);
+	ASSERT_EQ(frames, stats.cycles);
+	ASSERT(frames>=2u);
+	ASSERT(frames<=static_cast<size_t>(elapsedUs/5000+1));
+	ASSERT_EQ(last[0], 1000);
+	ASSERT_EQ(last[1], 0);
+}
+
+UNIT_TEST(kinematics_forward_of_inverse_is_identity)
+{
+	using Kinematics = HiwonderRpi::LegKinematics;
+	constexpr size_t Limbs = 7; // Not a multiple of the SIMD width
+	Kinematics kinematics(Limbs);
+	
+	Kinematics::Geometry geometry{30.0f, 60.0f, 90.0f};
+	Kinematics::Joint reversed;
+	reversed.direction = -1;
+	reversed.offset = 12;
+	for (size_t i=0; i<Limbs; ++i)
+	{
+		kinematics.setLimb(i, geometry, {Kinematics::Joint(), reversed, Kinematics::Joint()});
+	}
+	
+	float x[Limbs], y[Limbs], z[Limbs];
+	for (size_t i=0; i<Limbs; ++i)
+	{
+		x[i] = 80.0f + 5.0f*i;
+		y[i] = -30.0f + 10.0f*i;
+		z[i] = -60.0f + 3.0f*i;
+	}
+	
+	int16_t coxa[Limbs], femur[Limbs], tibia[Limbs];
+	kinematics.inverse(x, y, z, {coxa, femur, tibia});
+	
+	float fx[Limbs], fy[Limbs], fz[Limbs];
+	kinematics.forward({coxa, femur, tibia}, fx, fy, fz);
+	
+	// One servo unit is 0.24deg: ~0.4mm at the end of a 100mm segment
+	for (size_t i=0; i<Limbs; ++i)
+	{
+		ASSERT(std::abs(fx[i]-x[i]) < 2.0f);
+		ASSERT(std::abs(fy[i]-y[i]) < 2.0f);
+		ASSERT(std::abs(fz[i]-z[i]) < 2.0f);
+	}
+}
+
+UNIT_TEST(kinematics_inverse_is_clamped_to_limits)
+{
+	using Kinematics = HiwonderRpi::LegKinematics;
+	Kinematics kinematics(1);
+	Kinematics::Joint limited;
+	limited.minLimit = 400;
+	limited.maxLimit = 600;
+	kinematics.setLimb(0, Kinematics::Geometry{30.0f, 60.0f, 90.0f}, {limited, limited, limited});
+	
+	const float x = 0.0f, y = 100.0f, z = -500.0f; // 90deg yaw and out of reach
+	int16_t coxa, femur, tibia;
+	kinematics.inverse(&x, &y, &z, {&coxa, &femur, &tibia});
+	ASSERT_EQ(coxa, 600);
+	ASSERT(femur >= 400 && femur <= 600);
+	ASSERT(tibia >= 400 && tibia <= 600);
+}
+
+UNIT_TEST(positionEstimator_follows_commanded_move)
+{
+	HiwonderRpi::PositionEstimator estimator;
+	ASSERT(estimator.needsRead(0.0));
+	
+	estimator.update(500, 0.0);
+	ASSERT(!estimator.needsRead(0.01));
+	ASSERT(std::abs(estimator.predict(0.01)-500.0f) < 1.0f);
+	
+	estimator.command(800, 1000, 0.0);
+	ASSERT(std::abs(estimator.predict(0.5)-650.0f) < 1.0f);
+	ASSERT(std::abs(estimator.predict(2.0)-800.0f) < 1.0f);
+	
+	// The servo lags behind: the correction is kept for the rest of the move
+	estimator.update(620, 0.5);
+	ASSERT(estimator.predict(0.5) < 630.0f);
+	ASSERT(estimator.predict(0.6) > estimator.predict(0.5));
+}
+
+UNIT_TEST(positionEstimator_reduces_reads_by_an_order_of_magnitude)
+{
+	HiwonderRpi::PositionEstimator estimator;
+	
+	// Poll at 100Hz for 10s, with a move every 2s; the servo follows the command
+	size_t reads = 0;
+	size_t polls = 0;
+	int16_t target = 200;
+	for (int i=0; i<1000; ++i)
+	{
+		const double t = i*0.01;
+		if (0==i%200)
+		{
+			target = 1000-target;
+			estimator.command(target, 500, t);
+		}
+		polls++;
+		if (estimator.needsRead(t))
+		{
+			reads++;
+			estimator.update(static_cast<int16_t>(estimator.predict(t)), t);
+		}
+	}
+	ASSERT(reads*10 <= polls);
+}
+
+/// Transport keeping all written bytes, servos never answer
+struct WriteOnlyTransport: public HiwonderRpi::HiwonderTransport
+{
+	std::vector<uint8_t>& written;
+	WriteOnlyTransport( std::vector<uint8_t>& written ): written(written) {}
+	void write( const uint8_t* data, size_t size ) override { written.insert(written.end(), data, data+size); }
+	int available() override { return 0; }
+	int getByte() override { return -1; }
+	void discardInput() override {}
+	int baud() const override { return 115200; }
+};
+
+UNIT_TEST(busGroup_splits_group_moves_per_bus)
+{
+	std::vector<uint8_t> written0, written1;
+	HiwonderRpi::BusGroup group;
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written0)));
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written1)));
+	
+	const uint8_t ids[] = {1, 2, 3, 4, 5};
+	const int16_t positions[] = {100, 200, 300, 400, 500};
+	for (auto id: ids) group.assign(id, id%2);
+	
+	group.moveTimeWrite(ids, positions, 5, 20);
+	
+	// 10 bytes per moveTimeWrite frame
+	ASSERT_EQ(written0.size(), 20u);
+	ASSERT_EQ(written1.size(), 30u);
+	ASSERT_EQ((int)written0[2], 2);
+	ASSERT_EQ((int)written0[12], 4);
+	ASSERT_EQ((int)written1[2], 1);
+	ASSERT_EQ((int)written1[22], 5);
+	
+	// Servos do not answer: telemetry is invalid, but the call returns
+	HiwonderRpi::ServoTelemetry telemetry[5];
+	group.poll(ids, 5, telemetry, HiwonderRpi::ServoTelemetry::Position);
+	for (const auto& t: telemetry) ASSERT(!t.valid);
+}
+
+UNIT_TEST(discovery_scan_of_empty_bus_is_fast)
+{
+	std::vector<uint8_t> written;
+	HiwonderRpi::HiwonderBus bus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written)));
+	
+	auto found = HiwonderRpi::ServoDiscovery::scan(bus);
+	ASSERT(found.empty());
+	// One 6 bytes probe per id, without retries, timeout is restored
+	ASSERT_EQ(written.size(), 254u*6u);
+	ASSERT_EQ(bus.stats().timeouts, 254u);
+	ASSERT_EQ(bus.stats().retries, 0u);
+	ASSERT_EQ(bus.replyTimeout(), HiwonderRpi::HiwonderBus::DefaultReplyTimeoutUs);
+	ASSERT(HiwonderRpi::ServoDiscovery::probeTimeoutUs(115200, HiwonderRpi::ServoDiscovery::DefaultMarginUs)
+	    < HiwonderRpi::HiwonderBus::DefaultReplyTimeoutUs/4);
+}
+
+UNIT_TEST(startup_reports_missing_servos_quickly)
+{
+	std::vector<uint8_t> written0, written1;
+	HiwonderRpi::BusGroup group;
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written0)));
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written1)));
+	group.assign(1, 0);
+	group.assign(2, 1);
+	group.assign(3, 1);
+	
+	auto report = HiwonderRpi::Startup::run(group, {1, 2, 3, 4});
+	ASSERT(!report.ok);
+	ASSERT_EQ(report.missing.size(), 4u);
+	ASSERT_EQ((int)report.missing[3], 4);
+	ASSERT(report.validateUs <= report.totalUs);
+	// One probe per assigned servo, each waiting only for the probe timeout
+	ASSERT_EQ(written0.size(), 6u);
+	ASSERT_EQ(written1.size(), 12u);
+	HiwonderRpi::HiwonderBus::Stats stats;
+	uint32_t timeoutUs = 0;
+	group.getExecutor(1).post([&](HiwonderRpi::HiwonderBus& bus){ stats = bus.stats(); timeoutUs = bus.replyTimeout(); });
+	group.getExecutor(1).wait();
+	ASSERT_EQ(stats.timeouts, 2u);
+	ASSERT_EQ(stats.retries, 0u);
+	ASSERT_EQ(timeoutUs, HiwonderRpi::HiwonderBus::DefaultReplyTimeoutUs);
+	ASSERT(HiwonderRpi::ServoDiscovery::probeTimeoutUs(115200, HiwonderRpi::ServoDiscovery::DefaultMarginUs)*2u <= report.validateUs);
+}
+
+/// Transport failing to open or write (e.g. an unplugged USB adapter)
+struct FailingTransport: public WriteOnlyTransport
+{
+	using WriteOnlyTransport::WriteOnlyTransport;
+	void open() override { throw std::runtime_error("Unable to setup UART device."); }
+	void write( const uint8_t*, size_t ) override { throw std::runtime_error("Unable to write to UART device"); }
+};
+
+/// Transport taking 30ms per write, servos never answer
+struct SleepyTransport: public WriteOnlyTransport
+{
+	std::atomic<bool> writing{false};
+	std::atomic<int> writes{0};
+	using WriteOnlyTransport::WriteOnlyTransport;
+	void write( const uint8_t* data, size_t size ) override
+	{
+		writing = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		WriteOnlyTransport::write(data, size);
+		writes++;
+		writing = false;
+	}
+};
+
+UNIT_TEST(startup_error_waits_for_all_buses)
+{
+	std::vector<uint8_t> written0, written1;
+	HiwonderRpi::BusGroup group;
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new FailingTransport(written0)));
+	auto* slow = new SleepyTransport(written1);
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(slow));
+	group.assign(1, 0);
+	group.assign(2, 1);
+	
+	bool thrown = false;
+	try { HiwonderRpi::Startup::run(group, {1, 2}); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	// The slow bus finished its probe before the error was reported
+	ASSERT(!slow->writing);
+	ASSERT_EQ(slow->writes.load(), 1);
+}
+
+UNIT_TEST(discovery_reports_transport_errors)
+{
+	// The group scan reports a dead bus, instead of finding no servo on it
+	std::vector<uint8_t> written0, written1;
+	HiwonderRpi::BusGroup group;
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written0)));
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new FailingTransport(written1)));
+	HiwonderRpi::ServoDiscovery::Config config;
+	config.lastId = 3;
+	bool thrown = false;
+	try { HiwonderRpi::ServoDiscovery::scan(group, config); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	ASSERT_EQ(written0.size(), 4u*6u);
+	
+	// The bus settings are restored after the error
+	HiwonderRpi::HiwonderBus bus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new FailingTransport(written1)));
+	bus.setReplyTimeout(12345);
+	HiwonderRpi::HiwonderBus::RetryPolicy policy;
+	policy.maxRetries = 2;
+	bus.setRetryPolicy(policy);
+	HiwonderRpi::ReplyLatency::Config latency;
+	latency.enabled = true;
+	bus.getReplyLatency().setConfig(latency);
+	thrown = false;
+	try { HiwonderRpi::ServoDiscovery::probe(bus, 1); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	thrown = false;
+	try { HiwonderRpi::ServoDiscovery::scan(bus, config); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	ASSERT_EQ(bus.replyTimeout(), 12345u);
+	ASSERT_EQ((int)bus.retryPolicy().maxRetries, 2);
+	ASSERT(bus.getReplyLatency().getConfig().enabled);
+}
+
+UNIT_TEST(robotDescription_text_and_binary_forms_match)
+{
+	std::istringstream text(
+	    "# hexapod front legs\n"
+	    "bus 0 /dev/ttyAMA0 115200\n"
+	    "bus 1 /dev/ttyAMA1 115200\n"
+	    "joint front_left_coxa   1 0 100 900  0  1 500\n"
+	    "joint front_left_femur  2 0 200 800 -5 -1 600  # reversed\n"
+	    "joint front_right_coxa  3 1 100 900 12  1 500\n");
+	auto robot = HiwonderRpi::RobotDescription::fromText(text);
+	ASSERT_EQ(robot.jointCount(), 3u);
+	ASSERT_EQ(robot.busCount(), 2u);
+	
+	const auto femur = robot.find("front_left_femur");
+	ASSERT_EQ((int)femur, 1);
+	ASSERT_EQ((int)robot.joint(femur).id, 2);
+	ASSERT_EQ((int)robot.joint(femur).direction, -1);
+	ASSERT_EQ((int)robot.joint(femur).offset, -5);
+	ASSERT_EQ((int)robot.joint(femur).defaultPosition, 600);
+	ASSERT_EQ(robot.find("front_left_tibia"), HiwonderRpi::RobotDescription::InvalidHandle);
+	
+	const std::string path = "/tmp/hiwonder_ut_robot.bin";
+	robot.saveBinary(path);
+	auto compiled = HiwonderRpi::RobotDescription::loadBinary(path);
+	unlink(path.c_str());
+	ASSERT_EQ(compiled.jointCount(), 3u);
+	ASSERT_EQ(std::string(compiled.device(1)), std::string("/dev/ttyAMA1"));
+	for (HiwonderRpi::RobotDescription::Handle h=0; h<3; ++h)
+	{
+		ASSERT_EQ(compiled.find(robot.name(h)), h);
+		ASSERT_EQ((int)compiled.joint(h).bus, (int)robot.joint(h).bus);
+		ASSERT_EQ((int)compiled.joint(h).maxLimit, (int)robot.joint(h).maxLimit);
+	}
+	
+	std::istringstream invalid("joint a 1 0 100 900 0 2 500\n");
+	bool thrown = false;
+	try { HiwonderRpi::RobotDescription::fromText(invalid); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	
+	std::istringstream sameServo("joint a 1 0 100 900 0 1 500\njoint b 1 0 100 900 0 1 500\n");
+	thrown = false;
+	try { HiwonderRpi::RobotDescription::fromText(sameServo); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+	
+	// A crafted image with an offset or a handle out of range is rejected
+	std::ostringstream image;
+	robot.saveBinary(path);
+	image << std::ifstream(path, std::ios::binary).rdbuf();
+	const std::string bytes = image.str();
+	const auto rejected = [&](size_t at, uint32_t value, size_t width)
+	{
+		std::string patched = bytes;
+		std::memcpy(&patched[at], &value, width);
+		std::ofstream(path, std::ios::binary) << patched;
+		bool invalid = false;
+		try { HiwonderRpi::RobotDescription::loadBinary(path); }
+		catch (const std::runtime_error&) { invalid = true; }
+		unlink(path.c_str());
+		return invalid;
+	};
+	uint32_t jointsOffset, busesOffset, hashOffset;
+	std::memcpy(&jointsOffset, &bytes[24], 4);
+	std::memcpy(&busesOffset, &bytes[28], 4);
+	std::memcpy(&hashOffset, &bytes[32], 4);
+	ASSERT(rejected(jointsOffset+12, 100000, 4));   // joint name
+	ASSERT(rejected(busesOffset+12, 100000, 4));    // second bus device
+	ASSERT(rejected(hashOffset, 3, 2));             // handle
+	ASSERT(!rejected(24, jointsOffset, 4));
+}
+
+/// Transport answering each request with a preset reply
+struct ReplyTransport: public HiwonderRpi::HiwonderTransport
+{
+	std::vector<uint8_t> replyBytes;
+	std::vector<uint8_t> input;
+	size_t pos = 0;
+	void write( const uint8_t*, size_t ) override { input = replyBytes; pos = 0; }
+	int available() override { return static_cast<int>(input.size()-pos); }
+	int getByte() override { return pos<input.size() ? input[pos++] : -1; }
+	void discardInput() override { pos = input.size(); }
+	int baud() const override { return 115200; }
+};
+
+UNIT_TEST(nothrow_reads_return_bus_errors)
+{
+	auto* transport = new ReplyTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(transport)};
+	bus.setReplyTimeout(1000);
+	HiwonderRpi::HiwonderBusServo servo(bus, 3);
+	
+	// POS_READ reply of servo 3: position 0x01F4 (500)
+	HiwonderRpi::HiwonderBus::Buffer reply{0x55, 0x55, 3, 5, 28, 0xF4, 0x01};
+	reply[7] = HiwonderRpi::HiwonderBus::checksum(reply);
+	transport->replyBytes.assign(reply.begin(), reply.begin()+8);
+	auto position = servo.posRead(std::nothrow);
+	ASSERT(position.ok());
+	ASSERT_EQ(*position, 500);
+	ASSERT_EQ(servo.posRead(), 500);
+	
+	transport->replyBytes[7]++;
+	ASSERT(HiwonderRpi::Error::Checksum==servo.posRead(std::nothrow).error());
+	
+	auto wrongId = reply;
+	wrongId[2] = 4;
+	wrongId[7] = HiwonderRpi::HiwonderBus::checksum(wrongId);
+	transport->replyBytes.assign(wrongId.begin(), wrongId.begin()+8);
+	ASSERT(HiwonderRpi::Error::WrongId==servo.posRead(std::nothrow).error());
+	
+	// Announced size larger than any frame
+	transport->replyBytes = {0x55, 0x55, 3, 0xFF, 28, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	ASSERT(HiwonderRpi::Error::Length==servo.posRead(std::nothrow).error());
+	
+	transport->replyBytes.clear();
+	ASSERT(HiwonderRpi::Error::Timeout==servo.vinRead(std::nothrow).error());
+	ASSERT_EQ(servo.vinRead(std::nothrow).valueOr(42), 42);
+	
+	bool thrown = false;
+	try { servo.vinRead(); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+}
+
+/// Transport logging the order of the calls, servos never answer
+struct CallLogTransport: public HiwonderRpi::HiwonderTransport
+{
+	std::string log;
+	void write( const uint8_t*, size_t size ) override { log += "w" + std::to_string(size) + " "; }
+	void drain() override { log += "drain "; }
+	int available() override { return 0; }
+	int getByte() override { return -1; }
+	void discardInput() override { log += "discard "; }
+	int baud() const override { return 115200; }
+};
+
+UNIT_TEST(reads_wait_for_queued_writes_on_the_wire)
+{
+	auto* transport = new CallLogTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(transport)};
+	bus.setReplyTimeout(1000);
+	HiwonderRpi::HiwonderBusServo servo1(bus, 1);
+	HiwonderRpi::HiwonderBusServo servo2(bus, 2);
+	
+	// Both moves are sent at once, and are out before input is discarded
+	bus.hold();
+	servo1.moveTimeWrite(300);
+	servo2.moveTimeWrite(400);
+	servo1.posRead(std::nothrow);
+	ASSERT_EQ(transport->log, std::string("w20 drain discard w6 "));
+}
+
+UNIT_TEST(servoSink_sends_a_tick_in_one_write)
+{
+	auto* transport = new CallLogTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(transport)};
+	auto sink = HiwonderRpi::TrajectoryStreamer::servoSink({
+	    HiwonderRpi::HiwonderBusServo(bus, 1), HiwonderRpi::HiwonderBusServo(bus, 2), HiwonderRpi::HiwonderBusServo(bus, 3)});
+	
+	const int16_t positions[] = {100, 200, 300};
+	sink(positions, 3, 20);
+	ASSERT_EQ(transport->log, std::string("w30 "));
+	
+	// Writes after the tick are not held
+	HiwonderRpi::HiwonderBusServo(bus, 1).moveTimeWrite(150);
+	ASSERT_EQ(transport->log, std::string("w30 w10 "));
+}
+
+/// Input stream giving one line at a time, as a pipe fed over time, and
+///     keeping what the transport had sent when each line was requested
+struct LineByLineInput: public std::streambuf
+{
+	std::vector<std::string> lines;
+	std::vector<std::string> sentAtRequest;
+	const CallLogTransport* transport = nullptr;
+	std::string current;
+	size_t next = 0;
+	int_type underflow() override
+	{
+		if (gptr()<egptr()) return traits_type::to_int_type(*gptr());
+		if (next>=lines.size()) return traits_type::eof();
+		sentAtRequest.push_back(transport->log);
+		current = lines[next++];
+		setg(&current[0], &current[0], &current[0]+current.size());
+		return traits_type::to_int_type(current[0]);
+	}
+};
+
+UNIT_TEST(batch_sends_streamed_moves_before_waiting_for_input)
+{
+	auto* transport = new CallLogTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(transport)};
+	bus.setReplyTimeout(1000);
+	std::ostringstream out;
+	
+	// Each move is on the wire before the next line is read
+	LineByLineInput input;
+	input.transport = transport;
+	input.lines = {"move 1 100\n", "move 1 200 # same servo\n", "move 300 0\n", "read_position 1\n"};
+	std::istream streamed(&input);
+	ASSERT_EQ(HiwonderRpi::Batch::run(bus, streamed, out), 2u);
+	ASSERT_EQ(input.sentAtRequest.size(), 4u);
+	ASSERT_EQ(input.sentAtRequest[1], std::string("w10 "));
+	ASSERT_EQ(input.sentAtRequest[2], std::string("w10 w10 "));
+	ASSERT_EQ(transport->log, std::string("w10 w10 drain discard w6 "));
+	// One error per bad line: the servo id out of range, and the missing reply
+	ASSERT(out.str().find("line 3: invalid servo id 300")!=std::string::npos);
+	ASSERT(out.str().find("line 4: no valid reply")!=std::string::npos);
+	
+	// Buffered lines are sent together (and the moves coalesced) ...
+	transport->log.clear();
+	std::istringstream buffered("move 2 100\nmove 2 200\nmove 3 200\n");
+	ASSERT_EQ(HiwonderRpi::Batch::run(bus, buffered, out), 0u);
+	ASSERT_EQ(transport->log, std::string("w20 "));
+	
+	// ... unless typed on a terminal
+	transport->log.clear();
+	std::istringstream typed("move 2 300\nmove 2 400\n");
+	ASSERT_EQ(HiwonderRpi::Batch::run(bus, typed, out, true), 0u);
+	ASSERT_EQ(transport->log, std::string("w10 w10 "));
+}
+
+UNIT_TEST(broadcast_unload_forgets_the_last_moves)
+{
+	using LoadMode = HiwonderRpi::HiwonderBusServo::LoadMode;
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	sim->addServo(1);
+	sim->addServo(2);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	HiwonderRpi::HiwonderBusServo servo1(bus, 1);
+	HiwonderRpi::HiwonderBusServo servo2(bus, 2);
+	HiwonderRpi::HiwonderBusServo all(bus, HiwonderRpi::HiwonderBus::BroadcastId);
+	
+	servo1.moveTimeWrite(300);
+	servo2.moveTimeWrite(400);
+	all.loadOrUnloadWrite(LoadMode::Unload);
+	
+	// The same moves are sent again after the unload
+	const auto sent = bus.stats().sent;
+	servo1.moveTimeWrite(300);
+	servo2.moveTimeWrite(400);
+	ASSERT_EQ(bus.stats().sent, sent+2);
+}
+
+UNIT_TEST(only_idempotent_pending_writes_are_coalesced)
+{
+	std::vector<uint8_t> written;
+	HiwonderRpi::HiwonderBus bus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(new WriteOnlyTransport(written)));
+	HiwonderRpi::HiwonderBusServo servo1(bus, 1);
+	HiwonderRpi::HiwonderBusServo servo2(bus, 2);
+	
+	// Each waiting move is started before the next one
+	bus.hold();
+	servo1.moveTimeWaitWrite(300, 0);
+	servo1.moveStart();
+	servo1.moveTimeWaitWrite(400, 0);
+	servo1.moveStart();
+	bus.flush();
+	ASSERT_EQ(bus.stats().coalesced, 0u);
+	ASSERT_EQ(bus.stats().sent, 4u);
+	
+	// The offset is adjusted before being saved
+	written.clear();
+	bus.hold();
+	servo1.angleOffsetAdjust(5);
+	servo1.angleOffsetWrite();
+	servo1.angleOffsetAdjust(6);
+	bus.flush();
+	ASSERT_EQ(written.size(), 7u+6u+7u);
+	ASSERT_EQ((int)written[4], 17);
+	ASSERT_EQ((int)written[7+4], 18);
+	
+	// Moves are merged across other servos, not across a frame of the same servo
+	bus.hold();
+	servo1.moveTimeWrite(300);
+	servo2.moveTimeWrite(300);
+	servo1.moveTimeWrite(310);
+	servo1.moveStop();
+	servo1.moveTimeWrite(320);
+	bus.flush();
+	ASSERT_EQ(bus.stats().coalesced, 1u);
+}
+
+UNIT_TEST(simulator_answers_like_a_servo)
+{
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	sim->addServo(5);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	HiwonderRpi::HiwonderBusServo servo(bus, 5);
+	
+	servo.angleLimitWrite(100, 900);
+	servo.moveTimeWrite(950);
+	ASSERT_EQ(servo.posRead(), 900);
+	ASSERT_EQ(servo.angleLimitRead().maxLimit, 900);
+	ASSERT_EQ((int)servo.idRead(), 5);
+	ASSERT_EQ(servo.vinRead(), 7400);
+	
+	HiwonderRpi::HiwonderBusServo missing(bus, 6);
+	bus.setReplyTimeout(1000);
+	ASSERT(HiwonderRpi::Error::Timeout==missing.posRead(std::nothrow).error());
+}
+
+UNIT_TEST(allocationGuard_counts_allocations)
+{
+	void* (*volatile allocate)(size_t) = &::operator new;
+	AllocationGuard guard;
+	void* ptr = allocate(16);
+	ASSERT_EQ(guard.count(), 1u);
+	::operator delete(ptr);
+}
+
+UNIT_TEST(steady_state_servo_cycle_does_not_allocate)
+{
+	constexpr uint8_t Servos = 6;
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	std::vector<HiwonderRpi::HiwonderBusServo> servos;
+	for (uint8_t i=1; i<=Servos; ++i)
+	{
+		sim->addServo(i);
+		servos.emplace_back(bus, i);
+	}
+	
+	auto cycle = [&](int n)
+	{
+		int errors = 0;
+		bus.hold();
+		for (auto& servo: servos) servo.moveTimeWrite(static_cast<int16_t>(400+n%200), 20);
+		bus.flush();
+		for (auto& servo: servos)
+		{
+			errors += servo.posRead(std::nothrow) ? 0 : 1;
+			errors += servo.vinRead() ? 0 : 1;
+			errors += servo.tempRead(std::nothrow) ? 0 : 1;
+		}
+		servos[0].loadOrUnloadWrite(HiwonderRpi::HiwonderBusServo::LoadMode::Load);
+		servos[1].ledCtrlWrite(HiwonderRpi::HiwonderBusServo::PowerLed::On);
+		return errors;
+	};
+	
+	cycle(0); // Setup: first use
+	AllocationGuard guard;
+	int errors = 0;
+	for (int n=1; n<200; ++n) errors += cycle(n);
+	ASSERT_EQ(guard.count(), 0u);
+	ASSERT_EQ(errors, 0);
+}
+
+UNIT_TEST(steady_state_group_cycle_does_not_allocate)
+{
+	HiwonderRpi::BusGroup group;
+	HiwonderRpi::SimulatedTransport* sims[2];
+	for (auto& sim: sims)
+	{
+		sim = new HiwonderRpi::SimulatedTransport();
+		group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim));
+	}
+	const uint8_t ids[] = {1, 2, 3, 4, 5, 6};
+	int16_t positions[] = {100, 200, 300, 400, 500, 600};
+	for (auto id: ids)
+	{
+		sims[id%2]->addServo(id);
+		group.assign(id, id%2);
+	}
+	HiwonderRpi::ServoTelemetry telemetry[6];
+	
+	group.moveTimeWrite(ids, positions, 6, 0);
+	group.poll(ids, 6, telemetry);
+	AllocationGuard guard;
+	for (int n=0; n<100; ++n)
+	{
+		for (auto& p: positions) p = static_cast<int16_t>(100+(p+7)%800);
+		group.moveTimeWrite(ids, positions, 6, 0);
+		group.poll(ids, 6, telemetry, HiwonderRpi::ServoTelemetry::Position);
+	}
+	ASSERT_EQ(guard.count(), 0u);
+	for (size_t i=0; i<6; ++i)
+	{
+		ASSERT(telemetry[i].valid);
+		ASSERT_EQ(telemetry[i].position, positions[i]);
+	}
+}
+
+/// Simulated bus losing the next <drop> replies
+struct DroppingTransport: public HiwonderRpi::SimulatedTransport
+{
+	int drop = 0;
+	void write( const uint8_t* data, size_t size ) override
+	{
+		SimulatedTransport::write(data, size);
+		if (drop>0 && available()>0)
+		{
+			--drop;
+			discardInput();
+		}
+	}
+};
+
+UNIT_TEST(lost_replies_are_retried_with_backoff)
+{
+	auto* sim = new DroppingTransport();
+	sim->addServo(1);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	bus.setReplyTimeout(500);
+	HiwonderRpi::HiwonderBus::RetryPolicy policy;
+	policy.maxRetries = 3;
+	policy.backoffUs = 100;
+	bus.setRetryPolicy(policy);
+	HiwonderRpi::HiwonderBusServo servo(bus, 1);
+	
+	sim->drop = 2;
+	ASSERT(servo.posRead(std::nothrow).ok());
+	ASSERT_EQ(bus.stats().retries, 2u);
+	ASSERT_EQ(bus.stats().timeouts, 2u);
+	
+	sim->drop = 4;
+	ASSERT(HiwonderRpi::Error::Timeout==servo.posRead(std::nothrow).error());
+	ASSERT_EQ(bus.stats().retries, 5u);
+}
+
+UNIT_TEST(lost_replies_cost_at_most_the_budget)
+{
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	bus.setReplyTimeout(2000);
+	HiwonderRpi::HiwonderBus::RetryPolicy policy;
+	policy.maxRetries = 100;
+	policy.backoffUs = 200;
+	policy.transactionBudgetUs = 3000;
+	policy.cycleBudgetUs = 7000;
+	bus.setRetryPolicy(policy);
+	HiwonderRpi::HiwonderBusServo missing(bus, 9);
+	
+	// The transaction budget stops the retries: one retry fits in 3ms (2ms
+	//     timeout, 0.2ms backoff), the second one would start after the limit
+	bus.startCycle();
+	const auto start = std::chrono::steady_clock::now();
+	ASSERT(HiwonderRpi::Error::Timeout==missing.posRead(std::nothrow).error());
+	const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+	ASSERT(elapsedUs>=3000);
+	ASSERT_EQ(bus.stats().overBudget, 1u);
+	ASSERT(bus.stats().retries<=1u);
+	ASSERT_EQ(bus.stats().timeouts, bus.stats().retries+1u);
+	ASSERT_EQ(bus.stats().sent, bus.stats().timeouts);
+	
+	// Two more reads exhaust the cycle budget, next ones are not sent
+	missing.posRead(std::nothrow);
+	missing.posRead(std::nothrow);
+	const auto sent = bus.stats().sent;
+	ASSERT(HiwonderRpi::Error::Budget==missing.posRead(std::nothrow).error());
+	ASSERT_EQ(bus.stats().sent, sent);
+	ASSERT(bus.cycleTimeUs()>=7000);
+	
+	bus.startCycle();
+	ASSERT(HiwonderRpi::Error::Timeout==missing.posRead(std::nothrow).error());
+}
+
+/// Simulated bus where servos answer after <delayUs>
+struct SlowTransport: public HiwonderRpi::SimulatedTransport
+{
+	int64_t delayUs = 0;
+	std::chrono::steady_clock::time_point sentAt;
+	void write( const uint8_t* data, size_t size ) override
+	{
+		SimulatedTransport::write(data, size);
+		sentAt = std::chrono::steady_clock::now();
+	}
+	int available() override
+	{
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-sentAt);
+		return elapsed.count()>=delayUs ? SimulatedTransport::available() : 0;
+	}
+};
+
+UNIT_TEST(reply_timeouts_adapt_to_servo_latency)
+{
+	auto* sim = new SlowTransport();
+	sim->delayUs = 3000; // 1.2ms on the wire at 115200 bauds, 1.8ms turnaround
+	sim->addServo(1);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	HiwonderRpi::ReplyLatency::Config config;
+	config.enabled = true;
+	bus.getReplyLatency().setConfig(config);
+	HiwonderRpi::HiwonderBusServo servo(bus, 1);
+	
+	for (int i=0; i<50; ++i) ASSERT(servo.posRead(std::nothrow).ok());
+	const auto& learnt = bus.getReplyLatency().servo(1);
+	ASSERT_EQ(learnt.samples, 50u);
+	ASSERT(learnt.meanUs>1000.f);
+	
+	// A lost reply now costs the learnt timeout, not the 20ms default
+	const uint32_t timeoutUs = bus.getReplyLatency().timeoutUs(1, 0, bus.replyTimeout());
+	ASSERT(timeoutUs>=1000u && timeoutUs<bus.replyTimeout());
+	sim->removeServo(1);
+	const auto start = std::chrono::steady_clock::now();
+	ASSERT(HiwonderRpi::Error::Timeout==servo.posRead(std::nothrow).error());
+	const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+	ASSERT(elapsedUs>=timeoutUs);
+	ASSERT_EQ(bus.stats().timeouts, 1u);
+}
+
+UNIT_TEST(servos_not_answering_are_degraded)
+{
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	bus.setReplyTimeout(500);
+	HiwonderRpi::ReplyLatency::Config config;
+	config.enabled = true;
+	config.degradeAfter = 3;
+	config.degradedInterval = 10;
+	bus.getReplyLatency().setConfig(config);
+	HiwonderRpi::HiwonderBusServo servo(bus, 2);
+	
+	for (int i=0; i<3; ++i) ASSERT(HiwonderRpi::Error::Timeout==servo.posRead(std::nothrow).error());
+	ASSERT(bus.getReplyLatency().servo(2).degraded);
+	
+	const auto sent = bus.stats().sent;
+	for (int i=0; i<9; ++i) ASSERT(HiwonderRpi::Error::Degraded==servo.posRead(std::nothrow).error());
+	ASSERT_EQ(bus.stats().sent, sent);
+	ASSERT_EQ(bus.stats().skipped, 9u);
+	
+	// Every 10th read is sent: the servo is back
+	sim->addServo(2);
+	ASSERT(servo.posRead(std::nothrow).ok());
+	ASSERT(!bus.getReplyLatency().servo(2).degraded);
+}
+
+UNIT_TEST(busBudget_keeps_motion_time_and_defers_telemetry)
+{
+	// 115200 bauds: a move frame is 868us, a position read 1215us + turnaround
+	HiwonderRpi::BusTimeModel model(115200, nullptr, 500);
+	ASSERT_EQ(model.writeUs(1), 868u);
+	ASSERT_EQ(model.readUs(1, 5), 1215u+500u);
+	
+	HiwonderRpi::BusBudget budget(model, 10000);
+	budget.startCycle();
+	ASSERT(budget.planWrite(6)); // 5208us of motion
+	using Decision = HiwonderRpi::BusBudget::Decision;
+	ASSERT(Decision::Accept==budget.admitTelemetry(1, HiwonderRpi::ServoTelemetry::Position));
+	ASSERT(Decision::Accept==budget.admitTelemetry(2, HiwonderRpi::ServoTelemetry::Position));
+	ASSERT(Decision::Defer==budget.admitTelemetry(3, HiwonderRpi::ServoTelemetry::Position));
+	ASSERT(Decision::Reject==budget.admitTelemetry(3, HiwonderRpi::ServoTelemetry::All));
+	ASSERT(budget.remainingUs()<1715u);
+	
+	budget.endCycle(8000);
+	ASSERT(budget.stats().plannedUtilisation>0.85f && budget.stats().plannedUtilisation<0.9f);
+	ASSERT(budget.stats().utilisation>0.79f && budget.stats().utilisation<0.81f);
+	ASSERT_EQ(budget.stats().deferred, 1u);
+	ASSERT_EQ(budget.stats().rejected, 1u);
+	
+	// Motion alone over the cycle is reported as overrun
+	budget.startCycle();
+	ASSERT(!budget.planWrite(12));
+	budget.endCycle(10000);
+	ASSERT_EQ(budget.stats().overruns, 1u);
+}
+
+UNIT_TEST(busBudget_measures_bus_utilisation)
+{
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	sim->addServo(1);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	HiwonderRpi::HiwonderBusServo servo(bus, 1);
+	HiwonderRpi::BusTimeModel model(bus);
+	HiwonderRpi::BusBudget budget(model, 10000);
+	
+	budget.startCycle(bus);
+	budget.planWrite(1);
+	servo.moveTimeWrite(300);
+	budget.endCycle(bus);
+	ASSERT(budget.stats().utilisation>0.08f && budget.stats().utilisation<0.09f);
+}
+
+UNIT_TEST(busGroup_polls_the_load_state)
+{
+	HiwonderRpi::BusGroup group;
+	auto sim = new HiwonderRpi::SimulatedTransport();
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim));
+	const uint8_t ids[] = {1, 2};
+	for (auto id: ids)
+	{
+		sim->addServo(id);
+		group.assign(id, 0);
+	}
+	sim->servo(2).load = 0;
+	
+	HiwonderRpi::ServoTelemetry telemetry[2];
+	group.poll(ids, 2, telemetry, HiwonderRpi::ServoTelemetry::Load);
+	ASSERT(telemetry[0].valid && telemetry[0].loaded);
+	ASSERT(telemetry[1].valid && !telemetry[1].loaded);
+	
+	// Fields not requested are not read
+	ASSERT_EQ(telemetry[0].vin, 0u);
+	group.poll(ids, 2, telemetry);
+	ASSERT_EQ(telemetry[0].vin, 7400u);
+}
+
+UNIT_TEST(busExecutor_runs_most_urgent_class_first)
+{
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(new HiwonderRpi::SimulatedTransport())};
+	HiwonderRpi::BusExecutor executor(bus);
+	using Priority = HiwonderRpi::BusExecutor::Priority;
+	
+	std::atomic<bool> release{false};
+	std::vector<int> order;
+	executor.post([&release](HiwonderRpi::HiwonderBus&){ while (!release) continue; }, Priority::Telemetry);
+	for (int i=0; i<3; ++i) executor.post([&order](HiwonderRpi::HiwonderBus&){ order.push_back(2); }, Priority::Telemetry);
+	executor.post([&order](HiwonderRpi::HiwonderBus&){ order.push_back(1); }, Priority::Motion);
+	executor.post([&order](HiwonderRpi::HiwonderBus&){ order.push_back(0); }, Priority::Emergency);
+	release = true;
+	executor.wait();
+	
+	ASSERT_EQ(order.size(), 5u);
+	ASSERT_EQ(order[0], 0);
+	ASSERT_EQ(order[1], 1);
+	ASSERT_EQ(order[4], 2);
+	ASSERT_EQ(executor.stats(Priority::Telemetry).jobs, 4u);
+	ASSERT_EQ(executor.stats(Priority::Emergency).jobs, 1u);
+}
+
+/// Slow simulated bus logging the commands sent
+struct CommandLogTransport: public SlowTransport
+{
+	std::vector<uint8_t> commands;
+	std::atomic<size_t> sent{0};
+	void write( const uint8_t* data, size_t size ) override
+	{
+		SlowTransport::write(data, size);
+		commands.push_back(data[4]);
+		sent++;
+	}
+};
+
+UNIT_TEST(emergency_unload_preempts_a_running_poll)
+{
+	constexpr size_t Servos = 20;
+	auto* sim = new CommandLogTransport();
+	sim->delayUs = 5000;
+	HiwonderRpi::BusGroup group;
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim));
+	uint8_t ids[Servos];
+	for (size_t i=0; i<Servos; ++i)
+	{
+		ids[i] = static_cast<uint8_t>(i+1);
+		sim->addServo(ids[i]);
+		group.assign(ids[i], 0);
+	}
+	
+	// The poll takes about 100ms, the unload is requested during its first reads
+	HiwonderRpi::ServoTelemetry telemetry[Servos];
+	std::thread poller([&]{ group.poll(ids, Servos, telemetry, HiwonderRpi::ServoTelemetry::Position); });
+	while (sim->sent<2) std::this_thread::yield();
+	group.emergencyUnload();
+	poller.join();
+	
+	// Sent after the read in progress, not after the whole poll
+	ASSERT_EQ(sim->commands.size(), Servos+1);
+	const size_t unloadAt = std::find(sim->commands.begin(), sim->commands.end(), 31)-sim->commands.begin();
+	ASSERT(unloadAt>=2 && unloadAt<Servos);
+	for (auto id: ids) ASSERT_EQ((int)sim->servo(id).load, 0);
+	for (const auto& t: telemetry) ASSERT(t.valid);
+	const auto stats = group.getExecutor(0).stats(HiwonderRpi::BusExecutor::Priority::Emergency);
+	ASSERT_EQ(stats.jobs, 1u);
+}
+
+UNIT_TEST(motionRecording_plays_back_recorded_frames)
+{
+	const std::string path = "/tmp/hiwonder_ut_motion.bin";
+	const std::vector<uint8_t> ids = {3, 7, 9};
+	{
+		HiwonderRpi::MotionRecorder recorder(path, ids, 10000);
+		for (int16_t n=0; n<5; ++n)
+		{
+			const int16_t frame[] = {static_cast<int16_t>(100+n), static_cast<int16_t>(200+n), static_cast<int16_t>(300+n)};
+			recorder.append(frame);
+		}
+		ASSERT_EQ(recorder.frameCount(), 5u);
+		recorder.close();
+	}
+	
+	// Truncated frames (interrupted recording) are ignored
+	{
+		std::ofstream out(path, std::ios::binary|std::ios::app);
+		out.put(1);
+	}
+	auto recording = HiwonderRpi::MotionRecording::load(path);
+	unlink(path.c_str());
+	ASSERT_EQ(recording.periodUs(), 10000u);
+	ASSERT_EQ(recording.servoCount(), 3u);
+	ASSERT_EQ((int)recording.ids()[1], 7);
+	ASSERT_EQ(recording.frameCount(), 5u);
+	ASSERT_EQ(recording.frame(2)[2], 302);
+	
+	HiwonderRpi::BusGroup group;
+	auto sim = new HiwonderRpi::SimulatedTransport();
+	group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim));
+	for (auto id: ids)
+	{
+		sim->addServo(id);
+		group.assign(id, 0);
+	}
+	const auto start = std::chrono::steady_clock::now();
+	const auto stats = recording.play(group);
+	const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+	// One cycle per frame, less the frames of missed wakeups
+	ASSERT(stats.cycles>=1u && stats.cycles<=5u);
+	ASSERT_EQ(stats.cycles+stats.missed, 5u);
+	ASSERT(elapsedUs>=40000);
+	ASSERT_EQ(sim->servo(3).target, 104);
+	ASSERT_EQ(sim->servo(9).target, 304);
+	ASSERT_EQ(sim->servo(9).moveTimeMs, 10);
+	
+	bool thrown = false;
+	try { HiwonderRpi::MotionRecording::load("/tmp/hiwonder_ut_missing.bin"); }
+	catch (const std::runtime_error&) { thrown = true; }
+	ASSERT(thrown);
+}
+
+UNIT_TEST(telemetryLog_round_trips_and_is_compact)
+{
+	const std::string path = "/tmp/hiwonder_ut_telemetry.log";
+	const std::vector<uint8_t> ids = {1, 2, 3, 4, 5, 6};
+	constexpr size_t Samples = 2000;
+	std::vector<HiwonderRpi::ServoTelemetry> expected(Samples*ids.size());
+	for (size_t i=0; i<Samples; ++i)
+	{
+		for (size_t s=0; s<ids.size(); ++s)
+		{
+			auto& t = expected[i*ids.size()+s];
+			t.position = static_cast<int16_t>(500+300*std::sin(i*0.01+s));
+			t.vin = static_cast<uint16_t>(7400-i/100);
+			t.temp = static_cast<uint8_t>(30+i/500);
+			t.loaded = s!=2;
+			t.valid = (i+s)%97!=0;
+		}
+	}
+	
+	HiwonderRpi::TelemetryLogWriter::Config config;
+	config.keyframeInterval = 100;
+	config.queueSamples = Samples;
+	HiwonderRpi::TelemetryLogWriter writer(path, ids, config);
+	{
+		AllocationGuard guard;
+		for (size_t i=0; i<Samples; ++i)
+		{
+			ASSERT(writer.append(1000000+i*10000, &expected[i*ids.size()]));
+		}
+		ASSERT_EQ(guard.count(), 0u);
+	}
+	writer.close();
+	ASSERT_EQ(writer.dropped(), 0u);
+	
+	HiwonderRpi::TelemetryLogReader reader(path);
+	ASSERT_EQ(reader.ids().size(), ids.size());
+	ASSERT_EQ(reader.sampleCount(), Samples);
+	ASSERT_EQ(reader.blockCount(), Samples/100);
+	ASSERT_EQ(reader.startUs(), 1000000u);
+	ASSERT_EQ(reader.endUs(), 1000000u+(Samples-1)*10000u);
+	
+	size_t n = 0;
+	bool same = true;
+	reader.read(0, reader.endUs(), [&](uint64_t us, const HiwonderRpi::ServoTelemetry* telemetry)
+	{
+		same = same && us==1000000u+n*10000u;
+		for (size_t s=0; s<ids.size(); ++s)
+		{
+			const auto& a = telemetry[s];
+			const auto& b = expected[n*ids.size()+s];
+			same = same && a.position==b.position && a.vin==b.vin && a.temp==b.temp &&
+			    a.valid==b.valid && a.loaded==b.loaded;
+		}
+		++n;
+	});
+	ASSERT(same);
+	ASSERT_EQ(n, Samples);
+	
+	// Range query: only the overlapping blocks are decoded
+	n = 0;
+	uint64_t first = 0;
+	reader.read(5005000, 6000000, [&](uint64_t us, const HiwonderRpi::ServoTelemetry*){ if (!n++) first = us; });
+	ASSERT_EQ(first, 5010000u);
+	ASSERT_EQ(n, 100u);
+	
+	std::ostringstream csv;
+	reader.exportCsv(csv);
+	ASSERT(writer.bytes()*10<csv.str().size());
+	unlink(path.c_str());
+}
+
+UNIT_TEST(telemetryLog_drops_samples_instead_of_blocking)
+{
+	const std::string path = "/tmp/hiwonder_ut_telemetry_drop.log";
+	HiwonderRpi::TelemetryLogWriter::Config config;
+	config.queueSamples = 4;
+	config.idleMs = 1000;
+	HiwonderRpi::TelemetryLogWriter writer(path, {1}, config);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	HiwonderRpi::ServoTelemetry telemetry;
+	for (uint64_t i=0; i<10; ++i) writer.append(i, &telemetry);
+	ASSERT_EQ(writer.dropped(), 6u);
+	writer.close();
+	
+	HiwonderRpi::TelemetryLogReader reader(path);
+	ASSERT_EQ(reader.sampleCount(), 4u);
+	unlink(path.c_str());
+}
+
+/// Operations of a captured session, returning the values read
+static std::vector<int> traceSession( HiwonderRpi::HiwonderBus& bus )
+{
+	std::vector<int> values;
+	const auto result = [&](auto read){ values.push_back(read.ok() ? static_cast<int>(*read) : -static_cast<int>(read.error())); };
+	// Far above the 3ms replies: only the missing servo times out, however loaded the machine
+	bus.setReplyTimeout(20000);
+	HiwonderRpi::HiwonderBusServo(bus, 2).moveTimeWrite(321, 0);
+	result(HiwonderRpi::HiwonderBusServo(bus, 1).posRead(std::nothrow));
+	result(HiwonderRpi::HiwonderBusServo(bus, 2).posRead(std::nothrow));
+	result(HiwonderRpi::HiwonderBusServo(bus, 5).posRead(std::nothrow)); // missing
+	result(HiwonderRpi::HiwonderBusServo(bus, 3).tempRead(std::nothrow));
+	result(HiwonderRpi::HiwonderBusServo(bus, 1).vinRead(std::nothrow));
+	return values;
+}
+
+UNIT_TEST(trace_replays_captured_traffic_with_its_timing)
+{
+	const std::string path = "/tmp/hiwonder_ut_trace.bin";
+	using Clock = std::chrono::steady_clock;
+	const auto elapsedUs = [](Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-start).count();
+	};
+	
+	std::vector<int> captured;
+	{
+		auto* sim = new SlowTransport();
+		sim->delayUs = 3000;
+		for (uint8_t id=1; id<=3; ++id) sim->addServo(id);
+		auto* recorder = new HiwonderRpi::TraceRecorder(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim), path);
+		HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(recorder)};
+		captured = traceSession(bus);
+		recorder->flush();
+	}
+	ASSERT_EQ(captured[1], 321);
+	ASSERT_EQ(captured[2], -static_cast<int>(HiwonderRpi::Error::Timeout));
+	
+	// Same replies, never before their captured delay (at least 3ms): same results,
+	//     and the session lasts at least the 4 replies and the timeout
+	{
+		auto* replay = new HiwonderRpi::TraceReplay(path);
+		HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(replay)};
+		const auto start = Clock::now();
+		ASSERT(traceSession(bus)==captured);
+		ASSERT(elapsedUs(start)>=4*3000+20000);
+		ASSERT_EQ(bus.stats().timeouts, 1u);
+		ASSERT(replay->finished());
+		ASSERT_EQ(replay->stats().mismatches, 0u);
+		ASSERT_EQ(replay->stats().writes, 6u);
+	}
+	
+	// Immediate replies: the same session, only the missing servo times out
+	{
+		auto* replay = new HiwonderRpi::TraceReplay(path, HiwonderRpi::TraceReplay::Timing::Immediate);
+		HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(replay)};
+		ASSERT(traceSession(bus)==captured);
+		ASSERT_EQ(bus.stats().timeouts, 1u);
+		ASSERT(replay->finished());
+	}
+	
+	// The first reply is held back for its captured delay, or not at all
+	HiwonderRpi::HiwonderBus::Buffer move{0x55, 0x55, 2, 7, 1, 0x41, 0x01, 0, 0};
+	move[9] = HiwonderRpi::HiwonderBus::checksum(move);
+	HiwonderRpi::HiwonderBus::Buffer posRead{0x55, 0x55, 1, 3, 28};
+	posRead[5] = HiwonderRpi::HiwonderBus::checksum(posRead);
+	for (auto timing: {HiwonderRpi::TraceReplay::Timing::Original, HiwonderRpi::TraceReplay::Timing::Immediate})
+	{
+		HiwonderRpi::TraceReplay replay(path, timing);
+		replay.write(move.data(), 10);
+		const auto start = Clock::now();
+		replay.write(posRead.data(), 6);
+		const bool arrived = replay.available()>0;
+		const bool immediate = HiwonderRpi::TraceReplay::Timing::Immediate==timing;
+		ASSERT_EQ(replay.stats().mismatches, 0u);
+		ASSERT(immediate ? arrived : !arrived || elapsedUs(start)>=3000);
+	}
+	
+	// A different request is reported
+	{
+		auto* replay = new HiwonderRpi::TraceReplay(path, HiwonderRpi::TraceReplay::Timing::Immediate);
+		HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(replay)};
+		HiwonderRpi::HiwonderBusServo(bus, 2).moveTimeWrite(322, 0);
+		ASSERT_EQ(replay->stats().mismatches, 1u);
+	}
+	unlink(path.c_str());
+}
+
+UNIT_TEST(trace_replay_drops_replies_discarded_in_the_capture)
+{
+	using Kind = HiwonderRpi::TraceFormat::Kind;
+	using Buffer = HiwonderRpi::HiwonderBus::Buffer;
+	const std::string path = "/tmp/hiwonder_ut_trace_discard.bin";
+	const auto reply = [](int16_t position)
+	{
+		Buffer buf{0x55, 0x55, 1, 5, 28, static_cast<uint8_t>(position&0xFF), static_cast<uint8_t>(position>>8)};
+		buf[7] = HiwonderRpi::HiwonderBus::checksum(buf);
+		return std::vector<uint8_t>(buf.begin(), buf.begin()+8);
+	};
+	Buffer request{0x55, 0x55, 1, 3, 28};
+	request[5] = HiwonderRpi::HiwonderBus::checksum(request);
+	
+	// Field failure: the reply to the first request comes after its timeout,
+	//     is discarded before the retry, and the retry gets a newer position
+	{
+		std::ofstream out(path, std::ios::binary);
+		HiwonderRpi::TraceFormat::Header header{};
+		std::memcpy(header.magic, HiwonderRpi::TraceFormat::Magic, sizeof(header.magic));
+		header.baud = 115200;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		const auto event = [&](uint64_t timeUs, Kind kind, const std::vector<uint8_t>& bytes)
+		{
+			HiwonderRpi::TraceFormat::EventHeader head{};
+			head.timeUs = timeUs;
+			head.size = static_cast<uint16_t>(bytes.size());
+			head.kind = kind;
+			out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+			out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		};
+		const std::vector<uint8_t> requestBytes(request.begin(), request.begin()+6);
+		event(0, Kind::Tx, requestBytes);
+		event(25000, Kind::Rx, reply(100));
+		event(25000, Kind::Discard, {});
+		event(25010, Kind::Tx, requestBytes);
+		event(25500, Kind::Rx, reply(200));
+	}
+	
+	// The replay times out and retries earlier than the capture did: the late
+	//     reply is not due yet at the discard, but it was discarded in the field
+	auto* replay = new HiwonderRpi::TraceReplay(path);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(replay)};
+	bus.setReplyTimeout(5000);
+	HiwonderRpi::HiwonderBus::RetryPolicy policy;
+	policy.maxRetries = 1;
+	policy.backoffUs = 1000;
+	bus.setRetryPolicy(policy);
+	unlink(path.c_str());
+	
+	const int16_t position = HiwonderRpi::HiwonderBusServo(bus, 1).posRead(std::nothrow).valueOr(-1);
+	ASSERT_EQ(position, 200);
+	ASSERT_EQ(bus.stats().retries, 1u);
+	ASSERT_EQ(replay->stats().mismatches, 0u);
+	ASSERT_EQ(replay->stats().rxBytes, 8u);
+	ASSERT(replay->finished());
+	
+	// The recorder writes the discards of the bus
+	{
+		auto* sim = new HiwonderRpi::SimulatedTransport();
+		sim->addServo(1);
+		auto* recorder = new HiwonderRpi::TraceRecorder(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim), path);
+		HiwonderRpi::HiwonderBus recorded{std::unique_ptr<HiwonderRpi::HiwonderTransport>(recorder)};
+		HiwonderRpi::HiwonderBusServo(recorded, 1).posRead();
+		// Discard, request, reply
+		ASSERT_EQ(recorder->eventCount(), 3u);
+	}
+	unlink(path.c_str());
+}
+
+UNIT_TEST(simulator_injects_each_fault)
+{
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	sim->addServo(1);
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	bus.setReplyTimeout(3000);
+	HiwonderRpi::HiwonderBusServo servo(bus, 1);
+	using Error = HiwonderRpi::Error;
+	const auto withFault = [&](float HiwonderRpi::SimulatedTransport::Faults::*fault, uint32_t delayUs=0)
+	{
+		HiwonderRpi::SimulatedTransport::Faults faults;
+		faults.*fault = 1.f;
+		faults.delayUs = delayUs;
+		sim->setFaults(faults);
+		const auto result = servo.posRead(std::nothrow).error();
+		sim->setFaults(HiwonderRpi::SimulatedTransport::Faults());
+		return result;
+	};
+	
+	ASSERT(Error::Timeout==withFault(&HiwonderRpi::SimulatedTransport::Faults::silent));
+	ASSERT(Error::Timeout==withFault(&HiwonderRpi::SimulatedTransport::Faults::dropByte));
+	ASSERT(Error::Checksum==withFault(&HiwonderRpi::SimulatedTransport::Faults::flipChecksum));
+	ASSERT(Error::None!=withFault(&HiwonderRpi::SimulatedTransport::Faults::garbage));
+	ASSERT(Error::None==withFault(&HiwonderRpi::SimulatedTransport::Faults::duplicate));
+	ASSERT(Error::None==withFault(&HiwonderRpi::SimulatedTransport::Faults::delay, 1000));
+	ASSERT(Error::Timeout==withFault(&HiwonderRpi::SimulatedTransport::Faults::delay, 5000));
+	ASSERT(sim->stats().faults>=7u);
+	
+	// Nothing left behind: the late reply is discarded before the next request
+	std::this_thread::sleep_for(std::chrono::milliseconds(3));
+	ASSERT(servo.posRead(std::nothrow).ok());
+	ASSERT(servo.vinRead(std::nothrow).ok());
+}
+
+UNIT_TEST(stress_driver_under_injected_faults)
+{
+	constexpr uint8_t Servos = 4;
+	constexpr int Reads = 2000;
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	for (uint8_t id=1; id<=Servos; ++id) sim->addServo(id);
+	HiwonderRpi::SimulatedTransport::Faults faults;
+	faults.dropByte = 0.002f;
+	faults.flipChecksum = 0.01f;
+	faults.garbage = 0.01f;
+	faults.delay = 0.01f;
+	faults.delayUs = 3000;
+	faults.duplicate = 0.01f;
+	faults.silent = 0.01f;
+	sim->setFaults(faults);
+	
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	bus.setReplyTimeout(2000);
+	HiwonderRpi::HiwonderBus::RetryPolicy policy;
+	policy.maxRetries = 3;
+	policy.backoffUs = 200;
+	policy.transactionBudgetUs = 10000;
+	bus.setRetryPolicy(policy);
+	
+	HiwonderRpi::ReplyLatency::Config latency;
+	latency.enabled = true;
+	bus.getReplyLatency().setConfig(latency);
+	
+	// Latency of each read (retries included), reported only: timings depend
+	//     on the machine load. Servo 2 is disconnected for a while: recovery is
+	//     the time from its reconnection to its next reply, and its reads until then.
+	using Clock = std::chrono::steady_clock;
+	constexpr uint8_t Outage = 2;
+	std::vector<int64_t> latencyUs;
+	Clock::time_point backAt;
+	int64_t recoveryUs = -1;
+	int recoveryReads = 0;
+	int failures = 0;
+	for (int n=0; n<Reads; ++n)
+	{
+		if (1000==n) sim->removeServo(Outage);
+		if (1200==n)
+		{
+			sim->addServo(Outage);
+			backAt = Clock::now();
+		}
+		const uint8_t id = static_cast<uint8_t>(1+n%Servos);
+		const auto start = Clock::now();
+		const bool ok = HiwonderRpi::HiwonderBusServo(bus, id).posRead(std::nothrow).ok();
+		const auto end = Clock::now();
+		latencyUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end-start).count());
+		if (Outage==id && n>=1000)
+		{
+			if (n>=1200 && recoveryUs<0)
+			{
+				++recoveryReads;
+				if (ok) recoveryUs = std::chrono::duration_cast<std::chrono::microseconds>(end-backAt).count();
+			}
+			continue;
+		}
+		if (!ok) ++failures;
+	}
+	
+	std::sort(latencyUs.begin(), latencyUs.end());
+	const auto at = [&](double p){ return latencyUs[static_cast<size_t>(p/100*(latencyUs.size()-1))]; };
+	std::cout << "    " << sim->stats().faults << " faults, " << bus.stats().retries << " retries, "
+	    << failures << " failed reads; latency p50=" << at(50) << "us p99=" << at(99) << "us p99.9="
+	    << at(99.9) << "us max=" << at(100) << "us; recovery=" << recoveryUs << "us, "
+	    << recoveryReads << " reads" << std::endl;
+	
+	ASSERT(sim->stats().faults>100u);
+	ASSERT(failures*200<Reads);
+	// Most reads are answered at the first attempt
+	ASSERT(bus.stats().retries*10<static_cast<uint64_t>(Reads));
+	// Degraded while disconnected (most of its reads skipped), back within a
+	//     few of its reads: the first request after the reconnection, or the next one
+	ASSERT(bus.stats().skipped>0u);
+	ASSERT(recoveryUs>=0);
+	ASSERT(recoveryReads<=2*latency.degradedInterval);
+}
+
+UNIT_TEST(busGroup_drives_all_253_ids_over_virtual_buses)
+{
+	constexpr size_t Buses = 4;
+	constexpr size_t Servos = HiwonderRpi::HiwonderBus::BroadcastId-1;
+	HiwonderRpi::BusGroup group;
+	HiwonderRpi::SimulatedTransport* sims[Buses];
+	for (auto& sim: sims)
+	{
+		sim = new HiwonderRpi::SimulatedTransport();
+		group.addBus(std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim));
+	}
+	std::vector<uint8_t> ids;
+	std::vector<int16_t> positions;
+	for (size_t i=0; i<Servos; ++i)
+	{
+		const uint8_t id = static_cast<uint8_t>(i+1);
+		sims[i%Buses]->addServo(id);
+		group.assign(id, i%Buses);
+		ids.push_back(id);
+		positions.push_back(static_cast<int16_t>(100+3*i));
+	}
+	
+	std::vector<HiwonderRpi::ServoTelemetry> telemetry(Servos);
+	group.moveTimeWrite(ids.data(), positions.data(), Servos, 0);
+	group.poll(ids.data(), Servos, telemetry.data(), HiwonderRpi::ServoTelemetry::Position);
+	for (size_t i=0; i<Servos; ++i)
+	{
+		ASSERT(telemetry[i].valid);
+		ASSERT_EQ(telemetry[i].position, positions[i]);
+	}
+	// Each bus got the frames of its servos only
+	for (size_t b=0; b<Buses; ++b)
+	{
+		ASSERT_EQ(sims[b]->stats().replies, (Servos+Buses-1-b)/Buses);
+	}
+}
+
+UNIT_TEST(servo_handles_are_plain_values)
+{
+	static_assert(std::is_trivially_copyable<HiwonderRpi::HiwonderBusServo>::value, "");
+	static_assert(std::is_nothrow_move_constructible<HiwonderRpi::HiwonderBusServo>::value, "");
+	
+	auto* sim = new HiwonderRpi::SimulatedTransport();
+	HiwonderRpi::HiwonderBus bus{std::unique_ptr<HiwonderRpi::HiwonderTransport>(sim)};
+	std::vector<HiwonderRpi::HiwonderBusServo> servos;
+	for (uint8_t id=1; id<=200; ++id)
+	{
+		sim->addServo(id);
+		servos.emplace_back(bus, id); // reallocations move the handles
+	}
+	
+	// A copy addresses the same servo
+	HiwonderRpi::HiwonderBusServo copy = servos[41];
+	ASSERT_EQ((int)copy.getId(), 42);
+	ASSERT(&copy.getBus()==&bus);
+	copy.moveTimeWrite(777, 0);
+	ASSERT_EQ(servos[41].posRead(), 777);
+	
+	servos.erase(servos.begin());
+	ASSERT_EQ((int)servos.front().getId(), 2);
+	servos.front().moveTimeWrite(333, 0);
+	ASSERT_EQ(HiwonderRpi::HiwonderBusServo(bus, 2).posRead(), 333);
+}